@@ -0,0 +1,75 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Bench.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Host benchmark of Pico-Flash-Module. Runs flash_benchmark() over the emulated flash of Pico-Flash-Host.c and prints its CSV results on stdout, so that
+        they may be kept and compared between revisions of the module. The same results are given on the Pico by option 10 of Pico-Flash-Example.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host:   cmake -S . -B build-host -DPICO_FLASH_HOST=ON && cmake --build build-host
+
+            build-host/pico-flash-bench                 (32 iterations, erase / program times of the timing model added to the clock, no real wait)
+            build-host/pico-flash-bench 64 realtime     (64 iterations, really wait during erase / program, as the Pico would)
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(INT argc, CHAR *argv[])
+{
+  struct host_flash_config Config;
+  struct host_flash_stats  Stats;
+
+  UINT16 Iterations;
+
+  UINT8 ReturnCode;
+
+
+  Iterations = (argc > 1) ? atoi(argv[1]) : 32;
+
+  memset(&Config, 0, sizeof(Config));
+  Config.EraseUSec    = HOST_FLASH_ERASE_USEC;
+  Config.ProgramUSec  = HOST_FLASH_PROGRAM_USEC;
+  Config.FlagRealTime = ((argc > 2) && (strcmp(argv[2], "realtime") == 0)) ? FLAG_ON : FLAG_OFF;
+  if (host_flash_init(&Config))
+  {
+    fprintf(stderr, "Can't initialize emulated flash.\n");
+    return 1;
+  }
+
+  ReturnCode = flash_benchmark(FLASH_BENCH_OFFSET, FLASH_BENCH_SECTORS, Iterations);
+
+  /* Totals of the emulated flash on stderr, so that stdout remains pure CSV. */
+  host_flash_get_stats(&Stats);
+  fprintf(stderr, "Sectors erased: %u   Pages programmed: %u   Flash busy: %llu usec\n", Stats.EraseCount, Stats.ProgramCount, (unsigned long long)Stats.BusyUSec);
+  host_flash_close();
+
+  return ReturnCode;
+}
@@ -81,6 +81,8 @@ void uart_send(UINT LineNumber, const UCHAR *FunctionName, UCHAR *Format, ...);
                                  below the first sector. There are already 10 such offset defined in the Pico-Flash-Module.h include file.
                                                            They go from FLASH_DATA_OFFSET1 up to FLASH_DATA_OFFSET10
 \* ----------------------------------------------------------------------------------------------------------------------------------------------------------------- */
+/* NOTE: When FLASH_PAYLOAD_HEADER is enabled, Pico-Flash-Module saves a small header (FLASH_PAYLOAD_OFFSET bytes) in front of the structure, so it may use up to
+         FLASH_PAYLOAD_MAX_SIZE bytes. */
 struct flash_data
 {
   UCHAR  Version[12];              // for example, Firmware Version number.
@@ -116,6 +118,12 @@ struct flash_data
 \* ============================================================================================================================================================= */
 INT main()
 {
+  CHAR *HistogramName[4] = {"Sector erase", "Page program", "flash_save_data()", "Interrupts disabled"};
+
+  struct flash_histogram *Histogram[4];
+  struct flash_latency Latency;
+  struct flash_wear Wear;
+
   UCHAR String[256];
 
   UINT8 Delay;
@@ -126,10 +134,13 @@ INT main()
 
   UINT16 Crc16;
   UINT16 Loop1UInt16;
+  UINT16 Loop2UInt16;
 
   UINT32 Length;
   UINT32 Offset;
 
+  UINT64 EraseRate;
+
   stdio_init_all();
 
 
@@ -161,6 +172,9 @@ INT main()
   /* Start Firmware's endless loop. */
   while (1)
   {
+    /* Display the trace events recorded by Pico-Flash-Module during the last operation (this could also be done by core1). */
+    flash_trace_drain(0);
+
     printf("==================================================================\r");
     printf("                        Pico-Flash-Example\r");
     printf("   Pico's RAM memory area goes from 0x20000000 up to 0x2003FFFF\r");
@@ -176,7 +190,11 @@ INT main()
     printf("          5) Save current RAM variables to flash.\r");
     printf("          6) Wipe target sector of flash memory area.\r");
     printf("          7) Display technical information.\r");
-    printf("          8) Toggle Pico into upload mode.\r\r\r");
+    printf("          8) Toggle Pico into upload mode.\r");
+    printf("          9) Binary transfer with host tool (Pico-Flash-Tool).\r");
+    printf("         10) Benchmark flash operations.\r");
+    printf("         11) Display flash wear and projected endurance.\r");
+    printf("         12) Display flash latency histograms.\r\r\r");
     printf("                  Enter your choice: ");
     input_string(String);
 
@@ -283,7 +301,7 @@ INT main()
         printf("This is just an example to show how variables can be changed, than saved to flash.\r");
 
         printf("Current value for string variable <Version> is:\r\r");
-        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1), sizeof(FlashData.Version));
+        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET), sizeof(FlashData.Version));
         printf("Enter new string value for variable <Version> (max %u characters)\r", sizeof(FlashData.Version));
         printf("or simply <Enter> for no change: ");
         input_string(String);
@@ -295,7 +313,7 @@ INT main()
 
         printf("\r\r\r");
         printf("Current value for string variable <NetworkName> is:\r\r");
-        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1 + sizeof(FlashData.Version)), sizeof(FlashData.NetworkName));
+        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET + sizeof(FlashData.Version)), sizeof(FlashData.NetworkName));
         printf("Enter new string value for variable <NetworkName> (max %u characters)\r", sizeof(FlashData.NetworkName));
         printf("or simply <Enter> for no change: ");
         input_string(String);
@@ -307,7 +325,7 @@ INT main()
 
         printf("\r\r\r");
         printf("Current value for string variable <NetworkPassword> is:\r\r");
-        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1 + sizeof(FlashData.Version) + sizeof(FlashData.NetworkName)), sizeof(FlashData.NetworkName));
+        util_display_data((UINT8 *)(XIP_BASE + FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET + sizeof(FlashData.Version) + sizeof(FlashData.NetworkName)), sizeof(FlashData.NetworkName));
         printf("Enter new string value for variable <NetworkPassword> (max %u characters)\r", sizeof(FlashData.NetworkPassword));
         printf("or simply <Enter> for no change: ");
         input_string(String);
@@ -332,8 +350,20 @@ INT main()
         if ((String[0] == 'G') || (String[0] == 'g'))
         {
           printf("Saving variables to flash memory\r");
-          flash_save_data(FLASH_DATA_OFFSET1, (UINT8 *)&FlashData, sizeof(struct flash_data));
-          printf("Data has been saved to flash...\r");
+          switch (flash_save_data(FLASH_DATA_OFFSET1, (UINT8 *)&FlashData, sizeof(struct flash_data)))
+          {
+            case (FLASH_SAVE_WRITTEN):
+              printf("Data has been saved to flash...\r");
+            break;
+
+            case (FLASH_SAVE_SKIPPED):
+              printf("Flash already contains the same data, nothing has been written...\r");
+            break;
+
+            default:
+              printf("Error while saving data to flash...\r");
+            break;
+          }
         }
         else
         {
@@ -377,14 +407,14 @@ INT main()
         /* Display technical information. */
         printf("\r\r");
         printf("Size of structure FlashData):               %4u (0x%X)\r",  sizeof(FlashData), sizeof(FlashData));
-        printf("Address of structure FlashData:       0x%p                     [%X]\r", &FlashData, (XIP_BASE + FLASH_DATA_OFFSET1));
-        printf("Address of FlashData.Version:         0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Version,         ((UINT32)FlashData.Version -         (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.Version -         (UINT32)&FlashData)));
-        printf("Address of FlashData.NetworkName:     0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.NetworkName,     ((UINT32)FlashData.NetworkName -     (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.NetworkName -     (UINT32)&FlashData)));
-        printf("Address of FlashData.NetworkPassword: 0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.NetworkPassword, ((UINT32)FlashData.NetworkPassword - (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.NetworkPassword - (UINT32)&FlashData)));
-        /// printf("Address of FlashData.Variable8:       0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable8,       ((UINT32)FlashData.Variable8 -       (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.Variable8 -       (UINT32)&FlashData)));
-        /// printf("Address of FlashData.Variable16:      0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable16,      ((UINT32)FlashData.Variable16 -      (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.Variable16 -      (UINT32)&FlashData)));
-        /// printf("Address of FlashData.Variable32:      0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable32,      ((UINT32)FlashData.Variable32 -      (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)FlashData.Variable32 -      (UINT32)&FlashData)));
-        printf("Address of FlashData.Crc16:           0x%p (offset: 0x%4.4X)    [%X]\r", &FlashData.Crc16,           ((UINT32)&FlashData.Crc16 -          (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1) + ((UINT32)&FlashData.Crc16 -          (UINT32)&FlashData)));
+        printf("Address of structure FlashData:       0x%p                     [%X]\r", &FlashData, (XIP_BASE + FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET));
+        printf("Address of FlashData.Version:         0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Version,         ((UINT32)FlashData.Version -         (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.Version -         (UINT32)&FlashData)));
+        printf("Address of FlashData.NetworkName:     0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.NetworkName,     ((UINT32)FlashData.NetworkName -     (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.NetworkName -     (UINT32)&FlashData)));
+        printf("Address of FlashData.NetworkPassword: 0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.NetworkPassword, ((UINT32)FlashData.NetworkPassword - (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.NetworkPassword - (UINT32)&FlashData)));
+        /// printf("Address of FlashData.Variable8:       0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable8,       ((UINT32)FlashData.Variable8 -       (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.Variable8 -       (UINT32)&FlashData)));
+        /// printf("Address of FlashData.Variable16:      0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable16,      ((UINT32)FlashData.Variable16 -      (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.Variable16 -      (UINT32)&FlashData)));
+        /// printf("Address of FlashData.Variable32:      0x%p (offset: 0x%4.4X)    [%X]\r",  FlashData.Variable32,      ((UINT32)FlashData.Variable32 -      (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)FlashData.Variable32 -      (UINT32)&FlashData)));
+        printf("Address of FlashData.Crc16:           0x%p (offset: 0x%4.4X)    [%X]\r", &FlashData.Crc16,           ((UINT32)&FlashData.Crc16 -          (UINT32)&FlashData), (((UINT32)XIP_BASE + (UINT32)FLASH_DATA_OFFSET1 + FLASH_PAYLOAD_OFFSET) + ((UINT32)&FlashData.Crc16 -          (UINT32)&FlashData)));
         printf("Flash memory base address:            0x%X\r",        XIP_BASE);
         printf("FLASH_DATA_OFFSET1:                     0x%X\r",      FLASH_DATA_OFFSET1);
         printf("FLASH_DATA_OFFSET2:                     0x%X\r",      FLASH_DATA_OFFSET2);
@@ -410,6 +440,123 @@ INT main()
 
 
 
+      case (9):
+        /* Binary export / import of a flash range with the host tool. */
+        printf("\r\r");
+        printf("          Binary transfer with host tool.\r");
+        printf("         =================================\r\r");
+        printf("Close the terminal emulator and start Pico-Flash-Tool within 30 seconds, for example:\r");
+        printf("pico-flash-tool /dev/ttyACM0 export 0x%X 0x%X sectors.bin\r", FLASH_DATA_OFFSET1, FLASH_SECTOR_SIZE);
+        printf("pico-flash-tool /dev/ttyACM0 import 0x%X sector.bin\r\r", FLASH_DATA_OFFSET1);
+        stdio_flush();
+        if (flash_xfer_serve(30000))
+          printf("Binary transfer failed or timed out...\r\r");
+        else
+          printf("Binary transfer completed successfully.\r\r");
+      break;
+
+
+
+      case (10):
+        /* Benchmark of the main paths of Pico-Flash-Module. */
+        printf("\r\r");
+        printf("               Benchmark flash operations.\r");
+        printf("              =============================\r\r");
+        printf("Flash memory area from offset 0x%X up to 0x%X will be overwritten, then left erased.\r", FLASH_BENCH_OFFSET, FLASH_BENCH_OFFSET + (FLASH_BENCH_SECTORS * FLASH_SECTOR_SIZE) - 1);
+        printf("Results are CSV lines (latency in nsec) that may be captured from the terminal emulator. This takes about one minute.\r");
+        printf("Press <G> to proceed: ");
+        input_string(String);
+        if ((String[0] == 'G') || (String[0] == 'g'))
+        {
+          printf("\r\r");
+          flash_benchmark(FLASH_BENCH_OFFSET, FLASH_BENCH_SECTORS, 32);
+        }
+        else
+        {
+          printf("Operation aborted...\r\r");
+        }
+        printf("\r\r");
+      break;
+
+
+
+      case (11):
+        /* Wear statistics kept by Pico-Flash-Module, and remaining endurance of each data sector at the current erase rate. */
+        printf("\r\r");
+        printf("          Flash wear and projected endurance.\r");
+        printf("         =====================================\r\r");
+        if (flash_wear_save())  // so that counts displayed are also those kept after a power-off.
+          printf("Wear journal not enabled (FLASH_WEAR_JOURNAL), counts are those since power-up.\r\r");
+        flash_wear_get(&Wear);
+        if (Wear.PoweredSeconds == 0) Wear.PoweredSeconds = 1;
+        printf("Powered time:                   %lu hours %lu minutes\r", Wear.PoweredSeconds / 3600, (Wear.PoweredSeconds / 60) % 60);
+        printf("Bytes requested:                %llu\r", Wear.BytesRequested);
+        printf("Bytes programmed:               %llu\r", Wear.BytesProgrammed);
+        if (Wear.BytesRequested)
+          printf("Write amplification:            %llu.%2.2llu\r", Wear.BytesProgrammed / Wear.BytesRequested, ((Wear.BytesProgrammed * 100) / Wear.BytesRequested) % 100);
+        printf("Saves skipped (same data):      %lu\r", Wear.WritesSkipped);
+        printf("Saves coalesced (RAM cache):    %lu\r\r", Wear.WritesCoalesced);
+        printf("  Sector     Erases   Erases per day   Days left (%u cycles)\r", FLASH_WEAR_ENDURANCE);
+        for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_WEAR_SECTORS; ++Loop1UInt16)
+        {
+          EraseRate = ((UINT64)Wear.EraseCount[Loop1UInt16] * 86400) / Wear.PoweredSeconds;
+          printf("0x%6.6X   %8lu   %14llu   ", FLASH_DATA_OFFSET1 - (Loop1UInt16 * FLASH_SECTOR_SIZE), Wear.EraseCount[Loop1UInt16], EraseRate);
+          if (Wear.EraseCount[Loop1UInt16] >= FLASH_WEAR_ENDURANCE)
+            printf("worn out\r");
+          else if (Wear.EraseCount[Loop1UInt16] == 0)
+            printf("not erased yet\r");
+          else
+            printf("%llu\r", ((UINT64)(FLASH_WEAR_ENDURANCE - Wear.EraseCount[Loop1UInt16]) * Wear.PoweredSeconds) / ((UINT64)Wear.EraseCount[Loop1UInt16] * 86400));
+        }
+        printf("\r\r");
+      break;
+
+
+
+      case (12):
+        /* Latency histograms kept by Pico-Flash-Module since power-up (or last reset of the histograms). */
+        printf("\r\r");
+        printf("              Flash latency histograms.\r");
+        printf("             ===========================\r\r");
+        flash_latency_get(&Latency);
+        Histogram[0] = &Latency.Erase;
+        Histogram[1] = &Latency.Program;
+        Histogram[2] = &Latency.Save;
+        Histogram[3] = &Latency.IrqOff;
+        for (Loop1UInt16 = 0; Loop1UInt16 < 4; ++Loop1UInt16)
+        {
+          printf("%s: %lu samples", HistogramName[Loop1UInt16], Histogram[Loop1UInt16]->Samples);
+          if (Histogram[Loop1UInt16]->Samples == 0)
+          {
+            printf("\r\r");
+            continue;
+          }
+          printf("   average: %llu usec   max: %lu usec\r", Histogram[Loop1UInt16]->TotalUSec / Histogram[Loop1UInt16]->Samples, Histogram[Loop1UInt16]->MaxUSec);
+          for (Loop2UInt16 = 0; Loop2UInt16 < FLASH_LATENCY_BUCKETS; ++Loop2UInt16)
+          {
+            if (Histogram[Loop1UInt16]->Count[Loop2UInt16] == 0) continue;
+            if (Loop2UInt16 == 0)
+              printf("              0 usec: %8lu\r", Histogram[Loop1UInt16]->Count[Loop2UInt16]);
+            else if (Loop2UInt16 == (FLASH_LATENCY_BUCKETS - 1))
+              printf("   %7lu usec and more: %8lu\r", 1UL << (Loop2UInt16 - 1), Histogram[Loop1UInt16]->Count[Loop2UInt16]);
+            else
+              printf("   %7lu - %7lu usec: %8lu\r", 1UL << (Loop2UInt16 - 1), (1UL << Loop2UInt16) - 1, Histogram[Loop1UInt16]->Count[Loop2UInt16]);
+          }
+          printf("\r");
+        }
+        printf("Longest window with interrupts disabled: %lu usec\r\r", Latency.IrqOff.MaxUSec);
+        printf("Press <R> to reset histograms, any other key to continue: ");
+        input_string(String);
+        if ((String[0] == 'R') || (String[0] == 'r'))
+        {
+          flash_latency_reset();
+          printf("Histograms have been reset.\r");
+        }
+        printf("\r\r");
+      break;
+
+
+
       default:
         printf("\r\r");
         printf("                    Invalid choice... please re-enter [%s]  [%u]\r\r\r\r\r", String, Menu);
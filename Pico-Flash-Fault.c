@@ -0,0 +1,513 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Fault.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Power-loss campaign of Pico-Flash-Module over the emulated flash of Pico-Flash-Host.c. For each scenario, a previous version of data is committed,
+        then a new version is saved and power is cut during each erase and each page program of that save in turn, once right after the operation and once
+        halfway through it (torn data). After each cut, the read path of the module is run as it would be after a reset, and the data it returns is checked:
+            old     - previous version is returned.
+            new     - new version is returned.
+            lost    - read path reports that no valid data is found.
+            corrupt - read path returns data that is neither version (never acceptable).
+        The time taken by the read path (including flash_log_mount(), which may complete an interrupted reclaim) is reported as recovery time. The read path is
+        then run a second time, after another reset, and must give the same result.
+
+        Results (one CSV line per scenario on stdout):
+            save_data - flash_save_data() erases the sector, then programs it. It is not power-fail safe: a cut between the erase and the last page program
+                        loses the data, which flash_read_data() detects (bad header or CRC16). Data is never returned corrupted.
+            ab_save   - flash_ab_save() / flash_ab_read(): always the old or the new version.
+            log_write - flash_log_write() / flash_log_mount() + flash_log_read(), including the reclaim of the oldest sector: always the old or the new version.
+
+        Every run gives the same cuts and the same torn bits, so that a failure may be reproduced with the scenario name and cut number alone.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host:   cmake -S . -B build-host -DPICO_FLASH_HOST=ON && cmake --build build-host
+
+            build-host/pico-flash-fault                 (all scenarios, exit status 1 if any of them failed)
+            build-host/pico-flash-fault -v log_write    (one scenario, with the output of the module)
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+#define FAULT_DATA_SIZE         1000  // size of data saved by each scenario (CRC16 included).
+#define FAULT_LOG_RECORD        1     // record checked by the log_write scenario.
+#define FAULT_LOG_FILLER        2     // record used to fill the ring, so that the save of the new version reclaims the oldest sector.
+#define FAULT_LOG_FILL_COUNT    35    // versions of the filler record written before the new version (ring is then full up to the last sector).
+#define FAULT_MAX_CUTS          512   // maximum number of erases and page programs in the save of a scenario.
+
+/* Phases of a scenario, each one run in a child process. */
+#define FAULT_PREPARE           0     // commit the old version.
+#define FAULT_WORKLOAD          1     // save the new version (power may be cut).
+#define FAULT_RECOVER           2     // read path after a reset.
+
+/* Result of the read path. */
+#define FAULT_OLD               0
+#define FAULT_NEW               1
+#define FAULT_LOST              2
+#define FAULT_CORRUPT           3
+
+struct fault_scenario
+{
+  const CHAR *Name;
+  void  (*Prepare)(void);
+  UINT8 (*Workload)(void);
+  UINT8 (*Recover)(UINT8 *Data);     // returns 0 if valid data has been read.
+  UINT8 FlagPowerSafe;               // data must never be lost.
+};
+
+/* Shared with child processes. */
+static struct
+{
+  UINT32 Operations;                 // erases and page programs of the workload.
+  UINT8  Result;                     // FAULT_OLD, FAULT_NEW, etc.
+  UINT64 RecoveryUSec;               // time taken by the read path.
+} *Shared;
+
+static UINT8 DataOld[FAULT_DATA_SIZE];
+static UINT8 DataNew[FAULT_DATA_SIZE];
+static UINT8 FlagVerbose = FLAG_OFF;
+static UINT8 Image[PICO_FLASH_SIZE_BYTES];     // flash content once the old version has been committed.
+static UINT64 RecoveryUSec[FAULT_MAX_CUTS * 2];
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Run one phase of a scenario in a child process, and return its exit status (-1 if it has crashed). */
+static INT fault_run(const struct fault_scenario *Scenario, UINT8 Phase, const struct host_flash_fault *Fault);
+
+/* Run every power cut of a scenario and print its results. Returns the number of failures. */
+static UINT32 fault_scenario_run(const struct fault_scenario *Scenario);
+
+/* Scenario functions (prepare, workload, recover). */
+static void  ab_prepare(void);
+static UINT8 ab_recover(UINT8 *Data);
+static UINT8 ab_workload(void);
+static void  log_prepare(void);
+static UINT8 log_recover(UINT8 *Data);
+static UINT8 log_workload(void);
+static void  save_prepare(void);
+static UINT8 save_recover(UINT8 *Data);
+static UINT8 save_workload(void);
+
+static const struct fault_scenario Scenario[] =
+{
+  {"save_data", save_prepare, save_workload, save_recover, FLAG_OFF},
+  {"ab_save",   ab_prepare,   ab_workload,   ab_recover,   FLAG_ON},
+  {"log_write", log_prepare,  log_workload,  log_recover,  FLAG_ON},
+};
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(INT argc, CHAR *argv[])
+{
+  const CHAR *Name;
+
+  UINT16 Loop1UInt16;
+
+  UINT32 Failures;
+
+
+  Name = NULL;
+  for (Loop1UInt16 = 1; Loop1UInt16 < argc; ++Loop1UInt16)
+  {
+    if (strcmp(argv[Loop1UInt16], "-v") == 0)
+      FlagVerbose = FLAG_ON;
+    else
+      Name = argv[Loop1UInt16];
+  }
+
+  /* Two versions of data that differ in every byte. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < FAULT_DATA_SIZE; ++Loop1UInt16)
+  {
+    DataOld[Loop1UInt16] = Loop1UInt16 * 7;
+    DataNew[Loop1UInt16] = ~DataOld[Loop1UInt16];
+  }
+
+  Shared = mmap(NULL, sizeof(*Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if ((Shared == MAP_FAILED) || host_flash_init(NULL))
+  {
+    fprintf(stderr, "Can't initialize emulated flash.\n");
+    return 1;
+  }
+
+  printf("scenario,operations,cuts,old,new,lost,corrupt,recovery_p50_usec,recovery_max_usec\n");
+
+  Failures = 0;
+  for (Loop1UInt16 = 0; Loop1UInt16 < (sizeof(Scenario) / sizeof(Scenario[0])); ++Loop1UInt16)
+    if ((Name == NULL) || (strcmp(Name, Scenario[Loop1UInt16].Name) == 0)) Failures += fault_scenario_run(&Scenario[Loop1UInt16]);
+
+  host_flash_close();
+
+  return (Failures != 0);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=ab_prepare() */
+/* ============================================================================================================================================================= *\
+                                                                 A/B commit: commit the old version.
+\* ============================================================================================================================================================= */
+static void ab_prepare(void)
+{
+  flash_ab_save(FLASH_DATA_OFFSET2, FLASH_DATA_OFFSET1, DataOld, FAULT_DATA_SIZE);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=ab_recover() */
+/* ============================================================================================================================================================= *\
+                                                                   A/B commit: read path after a reset.
+\* ============================================================================================================================================================= */
+static UINT8 ab_recover(UINT8 *Data)
+{
+  return flash_ab_read(FLASH_DATA_OFFSET2, FLASH_DATA_OFFSET1, Data, FAULT_DATA_SIZE);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=ab_workload() */
+/* ============================================================================================================================================================= *\
+                                                                   A/B commit: save the new version.
+\* ============================================================================================================================================================= */
+static UINT8 ab_workload(void)
+{
+  return flash_ab_save(FLASH_DATA_OFFSET2, FLASH_DATA_OFFSET1, DataNew, FAULT_DATA_SIZE);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=fault_run() */
+/* ============================================================================================================================================================= *\
+                                       Run one phase of a scenario in a child process, and return its exit status (-1 if it has crashed).
+                 NOTE: The child has a fresh copy of RAM (as after a reset), but shares the emulated flash with the parent and with the other children.
+\* ============================================================================================================================================================= */
+static INT fault_run(const struct fault_scenario *Scenario, UINT8 Phase, const struct host_flash_fault *Fault)
+{
+  struct host_flash_stats Stats;
+
+  UINT8 Data[FAULT_DATA_SIZE];
+
+  INT   Status;
+  pid_t Child;
+
+  UINT64 TimeStamp;
+
+
+  fflush(stdout);
+  Child = fork();
+  if (Child < 0) return -1;
+
+  if (Child > 0)
+  {
+    if ((waitpid(Child, &Status, 0) != Child) || !WIFEXITED(Status)) return -1;
+    return WEXITSTATUS(Status);
+  }
+
+  /* Child process. Output of the module is only useful to investigate a failure. */
+  if (!FlagVerbose) freopen("/dev/null", "w", stdout);
+
+  switch (Phase)
+  {
+    case (FAULT_PREPARE):
+      Scenario->Prepare();
+    break;
+
+    case (FAULT_WORKLOAD):
+      host_flash_fault_arm(Fault);
+      if (Scenario->Workload()) _exit(2);
+      host_flash_get_stats(&Stats);
+      Shared->Operations = Stats.EraseCount + Stats.ProgramCount;
+    break;
+
+    case (FAULT_RECOVER):
+      memset(Data, 0, sizeof(Data));
+      TimeStamp = time_us_64();
+      if (Scenario->Recover(Data))
+        Shared->Result = FAULT_LOST;
+      else if (memcmp(Data, DataOld, FAULT_DATA_SIZE - 2) == 0)
+        Shared->Result = FAULT_OLD;
+      else if (memcmp(Data, DataNew, FAULT_DATA_SIZE - 2) == 0)
+        Shared->Result = FAULT_NEW;
+      else
+        Shared->Result = FAULT_CORRUPT;
+      Shared->RecoveryUSec = time_us_64() - TimeStamp;
+    break;
+  }
+
+  fflush(stdout);
+  _exit(0);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=fault_scenario_run() */
+/* ============================================================================================================================================================= *\
+                                                   Run every power cut of a scenario and print its results. Returns the number of failures.
+\* ============================================================================================================================================================= */
+static UINT32 fault_scenario_run(const struct fault_scenario *Scenario)
+{
+  static const CHAR *ResultName[4] = {"old", "new", "lost", "corrupt"};
+
+  struct host_flash_fault Fault;
+
+  UINT8 Result;
+  UINT8 Torn;
+
+  UINT32 Count[4];
+  UINT32 Cut;
+  UINT32 Cuts;
+  UINT32 Failures;
+  UINT32 Loop1UInt32;
+  UINT32 Loop2UInt32;
+  UINT32 Operations;
+
+  UINT64 Sample;
+
+
+  /* Commit the old version over blank flash, and keep the resulting image as the starting point of every cut. */
+  memset(Image, 0xFF, sizeof(Image));
+  host_flash_load(Image);
+  if (fault_run(Scenario, FAULT_PREPARE, NULL) != 0)
+  {
+    fprintf(stderr, "%s: preparation failed.\n", Scenario->Name);
+    return 1;
+  }
+  memcpy(Image, HostFlashXip, sizeof(Image));
+
+  /* Save without power cut, to count the operations of the save (and check that the new version is then read back). */
+  if ((fault_run(Scenario, FAULT_WORKLOAD, NULL) != 0) || (fault_run(Scenario, FAULT_RECOVER, NULL) != 0) || (Shared->Result != FAULT_NEW))
+  {
+    fprintf(stderr, "%s: save without power cut failed.\n", Scenario->Name);
+    return 1;
+  }
+  Operations = Shared->Operations;
+  if (Operations > FAULT_MAX_CUTS) Operations = FAULT_MAX_CUTS;
+
+  memset(Count, 0, sizeof(Count));
+  Cuts     = 0;
+  Failures = 0;
+  for (Cut = 1; Cut <= Operations; ++Cut)
+  {
+    for (Torn = FLAG_OFF; Torn <= FLAG_ON; ++Torn)
+    {
+      host_flash_load(Image);
+      Fault.CutAt    = Cut;
+      Fault.FlagTorn = Torn;
+      Fault.Seed     = (Cut * 2) + Torn;
+      if (fault_run(Scenario, FAULT_WORKLOAD, &Fault) != HOST_FLASH_POWER_CUT)
+      {
+        fprintf(stderr, "%s: cut %u%s: save didn't reach the power cut.\n", Scenario->Name, Cut, Torn ? " (torn)" : "");
+        ++Failures;
+        continue;
+      }
+
+      if (fault_run(Scenario, FAULT_RECOVER, NULL) != 0)
+      {
+        fprintf(stderr, "%s: cut %u%s: read path crashed.\n", Scenario->Name, Cut, Torn ? " (torn)" : "");
+        ++Failures;
+        continue;
+      }
+      Result = Shared->Result;
+      RecoveryUSec[Cuts++] = Shared->RecoveryUSec;
+      ++Count[Result];
+
+      /* A second reset must give the same result (anything repaired by the first read path must remain repaired). */
+      if ((fault_run(Scenario, FAULT_RECOVER, NULL) != 0) || (Shared->Result != Result))
+      {
+        fprintf(stderr, "%s: cut %u%s: second read path gave another result.\n", Scenario->Name, Cut, Torn ? " (torn)" : "");
+        ++Failures;
+      }
+
+      if ((Result == FAULT_CORRUPT) || ((Result == FAULT_LOST) && Scenario->FlagPowerSafe))
+      {
+        fprintf(stderr, "%s: cut %u%s: data %s.\n", Scenario->Name, Cut, Torn ? " (torn)" : "", ResultName[Result]);
+        ++Failures;
+      }
+    }
+  }
+
+  /* Insertion sort of recovery times, for the percentiles. */
+  for (Loop1UInt32 = 1; Loop1UInt32 < Cuts; ++Loop1UInt32)
+  {
+    Sample = RecoveryUSec[Loop1UInt32];
+    for (Loop2UInt32 = Loop1UInt32; (Loop2UInt32 > 0) && (RecoveryUSec[Loop2UInt32 - 1] > Sample); --Loop2UInt32)
+      RecoveryUSec[Loop2UInt32] = RecoveryUSec[Loop2UInt32 - 1];
+    RecoveryUSec[Loop2UInt32] = Sample;
+  }
+
+  printf("%s,%u,%u,%u,%u,%u,%u,%llu,%llu\n", Scenario->Name, Operations, Cuts, Count[FAULT_OLD], Count[FAULT_NEW], Count[FAULT_LOST], Count[FAULT_CORRUPT],
+         (unsigned long long)(Cuts ? RecoveryUSec[(Cuts - 1) / 2] : 0), (unsigned long long)(Cuts ? RecoveryUSec[Cuts - 1] : 0));
+
+  return Failures;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=log_prepare() */
+/* ============================================================================================================================================================= *\
+                                   Log-structured record store: commit the old version, then fill the ring until it is about to wrap around.
+\* ============================================================================================================================================================= */
+static void log_prepare(void)
+{
+  UINT8 Filler[FAULT_DATA_SIZE];
+
+  UINT16 Loop1UInt16;
+
+
+  flash_log_mount();
+  flash_log_write(FAULT_LOG_RECORD, DataOld, FAULT_DATA_SIZE);
+
+  memset(Filler, 0x5A, sizeof(Filler));
+  for (Loop1UInt16 = 0; Loop1UInt16 < FAULT_LOG_FILL_COUNT; ++Loop1UInt16)
+  {
+    Filler[0] = Loop1UInt16;
+    flash_log_write(FAULT_LOG_FILLER, Filler, FAULT_DATA_SIZE);
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=log_recover() */
+/* ============================================================================================================================================================= *\
+                                                       Log-structured record store: read path after a reset.
+\* ============================================================================================================================================================= */
+static UINT8 log_recover(UINT8 *Data)
+{
+  if (flash_log_mount()) return 1;
+
+  return flash_log_read(FAULT_LOG_RECORD, Data, FAULT_DATA_SIZE);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=log_workload() */
+/* ============================================================================================================================================================= *\
+                              Log-structured record store: save the new version (the oldest sector, holding the old version, is reclaimed first).
+\* ============================================================================================================================================================= */
+static UINT8 log_workload(void)
+{
+  if (flash_log_mount()) return 1;
+
+  return flash_log_write(FAULT_LOG_RECORD, DataNew, FAULT_DATA_SIZE);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=save_prepare() */
+/* ============================================================================================================================================================= *\
+                                                              flash_save_data(): commit the old version.
+\* ============================================================================================================================================================= */
+static void save_prepare(void)
+{
+  UINT8 Data[FAULT_DATA_SIZE];
+
+
+  memcpy(Data, DataOld, sizeof(Data));
+  flash_save_data(FLASH_DATA_OFFSET1, Data, FAULT_DATA_SIZE);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=save_recover() */
+/* ============================================================================================================================================================= *\
+                                                              flash_save_data(): read path after a reset.
+\* ============================================================================================================================================================= */
+static UINT8 save_recover(UINT8 *Data)
+{
+  return flash_read_data(FLASH_DATA_OFFSET1, Data, FAULT_DATA_SIZE);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=save_workload() */
+/* ============================================================================================================================================================= *\
+                                                              flash_save_data(): save the new version.
+\* ============================================================================================================================================================= */
+static UINT8 save_workload(void)
+{
+  UINT8 Data[FAULT_DATA_SIZE];
+
+
+  memcpy(Data, DataNew, sizeof(Data));
+
+  return (flash_save_data(FLASH_DATA_OFFSET1, Data, FAULT_DATA_SIZE) == FLASH_SAVE_ERROR);
+}
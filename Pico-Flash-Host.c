@@ -0,0 +1,743 @@
+/* ============================================================================================================================================================= *\
+   Pico-Flash-Host.c
+   Langage: C (Linux gcc)
+
+   Host (Linux) backend of Pico-Flash-Module. Replaces the few Pico SDK functions used by the module, with the Pico's flash emulated in an mmap'ed file.
+
+   NOTE:
+   THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+   WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+   TIME. AS A RESULT, THE AUTHOR SHALL NOT BE HELD LIABLE FOR ANY DIRECT,
+   INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING FROM
+   THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE CODING
+   INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCT.
+\* ============================================================================================================================================================= */
+
+
+
+/* ================================================================================================================================================================= *\
+                        The emulated flash behaves like the NOR flash of the Pico, so that the module may be run, benchmarked and tested on Linux:
+      - Flash content is mapped read-only at XIP_BASE. It may only be modified through flash_range_erase() and flash_range_program().
+      - An erase sets whole sectors to 0xFF. Offset and size must be multiples of FLASH_SECTOR_SIZE.
+      - A program can only clear bits (new content = old content AND data). Offset and size must be multiples of FLASH_PAGE_SIZE.
+      - A violation of those rules is reported and aborts the program, since it would corrupt flash (or crash the firmware) on the Pico.
+      - Each erase and program takes the time given by the timing model. By default, the time is not really waited: it only advances the clock seen by
+        time_us_64(), so that throughput and latency may be measured quickly (in CI, for example).
+      - The number of erases of each sector is kept, to measure wear.
+      - Power may be cut during any erase or page program (host_flash_fault_arm()), to check what the module recovers after a reset. The flash is shared
+        with child processes (MAP_SHARED), so that a workload may be run and "reset" in a child while its parent checks the recovery.
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Host.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+UINT8 *HostFlashXip = NULL;
+
+static struct host_flash_config HostFlashConfig;
+static struct host_flash_stats  HostFlashStats;
+
+static INT    HostFlashFile = -1;                          // file descriptor of the backing file (-1 if flash is in RAM only).
+static UINT8  FlagHostFlashInterrupts = FLAG_ON;           // FLAG_OFF between save_and_disable_interrupts() and restore_interrupts().
+static UINT32 HostFlashEraseCount[HOST_FLASH_SECTORS];     // erases of each sector since host_flash_init().
+static UINT64 HostFlashClockUSec;                          // time added to the real clock by the timing model (when not waited for real).
+static UINT64 HostFlashBootUSec;                           // real clock when host_flash_init() has been called ("boot" of the emulated Pico).
+
+static struct host_flash_fault HostFlashFault;             // power cut armed (CutAt = 0 if none).
+static UINT32 HostFlashOperations;                         // erases and page programs since host_flash_fault_arm().
+static UINT32 HostFlashRandom;                             // state of the pseudo-random sequence choosing torn bits.
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Wait for the specified time, according to the timing model (really, or only by advancing the clock). */
+static void host_flash_wait(UINT32 USec);
+
+/* Report a violation of the flash rules and abort. */
+static void host_flash_fault(const CHAR *Format, ...);
+
+/* Count an erase or page program, and check if power must be cut during this operation. */
+static UINT8 host_flash_power_check(void);
+
+/* Cut power: end the process at once, as a reset would. */
+static void host_flash_power_cut(void);
+
+/* Return the next byte of the pseudo-random sequence choosing torn bits. */
+static UINT8 host_flash_random(void);
+
+/* Allow or forbid writing to an area of the emulated flash. */
+static void host_flash_unlock(UINT32 Offset, UINT32 Size, UINT8 FlagUnlock);
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_range_erase() */
+/* ============================================================================================================================================================= *\
+                                                               Erase sectors of the emulated flash.
+\* ============================================================================================================================================================= */
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  UINT8 FlagCut;
+
+  UINT32 Loop1UInt32;
+  UINT32 Sector;
+
+
+  if (HostFlashXip == NULL) host_flash_fault("flash_range_erase() called before host_flash_init()");
+  if ((flash_offs % FLASH_SECTOR_SIZE) || (count % FLASH_SECTOR_SIZE))
+    host_flash_fault("flash_range_erase(0x%6.6X, 0x%X): offset and size must be multiples of 0x%X", flash_offs, (UINT32)count, FLASH_SECTOR_SIZE);
+  if ((flash_offs >= PICO_FLASH_SIZE_BYTES) || (count > (PICO_FLASH_SIZE_BYTES - flash_offs)))
+    host_flash_fault("flash_range_erase(0x%6.6X, 0x%X): range is outside of flash", flash_offs, (UINT32)count);
+
+  if (FlagHostFlashInterrupts) ++HostFlashStats.UnsafeCount;
+
+  for (Sector = flash_offs / FLASH_SECTOR_SIZE; Sector < ((flash_offs + count) / FLASH_SECTOR_SIZE); ++Sector)
+  {
+    FlagCut = host_flash_power_check();
+
+    host_flash_unlock(Sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE, FLAG_ON);
+    if (FlagCut && HostFlashFault.FlagTorn)
+    {
+      /* Erase interrupted: only some bits have been set back to 1. */
+      for (Loop1UInt32 = 0; Loop1UInt32 < FLASH_SECTOR_SIZE; ++Loop1UInt32)
+        HostFlashXip[(Sector * FLASH_SECTOR_SIZE) + Loop1UInt32] |= host_flash_random();
+    }
+    else
+      memset(&HostFlashXip[Sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE);
+    host_flash_unlock(Sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE, FLAG_OFF);
+    if (FlagCut) host_flash_power_cut();
+
+    ++HostFlashEraseCount[Sector];
+    ++HostFlashStats.EraseCount;
+    if (HostFlashEraseCount[Sector] > HostFlashStats.MaxSectorErase) HostFlashStats.MaxSectorErase = HostFlashEraseCount[Sector];
+    HostFlashStats.BusyUSec += HostFlashConfig.EraseUSec;
+    host_flash_wait(HostFlashConfig.EraseUSec);
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_range_program() */
+/* ============================================================================================================================================================= *\
+                                                              Program pages of the emulated flash.
+                                   NOTE: Like NOR flash, programming can only clear bits. An erase is required to set them back to 1.
+\* ============================================================================================================================================================= */
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+  UINT8 FlagCut;
+
+  UINT32 Loop1UInt32;
+  UINT32 Page;
+
+
+  if (HostFlashXip == NULL) host_flash_fault("flash_range_program() called before host_flash_init()");
+  if ((flash_offs % FLASH_PAGE_SIZE) || (count % FLASH_PAGE_SIZE))
+    host_flash_fault("flash_range_program(0x%6.6X, 0x%X): offset and size must be multiples of 0x%X", flash_offs, (UINT32)count, FLASH_PAGE_SIZE);
+  if ((flash_offs >= PICO_FLASH_SIZE_BYTES) || (count > (PICO_FLASH_SIZE_BYTES - flash_offs)))
+    host_flash_fault("flash_range_program(0x%6.6X, 0x%X): range is outside of flash", flash_offs, (UINT32)count);
+
+  if (FlagHostFlashInterrupts) ++HostFlashStats.UnsafeCount;
+
+  for (Page = 0; Page < count; Page += FLASH_PAGE_SIZE)
+  {
+    FlagCut = host_flash_power_check();
+
+    /* Program interrupted: only some bits have been cleared. */
+    host_flash_unlock(flash_offs + Page, FLASH_PAGE_SIZE, FLAG_ON);
+    for (Loop1UInt32 = Page; Loop1UInt32 < (Page + FLASH_PAGE_SIZE); ++Loop1UInt32)
+      HostFlashXip[flash_offs + Loop1UInt32] &= (FlagCut && HostFlashFault.FlagTorn) ? (data[Loop1UInt32] | host_flash_random()) : data[Loop1UInt32];
+    host_flash_unlock(flash_offs + Page, FLASH_PAGE_SIZE, FLAG_OFF);
+    if (FlagCut) host_flash_power_cut();
+
+    ++HostFlashStats.ProgramCount;
+    HostFlashStats.BytesProgrammed += FLASH_PAGE_SIZE;
+    HostFlashStats.BusyUSec        += HostFlashConfig.ProgramUSec;
+    host_flash_wait(HostFlashConfig.ProgramUSec);
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=get_core_num() */
+/* ============================================================================================================================================================= *\
+                                                          Return the core number (the host always runs as core 0).
+\* ============================================================================================================================================================= */
+uint get_core_num(void)
+{
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=getchar_timeout_us() */
+/* ============================================================================================================================================================= *\
+                                                     Read a character from stdin, or return PICO_ERROR_TIMEOUT after the time-out.
+\* ============================================================================================================================================================= */
+int getchar_timeout_us(uint32_t timeout_us)
+{
+  struct pollfd Poll;
+
+  UINT8 Character;
+
+
+  Poll.fd     = STDIN_FILENO;
+  Poll.events = POLLIN;
+  if (poll(&Poll, 1, timeout_us / 1000) <= 0) return PICO_ERROR_TIMEOUT;
+  if (read(STDIN_FILENO, &Character, 1) != 1) return PICO_ERROR_TIMEOUT;
+
+  return Character;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_close() */
+/* ============================================================================================================================================================= *\
+                                                          Release the emulated flash (the backing file keeps its content).
+\* ============================================================================================================================================================= */
+void host_flash_close(void)
+{
+  if (HostFlashXip == NULL) return;
+
+  if (HostFlashFile >= 0)
+  {
+    msync(HostFlashXip, PICO_FLASH_SIZE_BYTES, MS_SYNC);
+    close(HostFlashFile);
+    HostFlashFile = -1;
+  }
+  munmap(HostFlashXip, PICO_FLASH_SIZE_BYTES);
+  HostFlashXip = NULL;
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_erase_count() */
+/* ============================================================================================================================================================= *\
+                                        Return the number of times a sector of the emulated flash has been erased since host_flash_init().
+\* ============================================================================================================================================================= */
+UINT32 host_flash_erase_count(UINT16 SectorNumber)
+{
+  if (SectorNumber >= HOST_FLASH_SECTORS) return 0;
+
+  return HostFlashEraseCount[SectorNumber];
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_fault() */
+/* ============================================================================================================================================================= *\
+                                                                Report a violation of the flash rules and abort.
+\* ============================================================================================================================================================= */
+static void host_flash_fault(const CHAR *Format, ...)
+{
+  va_list argp;
+
+
+  fprintf(stderr, "*** FLASH FAULT *** ");
+  va_start(argp, Format);
+  vfprintf(stderr, Format, argp);
+  va_end(argp);
+  fprintf(stderr, "\n");
+
+  abort();
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_fault_arm() */
+/* ============================================================================================================================================================= *\
+                                                Arm a power cut in the emulated flash, or disarm it if Fault is NULL.
+\* ============================================================================================================================================================= */
+void host_flash_fault_arm(const struct host_flash_fault *Fault)
+{
+  if (Fault != NULL)
+    HostFlashFault = *Fault;
+  else
+    memset(&HostFlashFault, 0, sizeof(HostFlashFault));
+
+  HostFlashOperations = 0;
+  HostFlashRandom     = HostFlashFault.Seed;
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_get_stats() */
+/* ============================================================================================================================================================= *\
+                                                                  Retrieve statistics of the emulated flash.
+\* ============================================================================================================================================================= */
+void host_flash_get_stats(struct host_flash_stats *Stats)
+{
+  *Stats = HostFlashStats;
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_init() */
+/* ============================================================================================================================================================= *\
+                                                  Map the emulated flash. Must be called before any function of Pico-Flash-Module.
+                NOTES: A backing file that doesn't exist (or is too small) is extended with blank flash (0xFF). Config may be NULL (flash in RAM only,
+                       default timing model). Returns 1 if the backing file can't be opened or mapped.
+\* ============================================================================================================================================================= */
+UINT8 host_flash_init(const struct host_flash_config *Config)
+{
+  struct stat Stat;
+
+  UINT8 Blank[FLASH_SECTOR_SIZE];
+
+  off_t FileSize;
+
+
+  host_flash_close();
+
+  if (Config != NULL)
+    HostFlashConfig = *Config;
+  else
+  {
+    memset(&HostFlashConfig, 0, sizeof(HostFlashConfig));
+    HostFlashConfig.EraseUSec   = HOST_FLASH_ERASE_USEC;
+    HostFlashConfig.ProgramUSec = HOST_FLASH_PROGRAM_USEC;
+  }
+  memset(&HostFlashStats, 0, sizeof(HostFlashStats));
+  memset(HostFlashEraseCount, 0, sizeof(HostFlashEraseCount));
+  HostFlashClockUSec      = 0;
+  HostFlashBootUSec       = 0;
+  HostFlashBootUSec       = time_us_64();
+  FlagHostFlashInterrupts = FLAG_ON;
+  host_flash_fault_arm(NULL);
+
+  if (HostFlashConfig.FileName == NULL)
+  {
+    HostFlashXip = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (HostFlashXip == MAP_FAILED)
+    {
+      HostFlashXip = NULL;
+      return 1;
+    }
+    memset(HostFlashXip, 0xFF, PICO_FLASH_SIZE_BYTES);
+    host_flash_unlock(0, PICO_FLASH_SIZE_BYTES, FLAG_OFF);
+
+    return 0;
+  }
+
+  HostFlashFile = open(HostFlashConfig.FileName, O_RDWR | O_CREAT, 0644);
+  if ((HostFlashFile < 0) || (fstat(HostFlashFile, &Stat) != 0))
+  {
+    fprintf(stderr, "Can't open flash image %s\n", HostFlashConfig.FileName);
+    return 1;
+  }
+
+  /* Extend a new (or truncated) image with blank flash. */
+  memset(Blank, 0xFF, sizeof(Blank));
+  for (FileSize = Stat.st_size - (Stat.st_size % FLASH_SECTOR_SIZE); FileSize < PICO_FLASH_SIZE_BYTES; FileSize += FLASH_SECTOR_SIZE)
+  {
+    if (pwrite(HostFlashFile, Blank, sizeof(Blank), FileSize) != sizeof(Blank))
+    {
+      fprintf(stderr, "Can't extend flash image %s\n", HostFlashConfig.FileName);
+      close(HostFlashFile);
+      HostFlashFile = -1;
+      return 1;
+    }
+  }
+
+  HostFlashXip = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ, MAP_SHARED, HostFlashFile, 0);
+  if (HostFlashXip == MAP_FAILED)
+  {
+    HostFlashXip = NULL;
+    close(HostFlashFile);
+    HostFlashFile = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_load() */
+/* ============================================================================================================================================================= *\
+                     Replace the whole content of the emulated flash with an image (PICO_FLASH_SIZE_BYTES bytes), as a programmer would (nothing is counted).
+\* ============================================================================================================================================================= */
+void host_flash_load(const UINT8 *Image)
+{
+  if (HostFlashXip == NULL) host_flash_fault("host_flash_load() called before host_flash_init()");
+
+  host_flash_unlock(0, PICO_FLASH_SIZE_BYTES, FLAG_ON);
+  memcpy(HostFlashXip, Image, PICO_FLASH_SIZE_BYTES);
+  host_flash_unlock(0, PICO_FLASH_SIZE_BYTES, FLAG_OFF);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_power_check() */
+/* ============================================================================================================================================================= *\
+                                        Count an erase or page program, and check if power must be cut during this operation.
+\* ============================================================================================================================================================= */
+static UINT8 host_flash_power_check(void)
+{
+  ++HostFlashOperations;
+
+  return ((HostFlashFault.CutAt != 0) && (HostFlashOperations == HostFlashFault.CutAt));
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_power_cut() */
+/* ============================================================================================================================================================= *\
+                                                            Cut power: end the process at once, as a reset would.
+                  NOTE: Flash content is already in the shared mapping (and in the backing file, if any). Nothing else of the process is kept.
+\* ============================================================================================================================================================= */
+static void host_flash_power_cut(void)
+{
+  fflush(stdout);
+  _exit(HOST_FLASH_POWER_CUT);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_random() */
+/* ============================================================================================================================================================= *\
+                                                    Return the next byte of the pseudo-random sequence choosing torn bits.
+                                         NOTE: Simple linear congruential generator, same sequence on every host for a given seed.
+\* ============================================================================================================================================================= */
+static UINT8 host_flash_random(void)
+{
+  HostFlashRandom = (HostFlashRandom * 1103515245u) + 12345u;
+
+  return (UINT8)(HostFlashRandom >> 16);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_unlock() */
+/* ============================================================================================================================================================= *\
+                                                          Allow or forbid writing to an area of the emulated flash.
+             NOTE: Only the host memory pages covering the area are changed, which is much faster than changing the whole mapping for each page program.
+\* ============================================================================================================================================================= */
+static void host_flash_unlock(UINT32 Offset, UINT32 Size, UINT8 FlagUnlock)
+{
+  UINT32 PageSize;
+
+
+  PageSize = (UINT32)sysconf(_SC_PAGESIZE);
+  Size    += Offset % PageSize;
+  Offset  -= Offset % PageSize;
+
+  mprotect(HostFlashXip + Offset, Size, FlagUnlock ? (PROT_READ | PROT_WRITE) : PROT_READ);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=host_flash_wait() */
+/* ============================================================================================================================================================= *\
+                                   Wait for the specified time, according to the timing model (really, or only by advancing the clock).
+\* ============================================================================================================================================================= */
+static void host_flash_wait(UINT32 USec)
+{
+  struct timespec Delay;
+
+
+  if (HostFlashConfig.FlagRealTime)
+  {
+    Delay.tv_sec  = USec / 1000000;
+    Delay.tv_nsec = (USec % 1000000) * 1000;
+    while (nanosleep(&Delay, &Delay) != 0);
+  }
+  else
+    HostFlashClockUSec += USec;
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=multicore_lockout_end_blocking() */
+/* ============================================================================================================================================================= *\
+                                                            Release the other core (there is no other core on the host).
+\* ============================================================================================================================================================= */
+void multicore_lockout_end_blocking(void)
+{
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=multicore_lockout_start_blocking() */
+/* ============================================================================================================================================================= *\
+                                                             Park the other core (there is no other core on the host).
+\* ============================================================================================================================================================= */
+void multicore_lockout_start_blocking(void)
+{
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=multicore_lockout_victim_is_initialized() */
+/* ============================================================================================================================================================= *\
+                                                   Check if the other core may be parked (there is no other core on the host).
+\* ============================================================================================================================================================= */
+bool multicore_lockout_victim_is_initialized(uint core_num)
+{
+  return false;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=putchar_raw() */
+/* ============================================================================================================================================================= *\
+                                                              Send a character to stdout, without translation.
+\* ============================================================================================================================================================= */
+int putchar_raw(int c)
+{
+  return putchar(c);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=restore_interrupts() */
+/* ============================================================================================================================================================= *\
+                                                       Restore the interrupt state saved by save_and_disable_interrupts().
+\* ============================================================================================================================================================= */
+void restore_interrupts(uint32_t status)
+{
+  FlagHostFlashInterrupts = (status != 0);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=save_and_disable_interrupts() */
+/* ============================================================================================================================================================= *\
+                                                    Disable interrupts and return the previous state (only tracked on the host).
+\* ============================================================================================================================================================= */
+uint32_t save_and_disable_interrupts(void)
+{
+  uint32_t Status;
+
+
+  Status                  = FlagHostFlashInterrupts;
+  FlagHostFlashInterrupts = FLAG_OFF;
+
+  return Status;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=sleep_ms() */
+/* ============================================================================================================================================================= *\
+                                                                    Pause for specified number of msec.
+\* ============================================================================================================================================================= */
+void sleep_ms(uint32_t ms)
+{
+  host_flash_wait(ms * 1000);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=stdio_flush() */
+/* ============================================================================================================================================================= *\
+                                                                        Send all buffered output.
+\* ============================================================================================================================================================= */
+void stdio_flush(void)
+{
+  fflush(stdout);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=stdio_init_all() */
+/* ============================================================================================================================================================= *\
+                                                                 Initialize stdio (nothing to do on the host).
+\* ============================================================================================================================================================= */
+bool stdio_init_all(void)
+{
+  return true;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=stdio_usb_connected() */
+/* ============================================================================================================================================================= *\
+                                                             Check if a terminal is connected (stdout on the host).
+\* ============================================================================================================================================================= */
+bool stdio_usb_connected(void)
+{
+  return true;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=time_us_32() */
+/* ============================================================================================================================================================= *\
+                                                        Return the lower 32 bits of the time since boot (in usec).
+\* ============================================================================================================================================================= */
+uint32_t time_us_32(void)
+{
+  return (uint32_t)time_us_64();
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=time_us_64() */
+/* ============================================================================================================================================================= *\
+                   Return the time since boot (in usec): real monotonic clock since host_flash_init(), plus the time added by the timing model.
+\* ============================================================================================================================================================= */
+uint64_t time_us_64(void)
+{
+  struct timespec Now;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+
+  return ((uint64_t)Now.tv_sec * 1000000) + (Now.tv_nsec / 1000) - HostFlashBootUSec + HostFlashClockUSec;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=uart_send() */
+/* ============================================================================================================================================================= *\
+                                         Send a string to stdout. May be replaced by the uart_send() of the host program, if it has its own.
+\* ============================================================================================================================================================= */
+__attribute__((weak)) void uart_send(UINT LineNumber, const UCHAR *FunctionName, UCHAR *Format, ...)
+{
+  va_list argp;
+
+
+  printf("[%7u] - [%-25s] - ", LineNumber, FunctionName);
+  va_start(argp, Format);
+  vprintf((CHAR *)Format, argp);
+  va_end(argp);
+  printf("\n");
+
+  return;
+}
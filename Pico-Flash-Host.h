@@ -0,0 +1,156 @@
+/* ============================================================================================================================================================= *\
+   Pico-Flash-Host.h
+   Langage: C (Linux gcc)
+
+   Host (Linux) backend of Pico-Flash-Module. Replaces the few Pico SDK functions used by the module, with the Pico's flash emulated in an mmap'ed file.
+   Selected when Pico-Flash-Module is built with PICO_FLASH_HOST defined (cmake -DPICO_FLASH_HOST=ON). Power cuts may be injected in erase and program.
+
+   NOTE:
+   THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+   WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+   TIME. AS A RESULT, THE AUTHOR SHALL NOT BE HELD LIABLE FOR ANY DIRECT,
+   INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING FROM
+   THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE CODING
+   INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCT.
+\* ============================================================================================================================================================= */
+
+#ifndef __PICO_FLASH_HOST_H
+#define __PICO_FLASH_HOST_H
+
+/* $PAGE */
+/* $TITLE=Include files. */
+/* ============================================================================================================================================================= *\
+                                                                        Include files.
+\* ============================================================================================================================================================= */
+#include "baseline.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+
+
+/* $PAGE */
+/* $TITLE=Definitions */
+/* ============================================================================================================================================================= *\
+                                                                        Definitions.
+\* ============================================================================================================================================================= */
+/* Same geometry as the Pico's flash. */
+#define FLASH_PAGE_SIZE         (1u << 8)
+#define FLASH_SECTOR_SIZE       (1u << 12)
+#define PICO_FLASH_SIZE_BYTES   (2 * 1024 * 1024)
+#define HOST_FLASH_SECTORS      (PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE)
+
+/* Emulated flash is mapped read-only at this address (writing to it through XIP_BASE crashes, as it would on the Pico). */
+#define XIP_BASE                ((uintptr_t)HostFlashXip)
+#define XIP_NOCACHE_NOALLOC_BASE XIP_BASE
+
+/* Default timing model (typical values of the W25Q16JV flash of the Pico). */
+#define HOST_FLASH_ERASE_USEC   45000  // sector erase.
+#define HOST_FLASH_PROGRAM_USEC 700    // page program.
+
+/* Exit status of a process whose power has been cut by the fault injection (see host_flash_fault_arm()). */
+#define HOST_FLASH_POWER_CUT    99
+
+#define PICO_ERROR_TIMEOUT      -1
+
+/* Data memory barrier. */
+#define __dmb()                 __sync_synchronize()
+
+typedef unsigned int uint;
+
+
+
+/* $PAGE */
+/* $TITLE=Structures */
+/* ============================================================================================================================================================= *\
+                                                                        Structures.
+\* ============================================================================================================================================================= */
+/* Configuration of the emulated flash, given to host_flash_init(). */
+struct host_flash_config
+{
+  const CHAR *FileName;      // file backing the emulated flash (created blank if it doesn't exist). NULL = flash in RAM only.
+  UINT32      EraseUSec;     // time taken by a sector erase.
+  UINT32      ProgramUSec;   // time taken by a page program.
+  UINT8       FlagRealTime;  // FLAG_ON: really wait during erase / program. FLAG_OFF: only advance the clock seen by time_us_64() (faster, for CI).
+};
+
+
+/* Power cut injected in the emulated flash. Operations are counted from host_flash_fault_arm(): each sector erase and each page program is one operation.
+   Power is cut during operation number CutAt: once it is completed, or halfway (FlagTorn), leaving some bits of the sector (erase) or of the page (program)
+   in their old state. Bits left behind are chosen by a pseudo-random sequence starting at Seed, so that a given fault always gives the same flash content.
+   The process then ends at once with the exit status HOST_FLASH_POWER_CUT, which loses RAM content as a reset of the Pico would. The workload is thus
+   expected to be run in a child process (fork()), the parent then running the recovery in another child, over the same emulated flash. */
+struct host_flash_fault
+{
+  UINT32 CutAt;              // operation during which power is cut (1 = first operation after host_flash_fault_arm(), 0 = never).
+  UINT8  FlagTorn;           // FLAG_ON: operation is interrupted halfway. FLAG_OFF: power is cut right after the operation.
+  UINT32 Seed;               // start of the pseudo-random sequence choosing torn bits.
+};
+
+
+/* Statistics of the emulated flash. */
+struct host_flash_stats
+{
+  UINT32 EraseCount;         // sectors erased.
+  UINT32 ProgramCount;       // pages programmed.
+  UINT64 BytesProgrammed;    // bytes programmed (full pages).
+  UINT64 BusyUSec;           // total time spent in erase / program, according to the timing model.
+  UINT32 MaxSectorErase;     // highest erase count of a single sector.
+  UINT32 UnsafeCount;        // erase / program done while interrupts were enabled (the Pico would crash if an interrupt handler ran from flash).
+};
+
+
+
+/* $PAGE */
+/* $TITLE=Function prototypes */
+/* ============================================================================================================================================================= *\
+                                                                      Function prototypes.
+\* ============================================================================================================================================================= */
+/* Release the emulated flash (the backing file keeps its content). */
+void host_flash_close(void);
+
+/* Return the number of times a sector of the emulated flash has been erased since host_flash_init(). */
+UINT32 host_flash_erase_count(UINT16 SectorNumber);
+
+/* Arm a power cut in the emulated flash, or disarm it if Fault is NULL. */
+void host_flash_fault_arm(const struct host_flash_fault *Fault);
+
+/* Retrieve statistics of the emulated flash. */
+void host_flash_get_stats(struct host_flash_stats *Stats);
+
+/* Map the emulated flash. Must be called before any function of Pico-Flash-Module. */
+UINT8 host_flash_init(const struct host_flash_config *Config);
+
+/* Replace the whole content of the emulated flash with an image (PICO_FLASH_SIZE_BYTES bytes), as a programmer would (nothing is counted). */
+void host_flash_load(const UINT8 *Image);
+
+
+/* Pico SDK functions used by Pico-Flash-Module. */
+void     flash_range_erase(uint32_t flash_offs, size_t count);
+void     flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+uint     get_core_num(void);
+int      getchar_timeout_us(uint32_t timeout_us);
+void     multicore_lockout_end_blocking(void);
+void     multicore_lockout_start_blocking(void);
+bool     multicore_lockout_victim_is_initialized(uint core_num);
+int      putchar_raw(int c);
+void     restore_interrupts(uint32_t status);
+uint32_t save_and_disable_interrupts(void);
+void     sleep_ms(uint32_t ms);
+void     stdio_flush(void);
+bool     stdio_init_all(void);
+bool     stdio_usb_connected(void);
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+
+
+
+/* $PAGE */
+/* $TITLE=Global variables */
+/* ============================================================================================================================================================= *\
+                                                                      Global variables.
+\* ============================================================================================================================================================= */
+/* Emulated flash, as seen through XIP_BASE. */
+extern UINT8 *HostFlashXip;
+
+#endif  // __PICO_FLASH_HOST_H
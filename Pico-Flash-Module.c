@@ -32,6 +32,145 @@
 /* ============================================================================================================================================================= *\
                                                                     Global variables.
 \* ============================================================================================================================================================= */
+#if (CRC16_ENGINE != CRC16_ENGINE_BITWISE)
+/* Lookup tables for the table-driven CRC16 engines. Table [n] gives the CRC16 contribution of a byte followed by <n> other bytes. */
+static UINT16 Crc16Table[CRC16_ENGINE][256];
+static volatile UINT8 FlagCrc16TableReady = FLAG_OFF;  // set only once all tables are complete (see util_crc16_table_init()).
+#endif  // CRC16_ENGINE
+
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+/* Asynchronous save engine. Queue slots, and state of the save being written. */
+static struct
+{
+  volatile UINT8        Status;    // FLASH_ASYNC_xxx, set to FLASH_ASYNC_QUEUED last when submitting.
+  UINT8                *Data;
+  UINT16                DataSize;
+  UINT32                DataOffset;
+  UINT32                Ticket;    // submission order.
+  flash_async_callback  Callback;
+  void                 *Context;
+} FlashAsyncQueue[FLASH_ASYNC_QUEUE_SIZE];
+
+static INT16  FlashAsyncActive = -1;  // queue slot being written, -1 if none.
+static UINT8  FlashAsyncStep;         // next step of the save being written.
+static UINT16 FlashAsyncPages;        // pages still to be programmed (one bit per page).
+static UINT32 FlashAsyncTicket;       // ticket of the last save submitted.
+static UINT8  FlashAsyncSector[FLASH_SECTOR_SIZE] __attribute__((aligned(4)));  // sector image of the save being written.
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+
+/* Areas of flash whose CRC16 has been validated by flash_get_view(). */
+static struct
+{
+  UINT8  FlagValid;
+  UINT16 DataSize;
+  UINT32 DataOffset;
+} FlashViewCache[FLASH_VIEW_CACHE_SIZE];
+
+static UINT8 FlashViewNext;  // next entry of FlashViewCache[] to be replaced.
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* Write-back RAM cache of sectors saved with flash_save_data(). */
+static struct
+{
+  UINT8  Data[FLASH_SECTOR_SIZE] __attribute__((aligned(4)));
+  UINT8  FlagValid;
+  UINT8  FlagDirty;
+  UINT16 DirtyCount;    // number of saves since the sector has been written to flash.
+  UINT32 SectorOffset;
+  UINT64 LastUpdate;    // time stamp of last save or load (in usec).
+} FlashCache[FLASH_CACHE_SECTORS];
+#endif  // FLASH_CACHE_SECTORS
+
+/* Scratch buffer used to stage a sector before writing it to flash. */
+#if (FLASH_SCRATCH_SIZE > 0)
+static UINT8 FlashScratchStatic[FLASH_SCRATCH_SIZE] __attribute__((aligned(4)));
+static UINT8 *FlashScratch     = FlashScratchStatic;
+static UINT32 FlashScratchSize = FLASH_SCRATCH_SIZE;
+#else   // FLASH_SCRATCH_SIZE
+static UINT8 *FlashScratch     = NULL;
+static UINT32 FlashScratchSize = 0;
+#endif  // FLASH_SCRATCH_SIZE
+static volatile UINT8 FlagFlashScratchBusy = FLAG_OFF;
+static UINT32 FlashScratchInUse;  // bytes requested by the current user of the scratch buffer.
+
+/* Statistics of flash operations. */
+static struct flash_stats FlashStats;
+
+#if (FLASH_BENCH_SECTORS > 0)
+/* Benchmark: data written to flash (inverted at each iteration, so that every write really erases and programs), and latency of each iteration in nsec. */
+static UINT8  FlashBenchData[FLASH_BENCH_SECTORS * FLASH_SECTOR_SIZE] __attribute__((aligned(4)));
+static UINT32 FlashBenchSample[FLASH_BENCH_SAMPLES];
+#endif  // FLASH_BENCH_SECTORS
+
+#if (FLASH_TRACE_SIZE > 0)
+/* Binary trace ring. FlashTraceHead is only written by flash_trace_add() (producer) and FlashTraceTail only by flash_trace_drain() (consumer).
+   Both are free-running counters, the slot used is the counter modulo FLASH_TRACE_SIZE. */
+static struct flash_trace_event FlashTrace[FLASH_TRACE_SIZE];
+static volatile UINT32 FlashTraceHead;
+static volatile UINT32 FlashTraceTail;
+#endif  // FLASH_TRACE_SIZE
+
+#if (FLASH_LATENCY > 0)
+/* Latency histograms, since power-up or last flash_latency_reset(). */
+static struct flash_latency FlashLatency;
+#endif  // FLASH_LATENCY
+
+#ifdef FLASH_MULTICORE_LOCKOUT
+/* Time stamp when the other core has been parked. */
+static UINT64 FlashLockoutTimeStamp;
+#endif  // FLASH_MULTICORE_LOCKOUT
+
+/* Log-structured record store. Ring sectors, in the order they are used. */
+static const UINT32 FlashLogSectorOffset[FLASH_LOG_SECTORS] = {FLASH_DATA_OFFSET1, FLASH_DATA_OFFSET2, FLASH_DATA_OFFSET3, FLASH_DATA_OFFSET4, FLASH_DATA_OFFSET5,
+                                                               FLASH_DATA_OFFSET6, FLASH_DATA_OFFSET7, FLASH_DATA_OFFSET8, FLASH_DATA_OFFSET9, FLASH_DATA_OFFSET10};
+
+/* RAM index of the latest version of each record in the log-structured record store, and hash table of entries by record ID (-1 when free).
+   The index is also saved as is in checkpoint records. */
+static struct flash_log_entry
+{
+  UINT16 RecordId;
+  UINT16 DataSize;
+  UINT16 Flags;     // FLASH_LOG_FLAG_xxx of the latest version.
+  UINT32 Sequence;
+  UINT32 Offset;    // flash offset of the record header.
+} FlashLogIndex[FLASH_LOG_MAX_RECORDS];
+
+static INT16 FlashLogHash[FLASH_LOG_HASH_SIZE];
+
+static UINT8  FlagFlashLogMounted = FLAG_OFF;
+static UINT8  FlashLogHead;                                // ring sector currently being written.
+static UINT16 FlashLogRecordCount;                         // number of entries used in FlashLogIndex[].
+static UINT32 FlashLogEraseCount[FLASH_LOG_SECTORS];       // erases of each ring sector since power-up.
+static UINT32 FlashLogSequence;                            // sequence number of the last record written.
+static UINT32 FlashLogWriteOffset;                         // offset of free space in the head sector.
+static UINT8  FlagFlashLogReclaimed;                       // a sector has been reclaimed since last checkpoint.
+static UINT16 FlashLogCheckpointCount;                     // records appended since last checkpoint.
+static UINT32 FlashLogCheckpointOffset;                    // flash offset of the header of the latest checkpoint found by flash_log_mount().
+static UINT32 FlashLogCheckpointSequence;                  // sequence number of this checkpoint (0 if none).
+
+/* Wear statistics: content of the newest record of the journal, what has been counted since, and slot where the next record will be written. */
+static struct flash_wear FlashWearSaved;
+static struct flash_wear FlashWearPending;                 // PoweredSeconds is not used, it is computed from FlashWearTimeStamp.
+static UINT16 FlashWearPendingErases;                      // erases counted since last save.
+static UINT64 FlashWearTimeStamp;                          // time (in usec since boot) up to which PoweredSeconds has been counted.
+#if FLASH_WEAR_JOURNAL
+static UINT8  FlagFlashWearLoaded = FLAG_OFF;              // journal has been scanned.
+static UINT8  FlashWearSector;                             // journal sector being filled (0 = FLASH_WEAR_OFFSET1, 1 = FLASH_WEAR_OFFSET2).
+static UINT8  FlashWearSlot;                               // next slot of this sector.
+static UINT32 FlashWearSequence;                           // sequence number of the newest record.
+static const UINT32 FlashWearOffset[2] = {FLASH_WEAR_OFFSET1, FLASH_WEAR_OFFSET2};
+#endif  // FLASH_WEAR_JOURNAL
+
+#if (FLASH_XFER > 0)
+/* Binary transfer with the host tool: payload of the frame being received, and sector being rebuilt from received data before it is written to flash. */
+static UINT8  FlashXferPayload[FLASH_XFER_CHUNK_SIZE];
+static UINT8  FlashXferSector[FLASH_SECTOR_SIZE];
+#endif  // FLASH_XFER
+
+/* Hex dump: digits used by the formatter and batch of lines waiting to be sent. */
+static const UCHAR UtilHexDigit[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+static UCHAR  UtilDumpBuffer[UTIL_DUMP_BUFFER_SIZE];
+static UINT16 UtilDumpSize;                                // number of bytes in UtilDumpBuffer[].
 
 
 
@@ -40,84 +179,515 @@
 /* ============================================================================================================================================================= *\
                                                           Function prototypes for local functions.
 \* ============================================================================================================================================================= */
+/* Check the header of a sector used by the A/B commit. */
+static struct flash_ab_header *flash_ab_check(UINT32 DataOffset);
+
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+/* Complete the save being written by the asynchronous save engine. */
+static void flash_async_complete(UINT8 Status);
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+
+#if (FLASH_BENCH_SECTORS > 0)
+/* Print the result of one operation and size of the benchmark. */
+static void flash_benchmark_report(UINT8 Operation, UINT32 DataSize, UINT16 Iterations, UINT16 Batch, UINT64 TotalUSec);
+#endif  // FLASH_BENCH_SECTORS
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* Find the write-back cache entry of a sector. */
+static INT16 flash_cache_find(UINT32 SectorOffset);
+
+/* Drop the clean write-back cache entries overlapping an area of flash that is being erased or programmed. */
+static void flash_cache_invalidate(UINT32 DataOffset, UINT32 DataSize);
+
+/* Update a sector in the write-back cache. */
+static UINT8 flash_cache_update(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize);
+
+/* Write a dirty sector of the write-back cache to flash. */
+static UINT8 flash_cache_write(INT16 Entry);
+#endif  // FLASH_CACHE_SECTORS
+
+/* Check if an area of flash memory is blank (erased to 0xFF). */
+static UINT8 flash_is_blank(UINT32 DataOffset, UINT32 DataSize);
+
+#if (FLASH_CACHE_SECTORS == 0)
+/* Check if an area of flash memory already contains the specified data (saves are compared with the write-back cache instead, when it is used). */
+static UINT8 flash_is_identical(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize);
+#endif  // FLASH_CACHE_SECTORS
+
+#if (FLASH_LATENCY > 0)
+/* Record a duration in a latency histogram. */
+static void flash_latency_add(struct flash_histogram *Histogram, UINT32 USec);
+#endif  // FLASH_LATENCY
+
+/* Release the other core parked by flash_lockout_start(). */
+static void flash_lockout_end(UINT8 FlagLockout);
+
+/* Park the other core in RAM before a flash erase or program. */
+static UINT8 flash_lockout_start(void);
+
+/* Find the record ID used for a string key of the key-value store. */
+static UINT16 flash_kv_key(const UCHAR *Name, UINT16 *FreeKey);
+
+/* Append a new version of a record at the head of the log-structured record store. */
+static UINT8 flash_log_append(UINT16 RecordId, UINT8 *Data, UINT16 DataSize, UINT16 Flags, UINT8 FlagRelocate);
+
+#if (FLASH_LOG_CHECKPOINT_INTERVAL > 0)
+/* Write a checkpoint of the RAM index to the log-structured record store. */
+static UINT8 flash_log_checkpoint(void);
+#endif  // FLASH_LOG_CHECKPOINT_INTERVAL
+
+/* Load the latest checkpoint of the RAM index found by flash_log_scan(). */
+static UINT8 flash_log_checkpoint_load(void);
+
+/* Find the RAM index entry of a record of the log-structured record store. */
+static INT16 flash_log_find(UINT16 RecordId);
+
+/* Rebuild the hash table of the RAM index of the log-structured record store. */
+static void flash_log_hash_rebuild(void);
+
+/* Add a record ID to the RAM index of the log-structured record store. */
+static INT16 flash_log_insert(UINT16 RecordId);
+
+/* Move the live records out of a sector of the ring and erase it. */
+static UINT8 flash_log_reclaim(UINT8 SectorNumber);
+
+/* Scan the records of a sector of the ring and update the RAM index. */
+static UINT32 flash_log_scan(UINT8 SectorNumber, UINT32 MinSequence);
+
+/* Compare a page of new data with current flash content. */
+static UINT8 flash_page_compare(UINT8 *CurrentPage, UINT8 *NewPage);
+
+/* Check the header saved by flash_save_data() in front of data. */
+static UINT8 flash_payload_check(const UINT8 *Sector, UINT16 DataSize);
+
+/* Build the image of data saved by flash_save_data() at the beginning of a sector (header, then data). */
+static void flash_payload_stage(UINT8 *Sector, UINT8 *Data, UINT16 DataSize);
+
+/* Program data to an erased area of flash memory, one page at a time. */
+static UINT8 flash_program(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize);
+
+/* Reserve the scratch buffer. */
+static UINT8 *flash_scratch_acquire(UINT32 DataSize);
+
+/* Release the scratch buffer reserved by flash_scratch_acquire(). */
+static void flash_scratch_release(void);
+
+/* Invalidate the validated views overlapping an area of flash that is being erased or programmed. */
+static void flash_view_invalidate(UINT32 DataOffset, UINT32 DataSize);
+
+/* Save wear statistics to the journal if enough erases have been counted since last save. */
+static void flash_wear_check(void);
+
+#if FLASH_WEAR_JOURNAL
+/* Find the newest valid record of the wear journal, and the slot where the next one will be written. */
+static void flash_wear_load(void);
+#endif  // FLASH_WEAR_JOURNAL
+
+/* Write a full sector image to flash, erasing and programming only what is required. */
+static UINT8 flash_write_sector(UINT32 SectorOffset, UINT8 *SectorData);
+
+#if (FLASH_XFER > 0)
+/* Export a flash range to the host tool. */
+static UINT8 flash_xfer_export(UINT32 DataOffset, UINT32 DataSize);
+
+/* Import an image from the host tool to a flash range. */
+static UINT8 flash_xfer_import(UINT32 DataOffset, UINT32 DataSize);
+
+/* Receive a frame from the host tool. */
+static UINT8 flash_xfer_receive(UINT8 *Type, UINT8 *Sequence, UINT16 *Length, UINT32 TimeoutUSec);
+
+/* Send a frame to the host tool. */
+static void flash_xfer_send(UINT8 Type, UINT8 Sequence, const UINT8 *Payload, UINT16 Length);
+#endif  // FLASH_XFER
+
 /* Read a string from stdin. */
-void static input_string(UCHAR *String);
+static void input_string(UCHAR *String);
+
+/* Generate the lookup tables used by the table-driven CRC16 engines. */
+static void util_crc16_table_init(void);
+
+/* Format one line of a hex dump (hex bytes, then printable characters). */
+static UINT16 util_dump_line(UCHAR *Line, const UINT8 *Data, UINT32 DataSize);
+
+/* Add a string to the batch of hex dump lines, and send the batch when full or when requested. */
+static void util_dump_write(const UCHAR *String, UINT16 Size, UINT8 FlagFlush);
 
-/* Pause for specified number of msec. */
-void static wait_ms(UINT16 WaitMSec);
+/* Format a value as fixed-width hexadecimal digits. */
+static UCHAR *util_hex(UCHAR *String, UINT32 Value, UINT8 Digits);
 
 
 
 
 
 /* $PAGE */
-/* $TITLE=flash_display() */
+/* $TITLE=flash_ab_check() */
 /* ============================================================================================================================================================= *\
-                                                      Display flash content through external monitor.
+                                   Check the header of a sector used by the A/B commit. Returns a pointer to the header in flash, or NULL if not valid.
+                              NOTE: Only the header is checked here (a few bytes), the CRC16 of data is checked only for the copy that is selected.
 \* ============================================================================================================================================================= */
-void flash_display(UINT32 Offset, UINT32 Length)
+static struct flash_ab_header *flash_ab_check(UINT32 DataOffset)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
+  struct flash_ab_header *Header;
 
-  UCHAR String[256];
 
-  UINT8 *FlashBaseAddress;
+  Header = (struct flash_ab_header *)(XIP_BASE + DataOffset);
+
+  if ((Header->Magic != FLASH_AB_MAGIC) || (Header->Commit != FLASH_AB_COMMIT) || (Header->DataSize > FLASH_AB_MAX_DATA_SIZE)) return NULL;
+  if (util_crc16((UINT8 *)Header, offsetof(struct flash_ab_header, HeaderCrc16)) != Header->HeaderCrc16) return NULL;
+
+  return Header;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_ab_read() */
+/* ============================================================================================================================================================= *\
+                                     Read the newest valid copy of data saved with the power-fail-safe A/B commit.
+                    NOTES: The newest copy is selected by looking only at both headers. Its data CRC16 is then validated and, in the unlikely case it is
+                           not valid, the other copy is used. At most DataSize bytes are copied to Data. Returns 1 if no valid copy has been found.
+\* ============================================================================================================================================================= */
+UINT8 flash_ab_read(UINT32 OffsetA, UINT32 OffsetB, UINT8 *Data, UINT16 DataSize)
+{
+  struct flash_ab_header *Header[2];
+
+  UINT8 Loop1UInt8;
+  UINT8 Newest;
+
+  UINT8 *Payload;
 
-  UINT32 Loop1UInt32;
-  UINT32 Loop2UInt32;
 
+  Header[0] = flash_ab_check(OffsetA);
+  Header[1] = flash_ab_check(OffsetB);
 
-  if (FlagLocalDebug)
+  /* Try the newest copy first. */
+  Newest = ((Header[1] != NULL) && ((Header[0] == NULL) || (Header[1]->Generation > Header[0]->Generation))) ? 1 : 0;
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < 2; ++Loop1UInt8, Newest ^= 1)
   {
-    uart_send(__LINE__, __func__, "Entering flash_display()\r");
-    uart_send(__LINE__, __func__, "Offset: 0x%8.8lX     Length: 0x%8.8lX  (%lu)\r\r\r", Offset, Length, Length);
+    if (Header[Newest] == NULL) continue;
+
+    Payload = (UINT8 *)Header[Newest] + FLASH_PAGE_SIZE;
+    if (util_crc16(Payload, Header[Newest]->DataSize) != Header[Newest]->DataCrc16) continue;
+
+    FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_AB, "Using copy %c (generation %lu)\r", Newest ? 'B' : 'A', Header[Newest]->Generation);
+
+    if (DataSize > Header[Newest]->DataSize) DataSize = Header[Newest]->DataSize;
+    memcpy(Data, Payload, DataSize);
+
+    return 0;
   }
 
-  /* Compute target flash memory address.
-     NOTE: XIP_BASE ("eXecute-In-Place") is the base address of the flash memory in Pico's address space (memory map). */
-  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+  if (stdio_usb_connected()) uart_send(__LINE__, __func__, "No valid copy found in A/B sectors 0x%6.6X / 0x%6.6X.\r", OffsetA, OffsetB);
 
-  uart_send(__LINE__, __func__, " XIP_BASE: 0x%p   Offset: 0x%6.6X   Length: 0x%X (%u)\r", XIP_BASE, Offset, Length, Length);
-  uart_send(__LINE__, __func__, " ================================================================================\r");
+  return 1;
+}
 
 
-  /* Display target address and 16 bytes in hex. */
-  for (Loop1UInt32 = Offset; Loop1UInt32 < (Offset + Length); Loop1UInt32 += 16)
+
+
+
+/* $PAGE */
+/* $TITLE=flash_ab_save() */
+/* ============================================================================================================================================================= *\
+                                                     Save data with the power-fail-safe A/B commit.
+        NOTES: The sector holding the newest valid copy is never touched. The other one is erased, data is programmed, then the header, and the commit marker
+               last. A reset at any point leaves either the previous copy or the new one as the newest valid copy.
+               Power cuts during each erase and each page program of a save are simulated on the host by the ab_save scenario of Pico-Flash-Fault.c.
+\* ============================================================================================================================================================= */
+UINT8 flash_ab_save(UINT32 OffsetA, UINT32 OffsetB, UINT8 *Data, UINT16 DataSize)
+{
+  struct flash_ab_header  Header;
+  struct flash_ab_header *HeaderA;
+  struct flash_ab_header *HeaderB;
+
+  UINT32 Commit;
+  UINT32 TargetOffset;
+
+
+  if ((DataSize > FLASH_AB_MAX_DATA_SIZE) || (OffsetA % FLASH_SECTOR_SIZE) || (OffsetB % FLASH_SECTOR_SIZE) || (OffsetA == OffsetB))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Invalid A/B save (OffsetA: 0x%6.6X   OffsetB: 0x%6.6X   DataSize: 0x%4.4X)\r", OffsetA, OffsetB, DataSize);
+    return 1;
+  }
+
+  /* Write to the sector that doesn't hold the newest valid copy. */
+  HeaderA = flash_ab_check(OffsetA);
+  HeaderB = flash_ab_check(OffsetB);
+  if ((HeaderA != NULL) && ((HeaderB == NULL) || (HeaderA->Generation > HeaderB->Generation)))
+  {
+    TargetOffset      = OffsetB;
+    Header.Generation = HeaderA->Generation + 1;
+  }
+  else
+  {
+    TargetOffset      = OffsetA;
+    Header.Generation = (HeaderB != NULL) ? HeaderB->Generation + 1 : 1;
+  }
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_AB, "Saving generation %lu to sector 0x%6.6X\r", Header.Generation, TargetOffset);
+  FlashWearPending.BytesRequested += DataSize;
+
+  Header.Magic       = FLASH_AB_MAGIC;
+  Header.DataSize    = DataSize;
+  Header.DataCrc16   = util_crc16(Data, DataSize);
+  Header.HeaderCrc16 = util_crc16((UINT8 *)&Header, offsetof(struct flash_ab_header, HeaderCrc16));
+  Header.Reserved    = 0xFFFF;
+  Header.Commit      = 0xFFFFFFFF;
+
+  if (flash_erase(TargetOffset)) return 1;  // skipped if target sector is already blank.
+  if (flash_program(TargetOffset + FLASH_PAGE_SIZE, Data, DataSize)) return 1;
+  if (flash_program(TargetOffset, (UINT8 *)&Header, sizeof(Header))) return 1;
+
+  /* Commit marker last. */
+  Commit = FLASH_AB_COMMIT;
+  if (flash_program(TargetOffset + offsetof(struct flash_ab_header, Commit), (UINT8 *)&Commit, sizeof(Commit))) return 1;
+  flash_wear_check();
+
+  return 0;
+}
+
+
+
+
+
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+/* $PAGE */
+/* $TITLE=flash_async_complete() */
+/* ============================================================================================================================================================= *\
+                                             Complete the save being written by the asynchronous save engine.
+\* ============================================================================================================================================================= */
+static void flash_async_complete(UINT8 Status)
+{
+  INT16 Handle;
+
+
+  Handle           = FlashAsyncActive;
+  FlashAsyncActive = -1;
+  flash_wear_check();
+
+  /* Sector is not pending anymore, even for the callback (that may save it again). */
+  FlashAsyncQueue[Handle].Status = Status;
+
+  if (FlashAsyncQueue[Handle].Callback != NULL)
+  {
+    /* Slot is released as soon as the caller has been notified. */
+    FlashAsyncQueue[Handle].Callback(Handle, Status, FlashAsyncQueue[Handle].Context);
+    FlashAsyncQueue[Handle].Status = FLASH_ASYNC_FREE;
+  }
+  /* Otherwise, slot is released when the caller retrieves the status. */
+
+  return;
+}
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_async_pending() */
+/* ============================================================================================================================================================= *                                        Check if an asynchronous save is queued or in progress in an area of flash.
+      NOTE: Synchronous writes (flash_save_data(), flash_write(), flash_write_range(), write-back cache) are refused for such an area. The engine would
+            otherwise program the sector image it staged (or is about to stage) over the new data.
+\* ============================================================================================================================================================= */
+UINT8 flash_async_pending(UINT32 DataOffset, UINT32 DataSize)
+{
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+  INT16 Handle;
+
+
+  for (Handle = 0; Handle < FLASH_ASYNC_QUEUE_SIZE; ++Handle)
   {
-    sprintf(String, " [%p] ", XIP_BASE + Loop1UInt32);
+    if (((FlashAsyncQueue[Handle].Status == FLASH_ASYNC_QUEUED) || (FlashAsyncQueue[Handle].Status == FLASH_ASYNC_BUSY)) &&
+        (FlashAsyncQueue[Handle].DataOffset < (DataOffset + DataSize)) && (DataOffset < (FlashAsyncQueue[Handle].DataOffset + FLASH_SECTOR_SIZE)))
+      return TRUE;
+  }
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+
+  return FALSE;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_async_status() */
+/* ============================================================================================================================================================= *\
+                                            Return the status of a save submitted to the asynchronous save engine.
+                  NOTE: Once FLASH_ASYNC_DONE or FLASH_ASYNC_ERROR has been returned, the handle is released and must not be used anymore.
+\* ============================================================================================================================================================= */
+UINT8 flash_async_status(INT16 Handle)
+{
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+  UINT8 Status;
+
+
+  if ((Handle < 0) || (Handle >= FLASH_ASYNC_QUEUE_SIZE)) return FLASH_ASYNC_FREE;
+
+  Status = FlashAsyncQueue[Handle].Status;
+  if ((Status == FLASH_ASYNC_DONE) || (Status == FLASH_ASYNC_ERROR)) FlashAsyncQueue[Handle].Status = FLASH_ASYNC_FREE;
+
+  return Status;
+#else   // FLASH_ASYNC_QUEUE_SIZE
+  return FLASH_ASYNC_FREE;
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_async_submit() */
+/* ============================================================================================================================================================= *\
+                                                      Queue a save to the asynchronous save engine.
+       NOTES: As for flash_save_data(), the last 2 bytes of Data receive the CRC16. Data is not copied: it must not be modified until the save is completed.
+              Returns a handle to be used with flash_async_status(), or -1 if the request is not valid or if the queue is full.
+              The callback (may be NULL) is called from flash_async_task(), on the core that calls it.
+\* ============================================================================================================================================================= */
+INT16 flash_async_submit(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize, flash_async_callback Callback, void *Context)
+{
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+#if (FLASH_CACHE_SECTORS > 0)
+  INT16 Entry;
+#endif  // FLASH_CACHE_SECTORS
+  INT16 Handle;
+
+
+  if ((DataSize < 2) || (DataSize > FLASH_PAYLOAD_MAX_SIZE) || (DataOffset % FLASH_SECTOR_SIZE)) return -1;
+
+  for (Handle = 0; Handle < FLASH_ASYNC_QUEUE_SIZE; ++Handle)
+    if (FlashAsyncQueue[Handle].Status == FLASH_ASYNC_FREE) break;
+  if (Handle == FLASH_ASYNC_QUEUE_SIZE) return -1;  // queue is full.
+
+  /* Insert CRC16 as last 16 bits of the packet. */
+  *(UINT16 *)(Data + DataSize - 2) = util_crc16(Data, DataSize - 2);
+  FlashWearPending.BytesRequested += DataSize;
+
+#if (FLASH_CACHE_SECTORS > 0)
+  /* A write-back cache entry of this sector only holds an older version of data: drop it, even if dirty, so that it is not written over this save. */
+  Entry = flash_cache_find(DataOffset);
+  if (Entry >= 0) FlashCache[Entry].FlagValid = FALSE;
+#endif  // FLASH_CACHE_SECTORS
+
+  FlashAsyncQueue[Handle].Data       = Data;
+  FlashAsyncQueue[Handle].DataSize   = DataSize;
+  FlashAsyncQueue[Handle].DataOffset = DataOffset;
+  FlashAsyncQueue[Handle].Ticket     = ++FlashAsyncTicket;
+  FlashAsyncQueue[Handle].Callback   = Callback;
+  FlashAsyncQueue[Handle].Context    = Context;
+  FlashAsyncQueue[Handle].Status     = FLASH_ASYNC_QUEUED;
+
+  return Handle;
+#else   // FLASH_ASYNC_QUEUE_SIZE
+  return -1;
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_async_task() */
+/* ============================================================================================================================================================= *\
+                                  Perform the next step of the asynchronous save engine. Must be called regularly from the main loop (or the other core).
+        NOTES: Each call performs at most one sector erase or one page program, so that the caller is never blocked for the whole save.
+               Saves are performed in the order they have been submitted, following the same rules as flash_write() (erase only if required).
+\* ============================================================================================================================================================= */
+void flash_async_task(void)
+{
+#if (FLASH_ASYNC_QUEUE_SIZE > 0)
+  INT16 Handle;
+
+  UINT8 *FlashBaseAddress;
+
+  UINT16 Loop1UInt16;
+
+  UINT32 DataOffset;
+
 
-    for (Loop2UInt32 = 0; Loop2UInt32 < 16; ++Loop2UInt32)
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+
+  if (FlashAsyncActive < 0)
+  {
+    /* Start oldest save waiting in the queue. */
+    for (Handle = 0; Handle < FLASH_ASYNC_QUEUE_SIZE; ++Handle)
     {
-      sprintf(&String[strlen(String)], "%2.2X ", FlashBaseAddress[Loop1UInt32 + Loop2UInt32]);
+      if ((FlashAsyncQueue[Handle].Status == FLASH_ASYNC_QUEUED) &&
+          ((FlashAsyncActive < 0) || ((INT32)(FlashAsyncQueue[Handle].Ticket - FlashAsyncQueue[FlashAsyncActive].Ticket) < 0)))
+        FlashAsyncActive = Handle;
     }
-    uart_send(__LINE__, __func__, String);
+    if (FlashAsyncActive < 0) return;  // nothing to do.
 
+    FlashAsyncQueue[FlashAsyncActive].Status = FLASH_ASYNC_BUSY;
+    FlashAsyncStep = FLASH_ASYNC_STEP_START;
+  }
 
-    /* Display separator. */
-    sprintf(String, "| ");
+  DataOffset = FlashAsyncQueue[FlashAsyncActive].DataOffset;
 
+  switch (FlashAsyncStep)
+  {
+    case (FLASH_ASYNC_STEP_START):
+      /* Build sector image and find which pages must be programmed. */
+      memcpy(FlashAsyncSector, &FlashBaseAddress[DataOffset], FLASH_SECTOR_SIZE);
+      flash_payload_stage(FlashAsyncSector, FlashAsyncQueue[FlashAsyncActive].Data, FlashAsyncQueue[FlashAsyncActive].DataSize);
+
+      FlashAsyncPages = 0;
+      FlashAsyncStep  = FLASH_ASYNC_STEP_PROGRAM;
+      for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
+      {
+        switch (flash_page_compare(&FlashBaseAddress[DataOffset + (Loop1UInt16 * FLASH_PAGE_SIZE)], &FlashAsyncSector[Loop1UInt16 * FLASH_PAGE_SIZE]))
+        {
+          case (FLASH_PAGE_ERASE):
+            FlashAsyncStep = FLASH_ASYNC_STEP_ERASE;
+            /* Fall through - page must also be programmed. */
+          case (FLASH_PAGE_PROGRAM):
+            FlashAsyncPages |= (1 << Loop1UInt16);
+          break;
+        }
+      }
+    break;
 
-    /* Display same bytes in ASCII or a dot <.> if not printable. */
-    for (Loop2UInt32 = 0; Loop2UInt32 < 16; ++Loop2UInt32)
-    {
-      if ((FlashBaseAddress[Loop1UInt32 + Loop2UInt32] >= 0x20) && (FlashBaseAddress[Loop1UInt32 + Loop2UInt32] <= 0x7E)  && (FlashBaseAddress[Loop1UInt32 + Loop2UInt32] != 0x25))
+    case (FLASH_ASYNC_STEP_ERASE):
+      if (flash_erase(DataOffset))
       {
-        sprintf(&String[Loop2UInt32 + 2], "%c", FlashBaseAddress[Loop1UInt32 + Loop2UInt32]);
+        flash_async_complete(FLASH_ASYNC_ERROR);
+        return;
       }
-      else
+
+      /* After an erase, every page that is not blank must be programmed. */
+      FlashAsyncPages = 0;
+      FlashAsyncStep  = FLASH_ASYNC_STEP_PROGRAM;
+      for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
+        if (flash_page_compare(&FlashBaseAddress[DataOffset + (Loop1UInt16 * FLASH_PAGE_SIZE)], &FlashAsyncSector[Loop1UInt16 * FLASH_PAGE_SIZE]) != FLASH_PAGE_IDENTICAL)
+          FlashAsyncPages |= (1 << Loop1UInt16);
+    break;
+
+    case (FLASH_ASYNC_STEP_PROGRAM):
+      /* Program one page. */
+      for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
       {
-        sprintf(&String[Loop2UInt32 + 2], ".");
+        if (FlashAsyncPages & (1 << Loop1UInt16))
+        {
+          if (flash_program(DataOffset + (Loop1UInt16 * FLASH_PAGE_SIZE), &FlashAsyncSector[Loop1UInt16 * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE))
+          {
+            flash_async_complete(FLASH_ASYNC_ERROR);
+            return;
+          }
+          FlashAsyncPages &= ~(1 << Loop1UInt16);
+          break;
+        }
       }
-    }
-    uart_send(__LINE__, __func__, String);
-    uart_send(__LINE__, __func__, "\r");
+    break;
   }
 
-  if (FlagLocalDebug) uart_send(__LINE__, __func__, "Exiting flash_display()\r");
+  if ((FlashAsyncStep == FLASH_ASYNC_STEP_PROGRAM) && (FlashAsyncPages == 0)) flash_async_complete(FLASH_ASYNC_DONE);
+#endif  // FLASH_ASYNC_QUEUE_SIZE
 
   return;
 }
@@ -126,98 +696,2699 @@ void flash_display(UINT32 Offset, UINT32 Length)
 
 
 
-/* PAGE */
-/* $TITLE=flash_erase() */
+/* $PAGE */
+/* $TITLE=flash_benchmark() */
 /* ============================================================================================================================================================= *\
-             Erase data in Pico's flash memory. The way the Pico's electronics is done, one sector of the flash (4096 bytes) must be erased at a time.
+                       Measure throughput and latency of the main paths of the module over an area of flash, and print results as CSV lines.
+        NOTES: The area begins at DataOffset (must be aligned on a sector boundary) and spans SectorCount sectors (FLASH_BENCH_SECTORS maximum). Its content
+               is lost and it is left erased. Each operation is run <Iterations> times (FLASH_BENCH_SAMPLES maximum) for each size, and timed with time_us_64()
+               (on the host, the monotonic clock with the time model of the emulated flash). A header line gives the name of each column.
 \* ============================================================================================================================================================= */
-UINT8 flash_erase(UINT32 DataOffset)
+UINT8 flash_benchmark(UINT32 DataOffset, UINT8 SectorCount, UINT16 Iterations)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
+#if (FLASH_BENCH_SECTORS > 0)
+  UCHAR Line[128];
 
-  UINT32 InterruptMask;
+  UINT8 Operation;
 
+  UINT16 Batch;
+  UINT16 Loop1UInt16;
+  UINT16 Loop2UInt16;
 
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "Entering flash_erase()\r");
-    uart_send(__LINE__, __func__, "DataOffset: 0x%8.8lX\r\r\r", DataOffset);
+  UINT32 DataSize;
+  UINT32 Loop1UInt32;
+  UINT32 MaxSize;
+  UINT32 Size;
 
-    /* Wait for interrupts to clear from uart_send() above before disable them. */
-    wait_ms(200);
-  }
+  UINT64 TimeStamp;
+  UINT64 TotalUSec;
 
+  volatile UINT32 Sink;  // results of functions without side effect, so that the compiler can't drop the calls being timed.
 
-  if (DataOffset % FLASH_SECTOR_SIZE)
-  {
-    /* Data offset specified is not aligned on a flash sector boundary. */
-    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
-    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
-    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
 
+  if ((DataOffset % FLASH_SECTOR_SIZE) || (SectorCount == 0) || (SectorCount > FLASH_BENCH_SECTORS) || (Iterations == 0) || (Iterations > FLASH_BENCH_SAMPLES) ||
+      (DataOffset > (PICO_FLASH_SIZE_BYTES - (SectorCount * FLASH_SECTOR_SIZE))))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Invalid benchmark area (0x%8.8X, %u sectors) or number of iterations (%u).\r", DataOffset, SectorCount, Iterations);
     return 1;
   }
 
+  printf("op,size,calls,ops_per_sec,bytes_per_sec,p50_nsec,p99_nsec\r\n");
 
-  /* Erase an area of the Pico's flash memory. Keep track of interrupt mask on entry. */
-  InterruptMask = save_and_disable_interrupts();
+  for (Operation = 0; Operation < FLASH_BENCH_OPS; ++Operation)
+  {
+    /* Start from a pattern that has both 0 and 1 bits in every page (read operations overwrite it with flash content). */
+    for (Loop1UInt32 = 0; Loop1UInt32 < sizeof(FlashBenchData); ++Loop1UInt32) FlashBenchData[Loop1UInt32] = Loop1UInt32 * 7;
 
-  /* Erase flash area to be reprogrammed. */
-  flash_range_erase(DataOffset, FLASH_SECTOR_SIZE);
+    /* Functions working on a single sector are limited to the payload of a sector. */
+    switch (Operation)
+    {
+      case (FLASH_BENCH_READ_DATA):
+      case (FLASH_BENCH_SAVE_SAME):
+      case (FLASH_BENCH_SAVE_DATA):
+      case (FLASH_BENCH_WRITE):
+        MaxSize = FLASH_PAYLOAD_MAX_SIZE;
+      break;
 
-  /* Restore original interrupt mask when done. */
-  restore_interrupts(InterruptMask);
+      case (FLASH_BENCH_ERASE):
+        MaxSize = FLASH_SECTOR_SIZE;
+      break;
+
+      default:
+        MaxSize = SectorCount * FLASH_SECTOR_SIZE;
+      break;
+    }
+    Batch = (Operation < FLASH_BENCH_SAVE_DATA) ? FLASH_BENCH_BATCH : 1;
+
+    /* Sizes go from 16 bytes up to a sector by steps of x4, then one sector at a time. An erase is always a whole sector. */
+    Size = (Operation == FLASH_BENCH_ERASE) ? FLASH_SECTOR_SIZE : 16;
+    do
+    {
+      DataSize = (Size < MaxSize) ? Size : MaxSize;
+
+      /* Data read back by those two operations must have been saved first. */
+      if ((Operation == FLASH_BENCH_READ_DATA) || (Operation == FLASH_BENCH_SAVE_SAME)) flash_save_data(DataOffset, FlashBenchData, DataSize);
+
+      TotalUSec = 0;
+      for (Loop1UInt16 = 0; Loop1UInt16 < Iterations; ++Loop1UInt16)
+      {
+        /* Preparation of the iteration, not timed. */
+        if ((Operation == FLASH_BENCH_SAVE_DATA) || (Operation == FLASH_BENCH_WRITE) || (Operation == FLASH_BENCH_WRITE_RANGE))
+          for (Loop1UInt32 = 0; Loop1UInt32 < DataSize; ++Loop1UInt32) FlashBenchData[Loop1UInt32] ^= 0xFF;
+        if (Operation == FLASH_BENCH_ERASE) flash_write_range(DataOffset, FlashBenchData, FLASH_PAGE_SIZE);
+
+        TimeStamp = time_us_64();
+        for (Loop2UInt16 = 0; Loop2UInt16 < Batch; ++Loop2UInt16)
+        {
+          switch (Operation)
+          {
+            case (FLASH_BENCH_CRC16):
+              Sink = util_crc16(FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_VERIFY_CRC):
+              Sink = flash_verify_crc(DataOffset, DataSize);
+            break;
+
+            case (FLASH_BENCH_READ_RANGE):
+              flash_read_range(DataOffset, FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_READ_DATA):
+              flash_read_data(DataOffset, FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_DUMP):
+              for (Loop1UInt32 = 0; Loop1UInt32 < DataSize; Loop1UInt32 += 16)
+                Sink = util_dump_line(Line, &FlashBenchData[Loop1UInt32], ((DataSize - Loop1UInt32) < 16) ? (DataSize - Loop1UInt32) : 16);
+            break;
+
+            case (FLASH_BENCH_SAVE_SAME):
+            case (FLASH_BENCH_SAVE_DATA):
+              flash_save_data(DataOffset, FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_WRITE):
+              flash_write(DataOffset, FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_WRITE_RANGE):
+              flash_write_range(DataOffset, FlashBenchData, DataSize);
+            break;
+
+            case (FLASH_BENCH_ERASE):
+              flash_erase(DataOffset);
+            break;
+          }
+        }
+        TimeStamp = time_us_64() - TimeStamp;
+
+        FlashBenchSample[Loop1UInt16] = (UINT32)((TimeStamp * 1000) / Batch);
+        TotalUSec += TimeStamp;
+      }
+
+      flash_benchmark_report(Operation, DataSize, Iterations, Batch, TotalUSec);
+      stdio_flush();
+
+      Size = (Size < FLASH_SECTOR_SIZE) ? (Size * 4) : (Size + FLASH_SECTOR_SIZE);
+    } while (DataSize < MaxSize);
+  }
 
-  if (FlagLocalDebug) uart_send(__LINE__, __func__, "Exiting flash_erase()\r");
+  /* Leave the area erased. */
+  for (Loop1UInt32 = 0; Loop1UInt32 < SectorCount; ++Loop1UInt32) flash_erase(DataOffset + (Loop1UInt32 * FLASH_SECTOR_SIZE));
+  (void)Sink;
 
   return 0;
+#else   // FLASH_BENCH_SECTORS
+  uart_send(__LINE__, __func__, "*** ERROR *** Benchmark not available (FLASH_BENCH_SECTORS is 0).\r");
+
+  return 1;
+#endif  // FLASH_BENCH_SECTORS
 }
 
 
 
 
 
+#if (FLASH_BENCH_SECTORS > 0)
 /* $PAGE */
-/* $TITLE=flash_extract_crc() */
+/* $TITLE=flash_benchmark_report() */
 /* ============================================================================================================================================================= *\
-                                                                   Extract CRC16 from a data packet.
-             NOTES: It is assumed that the CRC16 is an unsigned integer 16 and that it is the last 2 bytes (last 16 bits) of the packet passed as an argument.
-                    DateSize represents the full size of the packet, including the CRC.
+                                                      Print the result of one operation and size of the benchmark.
+             NOTES: Latency percentiles are taken from the samples of FlashBenchSample[] (one per iteration), which are sorted in place.
+                    Throughput is computed from the total time of all iterations, which is more accurate than the samples for very short calls.
 \* ============================================================================================================================================================= */
-UINT16 flash_extract_crc(UINT8 *Data, UINT16 DataSize)
+static void flash_benchmark_report(UINT8 Operation, UINT32 DataSize, UINT16 Iterations, UINT16 Batch, UINT64 TotalUSec)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
+  static const UCHAR *Name[FLASH_BENCH_OPS] = {"crc16", "verify_crc", "read_range", "read_data", "dump_format", "save_same", "save_data", "write", "write_range", "erase"};
+
+  UINT16 Calls;
+  UINT16 Loop1UInt16;
+  UINT16 Loop2UInt16;
+
+  UINT32 Sample;
+
+
+  /* Insertion sort (at most FLASH_BENCH_SAMPLES samples). */
+  for (Loop1UInt16 = 1; Loop1UInt16 < Iterations; ++Loop1UInt16)
+  {
+    Sample = FlashBenchSample[Loop1UInt16];
+    for (Loop2UInt16 = Loop1UInt16; (Loop2UInt16 > 0) && (FlashBenchSample[Loop2UInt16 - 1] > Sample); --Loop2UInt16)
+      FlashBenchSample[Loop2UInt16] = FlashBenchSample[Loop2UInt16 - 1];
+    FlashBenchSample[Loop2UInt16] = Sample;
+  }
+
+  /* Calls shorter than the timer resolution may add up to nothing. */
+  if (TotalUSec == 0) TotalUSec = 1;
+  Calls = Iterations * Batch;
+
+  printf("%s,%lu,%u,%llu,%llu,%lu,%lu\r\n", Name[Operation], (unsigned long)DataSize, Calls,
+         (unsigned long long)((Calls * 1000000ull) / TotalUSec), (unsigned long long)((Calls * 1000000ull * DataSize) / TotalUSec),
+         (unsigned long)FlashBenchSample[(Iterations - 1) / 2], (unsigned long)FlashBenchSample[((Iterations * 99) + 99) / 100 - 1]);
+
+  return;
+}
+#endif  // FLASH_BENCH_SECTORS
+
+
+
+
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* $PAGE */
+/* $TITLE=flash_cache_find() */
+/* ============================================================================================================================================================= *\
+                                                      Find the write-back cache entry of a sector (-1 if not cached).
+\* ============================================================================================================================================================= */
+static INT16 flash_cache_find(UINT32 SectorOffset)
+{
+  INT16 Entry;
+
+
+  for (Entry = 0; Entry < FLASH_CACHE_SECTORS; ++Entry)
+    if (FlashCache[Entry].FlagValid && (FlashCache[Entry].SectorOffset == SectorOffset)) return Entry;
+
+  return -1;
+}
+#endif  // FLASH_CACHE_SECTORS
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_cache_flush() */
+/* ============================================================================================================================================================= *\
+                                                      Write all dirty sectors of the write-back cache to flash.
+\* ============================================================================================================================================================= */
+UINT8 flash_cache_flush(void)
+{
+  UINT8 ReturnCode;
+
+#if (FLASH_CACHE_SECTORS > 0)
+  INT16 Entry;
+#endif  // FLASH_CACHE_SECTORS
+
+
+  ReturnCode = 0;
+#if (FLASH_CACHE_SECTORS > 0)
+  for (Entry = 0; Entry < FLASH_CACHE_SECTORS; ++Entry)
+    ReturnCode |= flash_cache_write(Entry);
+#endif  // FLASH_CACHE_SECTORS
+
+  return ReturnCode;
+}
+
+
+
+
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* $PAGE */
+/* $TITLE=flash_cache_invalidate() */
+/* ============================================================================================================================================================= *\
+                                 Drop the clean write-back cache entries overlapping an area of flash that is being erased or programmed.
+\* ============================================================================================================================================================= */
+static void flash_cache_invalidate(UINT32 DataOffset, UINT32 DataSize)
+{
+  INT16 Entry;
+
+
+  for (Entry = 0; Entry < FLASH_CACHE_SECTORS; ++Entry)
+  {
+    if (FlashCache[Entry].FlagValid && !FlashCache[Entry].FlagDirty &&
+        (FlashCache[Entry].SectorOffset < (DataOffset + DataSize)) && (DataOffset < (FlashCache[Entry].SectorOffset + FLASH_SECTOR_SIZE)))
+      FlashCache[Entry].FlagValid = FALSE;
+  }
+
+  return;
+}
+#endif  // FLASH_CACHE_SECTORS
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_cache_task() */
+/* ============================================================================================================================================================= *\
+                             Write to flash the dirty sectors of the write-back cache that have not been updated for FLASH_CACHE_IDLE_MSEC.
+                                                   NOTE: Must be called regularly from the main loop when the cache is used.
+\* ============================================================================================================================================================= */
+void flash_cache_task(void)
+{
+#if (FLASH_CACHE_SECTORS > 0)
+  INT16 Entry;
+
+
+  for (Entry = 0; Entry < FLASH_CACHE_SECTORS; ++Entry)
+    if (FlashCache[Entry].FlagDirty && ((time_us_64() - FlashCache[Entry].LastUpdate) >= (FLASH_CACHE_IDLE_MSEC * 1000ll))) flash_cache_write(Entry);
+#endif  // FLASH_CACHE_SECTORS
+
+  return;
+}
+
+
+
+
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* $PAGE */
+/* $TITLE=flash_cache_update() */
+/* ============================================================================================================================================================= *\
+                                                 Update a sector in the write-back cache, loading it from flash first if required.
+              NOTES: When all entries are used, the least recently updated one is replaced (and written to flash first if it is dirty).
+                     Returns a return code of flash_save_data() (FLASH_SAVE_SKIPPED if the cached sector already contains the same data).
+\* ============================================================================================================================================================= */
+static UINT8 flash_cache_update(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
+{
+  INT16 Entry;
+  INT16 Loop1Int16;
+
+
+  Entry = flash_cache_find(DataOffset);
+  if (Entry < 0)
+  {
+    /* Select a free entry, or the least recently updated one. */
+    Entry = 0;
+    for (Loop1Int16 = 0; Loop1Int16 < FLASH_CACHE_SECTORS; ++Loop1Int16)
+    {
+      if (!FlashCache[Loop1Int16].FlagValid)
+      {
+        Entry = Loop1Int16;
+        break;
+      }
+      if (FlashCache[Loop1Int16].LastUpdate < FlashCache[Entry].LastUpdate) Entry = Loop1Int16;
+    }
+    if (flash_cache_write(Entry)) return FLASH_SAVE_ERROR;
+
+    memcpy(FlashCache[Entry].Data, (UINT8 *)(XIP_BASE + DataOffset), FLASH_SECTOR_SIZE);
+    FlashCache[Entry].SectorOffset = DataOffset;
+    FlashCache[Entry].FlagValid    = TRUE;
+    FlashCache[Entry].FlagDirty    = FALSE;
+    FlashCache[Entry].DirtyCount   = 0;
+    FlashCache[Entry].LastUpdate   = time_us_64();
+  }
+
+  /* Nothing to do if data is the same. */
+  if ((flash_payload_check(FlashCache[Entry].Data, DataSize) == 0) && (memcmp(&FlashCache[Entry].Data[FLASH_PAYLOAD_OFFSET], Data, DataSize) == 0))
+  {
+    ++FlashStats.SaveSkipped;
+    ++FlashWearPending.WritesSkipped;
+    return FLASH_SAVE_SKIPPED;
+  }
+
+  flash_payload_stage(FlashCache[Entry].Data, Data, DataSize);
+  FlashCache[Entry].FlagDirty  = TRUE;
+  FlashCache[Entry].LastUpdate = time_us_64();
+  ++FlashCache[Entry].DirtyCount;
+
+  if ((FlashCache[Entry].DirtyCount >= FLASH_CACHE_DIRTY_MAX) && flash_cache_write(Entry)) return FLASH_SAVE_ERROR;
+
+  return FLASH_SAVE_WRITTEN;
+}
+#endif  // FLASH_CACHE_SECTORS
+
+
+
+
+
+#if (FLASH_CACHE_SECTORS > 0)
+/* $PAGE */
+/* $TITLE=flash_cache_write() */
+/* ============================================================================================================================================================= *\
+                                                        Write a dirty sector of the write-back cache to flash.
+\* ============================================================================================================================================================= */
+static UINT8 flash_cache_write(INT16 Entry)
+{
+  if ((Entry < 0) || !FlashCache[Entry].FlagValid || !FlashCache[Entry].FlagDirty) return 0;
+
+  /* Entry is now clean (flash_cache_invalidate() will drop it while its sector is being written, it is reloaded on next use). */
+  FlashCache[Entry].FlagDirty = FALSE;
+  if (flash_write_sector(FlashCache[Entry].SectorOffset, FlashCache[Entry].Data))
+  {
+    FlashCache[Entry].FlagValid = TRUE;
+    FlashCache[Entry].FlagDirty = TRUE;
+    return 1;
+  }
+
+  ++FlashStats.CacheFlushes;
+  FlashStats.SaveCoalesced  += FlashCache[Entry].DirtyCount - 1;
+  FlashWearPending.WritesCoalesced += FlashCache[Entry].DirtyCount - 1;
+  FlashStats.LastSaveWritten = TRUE;
+  FlashCache[Entry].DirtyCount = 0;
+
+  return 0;
+}
+#endif  // FLASH_CACHE_SECTORS
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_display() */
+/* ============================================================================================================================================================= *\
+                                                      Display flash content through external monitor.
+         NOTE: Lines are formatted in a single pass and sent in batches of UTIL_DUMP_BUFFER_SIZE bytes. The formatting throughput is measured by the
+               dump_format operation of flash_benchmark() (pico-flash-bench on the host, option 10 of Pico-Flash-Example on the Pico).
+\* ============================================================================================================================================================= */
+void flash_display(UINT32 Offset, UINT32 Length)
+{
+  UCHAR String[128];
+  UCHAR *Line;
+
+  UINT8 *FlashBaseAddress;
+
+  UINT32 Loop1UInt32;
+
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_READ)
+  uart_send(__LINE__, __func__, "Entering flash_display()\r");
+  uart_send(__LINE__, __func__, "Offset: 0x%8.8lX     Length: 0x%8.8lX  (%lu)\r\r\r", Offset, Length, Length);
+#endif  // FLASH_DEBUG_ENABLED
+
+  /* Compute target flash memory address.
+     NOTE: XIP_BASE ("eXecute-In-Place") is the base address of the flash memory in Pico's address space (memory map). */
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+
+  uart_send(__LINE__, __func__, " XIP_BASE: 0x%p   Offset: 0x%6.6X   Length: 0x%X (%u)\r", XIP_BASE, Offset, Length, Length);
+  uart_send(__LINE__, __func__, " ================================================================================\r");
+
+
+  /* Display target address, 16 bytes in hex, then the same bytes in ASCII. Lines are sent in batches. */
+  for (Loop1UInt32 = Offset; Loop1UInt32 < (Offset + Length); Loop1UInt32 += 16)
+  {
+    Line    = String;
+    *Line++ = ' ';
+    *Line++ = '[';
+    *Line++ = '0';
+    *Line++ = 'x';
+    Line    = util_hex(Line, XIP_BASE + Loop1UInt32, 8);
+    *Line++ = ']';
+    *Line++ = ' ';
+    Line   += util_dump_line(Line, &FlashBaseAddress[Loop1UInt32], ((Offset + Length - Loop1UInt32) < 16) ? (Offset + Length - Loop1UInt32) : 16);
+
+    util_dump_write(String, Line - String, FALSE);
+  }
+  util_dump_write(NULL, 0, TRUE);
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_READ, "Exiting flash_display()\r");
+
+  return;
+}
+
+
+
+
+
+/* PAGE */
+/* $TITLE=flash_erase() */
+/* ============================================================================================================================================================= *\
+             Erase data in Pico's flash memory. The way the Pico's electronics is done, one sector of the flash (4096 bytes) must be erased at a time.
+\* ============================================================================================================================================================= */
+UINT8 flash_erase(UINT32 DataOffset)
+{
+  UINT8 FlagLockout;
+
+  UINT32 InterruptMask;
+  UINT32 TimeStamp;
+
+
+  FLASH_TRACE("Erasing sector 0x%6.6X\r", DataOffset);
+
+
+  if (DataOffset % FLASH_SECTOR_SIZE)
+  {
+    /* Data offset specified is not aligned on a flash sector boundary. */
+    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
+    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
+    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
+
+    return 1;
+  }
+
+
+  /* Nothing to do if the sector is already erased (for example, first provisioning or after a factory reset). */
+  ++FlashStats.EraseRequests;
+  if (flash_is_blank(DataOffset, FLASH_SECTOR_SIZE))
+  {
+    ++FlashStats.EraseSkipped;
+    FLASH_TRACE("Sector 0x%6.6X is already blank, erase skipped\r", DataOffset);
+
+    return 0;
+  }
+
+  flash_view_invalidate(DataOffset, FLASH_SECTOR_SIZE);
+#if (FLASH_CACHE_SECTORS > 0)
+  flash_cache_invalidate(DataOffset, FLASH_SECTOR_SIZE);
+#endif  // FLASH_CACHE_SECTORS
+
+  /* Park the other core while flash is not accessible. */
+  FlagLockout = flash_lockout_start();
+
+  /* Erase an area of the Pico's flash memory. Keep track of interrupt mask on entry. */
+  InterruptMask = save_and_disable_interrupts();
+  TimeStamp     = time_us_32();
+
+  /* Erase flash area to be reprogrammed. */
+  flash_range_erase(DataOffset, FLASH_SECTOR_SIZE);
+
+  /* Restore original interrupt mask when done. */
+  TimeStamp     = time_us_32() - TimeStamp;
+  restore_interrupts(InterruptMask);
+  flash_lockout_end(FlagLockout);
+
+  FLASH_LATENCY_ADD(Erase,  TimeStamp);
+  FLASH_LATENCY_ADD(IrqOff, TimeStamp);
+  FLASH_TRACE("Sector 0x%6.6X erased in %lu usec\r", DataOffset, TimeStamp);
+
+  /* Count erases of the data sectors (saved to the wear journal by flash_wear_check(), once the write in progress is completed). */
+  if ((DataOffset >= FLASH_DATA_OFFSET10) && (DataOffset <= FLASH_DATA_OFFSET1))
+  {
+    ++FlashWearPending.EraseCount[(FLASH_DATA_OFFSET1 - DataOffset) / FLASH_SECTOR_SIZE];
+    ++FlashWearPendingErases;
+  }
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_extract_crc() */
+/* ============================================================================================================================================================= *\
+                                                                   Extract CRC16 from a data packet.
+             NOTES: It is assumed that the CRC16 is an unsigned integer 16 and that it is the last 2 bytes (last 16 bits) of the packet passed as an argument.
+                    DateSize represents the full size of the packet, including the CRC.
+\* ============================================================================================================================================================= */
+UINT16 flash_extract_crc(UINT8 *Data, UINT16 DataSize)
+{
+  UINT16 Crc16;
+
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_READ)
+  uart_send(__LINE__, __func__, "Entering flash_extract()\r");
+  uart_send(__LINE__, __func__, "Data: 0x%8.8lX     DataSize: 0x%4.4X  (%u)\r\r\r", Data, DataSize, DataSize);
+#endif  // FLASH_DEBUG_ENABLED
+
+  Crc16 = *(UINT16 *)(Data + DataSize - 2);
+
+  /* Extract CRC16 from packet passed as an argument (last packet 16 bits). */
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_READ)
+  uart_send(__LINE__, __func__, "RAM base address:         0x%X\r",       RAM_BASE_ADDRESS);
+  uart_send(__LINE__, __func__, "Data pointer:             0x%X\r",       Data);
+  uart_send(__LINE__, __func__, "Data size:                0x%X  (%u)\r", DataSize, DataSize);
+  uart_send(__LINE__, __func__, "Pointer to CRC16:         0x%X\r",       Data + DataSize - 2);
+  uart_send(__LINE__, __func__, "Value of CRC found:       0x%X\r\r\r",   Crc16);
+#endif  // FLASH_DEBUG_ENABLED
+
+  return Crc16;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_get_stats() */
+/* ============================================================================================================================================================= *\
+                                                   Retrieve statistics of flash operations performed by the module.
+\* ============================================================================================================================================================= */
+void flash_get_stats(struct flash_stats *Stats)
+{
+  memcpy(Stats, &FlashStats, sizeof(struct flash_stats));
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_get_view() */
+/* ============================================================================================================================================================= *\
+                                     Return a pointer directly to data in flash memory (XIP), once its CRC16 has been validated.
+        NOTES: Data must have been saved with flash_save_data() (CRC16 in the last 2 bytes). Returns NULL if the header or the CRC16 is not valid.
+               The CRC16 is computed only on first call for an area. The validation is kept until the module erases or programs any part of that area,
+               so readers may then dereference flash directly on every access, without copying data to RAM.
+\* ============================================================================================================================================================= */
+const UINT8 *flash_get_view(UINT32 DataOffset, UINT16 DataSize)
+{
+  UINT8 Loop1UInt8;
+
+  UINT8 *View;
+
+  UINT16 Crc16Extracted;
+
+
+  View = (UINT8 *)(XIP_BASE + DataOffset + FLASH_PAYLOAD_OFFSET);
+
+#if (FLASH_CACHE_SECTORS > 0)
+  /* View is always in flash, so a dirty sector in the write-back cache must be written first. */
+  flash_cache_write(flash_cache_find(DataOffset & ~(FLASH_SECTOR_SIZE - 1)));
+#endif  // FLASH_CACHE_SECTORS
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < FLASH_VIEW_CACHE_SIZE; ++Loop1UInt8)
+    if (FlashViewCache[Loop1UInt8].FlagValid && (FlashViewCache[Loop1UInt8].DataOffset == DataOffset) && (FlashViewCache[Loop1UInt8].DataSize == DataSize)) return View;
+
+  if ((DataSize < 2) || (DataOffset >= PICO_FLASH_SIZE_BYTES) || ((DataSize + FLASH_PAYLOAD_OFFSET) > (PICO_FLASH_SIZE_BYTES - DataOffset))) return NULL;
+  if (flash_payload_check((UINT8 *)(XIP_BASE + DataOffset), DataSize)) return NULL;
+
+  /* CRC16 is the last 2 bytes (read one byte at a time since it may not be aligned). */
+  Crc16Extracted = View[DataSize - 2] | (View[DataSize - 1] << 8);
+  if (util_crc16(View, DataSize - 2) != Crc16Extracted) return NULL;
+
+  FlashViewCache[FlashViewNext].FlagValid  = TRUE;
+  FlashViewCache[FlashViewNext].DataOffset = DataOffset;
+  FlashViewCache[FlashViewNext].DataSize   = DataSize;
+  FlashViewNext = (FlashViewNext + 1) % FLASH_VIEW_CACHE_SIZE;
+
+  return View;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_is_blank() */
+/* ============================================================================================================================================================= *\
+                                                          Check if an area of flash memory is blank (erased to 0xFF).
+           NOTE: Reads 32 bits at a time when the area is word-aligned (always the case for a sector). Flash is read through the non-cached XIP alias,
+                 so that checking a whole sector doesn't evict program code from the XIP cache.
+\* ============================================================================================================================================================= */
+static UINT8 flash_is_blank(UINT32 DataOffset, UINT32 DataSize)
+{
+  UINT8 *FlashBaseAddress;
+
+  UINT32 Loop1UInt32;
+
+
+#ifdef XIP_NOCACHE_NOALLOC_BASE
+  FlashBaseAddress = (UINT8 *)(XIP_NOCACHE_NOALLOC_BASE);
+#else   // XIP_NOCACHE_NOALLOC_BASE
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+#endif  // XIP_NOCACHE_NOALLOC_BASE
+  Loop1UInt32      = 0;
+
+  if ((DataOffset % sizeof(UINT32)) == 0)
+  {
+    for (; (Loop1UInt32 + sizeof(UINT32)) <= DataSize; Loop1UInt32 += sizeof(UINT32))
+      if (*(volatile UINT32 *)&FlashBaseAddress[DataOffset + Loop1UInt32] != 0xFFFFFFFF) return FALSE;
+  }
+
+  /* Remaining bytes (or all bytes if area is not aligned). */
+  for (; Loop1UInt32 < DataSize; ++Loop1UInt32)
+    if (FlashBaseAddress[DataOffset + Loop1UInt32] != 0xFF) return FALSE;
+
+  return TRUE;
+}
+
+
+
+
+
+#if (FLASH_CACHE_SECTORS == 0)
+/* $PAGE */
+/* $TITLE=flash_is_identical() */
+/* ============================================================================================================================================================= *\
+                                                 Check if an area of flash memory already contains the specified data.
+                                   NOTE: Compares 32 bits at a time when Data is word-aligned (DataOffset always is for flash_save_data()).
+\* ============================================================================================================================================================= */
+static UINT8 flash_is_identical(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize)
+{
+  UINT8 *FlashBaseAddress;
+
+  UINT32 Loop1UInt32;
+
+
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+  Loop1UInt32      = 0;
+
+  if ((((uintptr_t)Data | DataOffset) % sizeof(UINT32)) == 0)
+  {
+    for (; (Loop1UInt32 + sizeof(UINT32)) <= DataSize; Loop1UInt32 += sizeof(UINT32))
+      if (*(UINT32 *)&FlashBaseAddress[DataOffset + Loop1UInt32] != *(UINT32 *)&Data[Loop1UInt32]) return FALSE;
+  }
+
+  /* Remaining bytes (or all bytes if data is not aligned). */
+  for (; Loop1UInt32 < DataSize; ++Loop1UInt32)
+    if (FlashBaseAddress[DataOffset + Loop1UInt32] != Data[Loop1UInt32]) return FALSE;
+
+  return TRUE;
+}
+#endif  // FLASH_CACHE_SECTORS
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_delete() */
+/* ============================================================================================================================================================= *\
+                                                            Delete a key from the key-value store.
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_delete(UINT16 Key)
+{
+  if (Key > FLASH_KV_MAX_KEY) return 1;
+
+  return flash_log_delete(Key);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_delete_str() */
+/* ============================================================================================================================================================= *\
+                                                         Delete a string key from the key-value store.
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_delete_str(const UCHAR *Name)
+{
+  UINT16 Key;
+
+
+  if (strlen((char *)Name) > FLASH_KV_MAX_NAME) return 1;
+
+  Key = flash_kv_key(Name, NULL);
+  if (Key == FLASH_KV_NO_KEY) return 0;  // nothing to delete.
+
+  return flash_log_delete(Key);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_get() */
+/* ============================================================================================================================================================= *\
+                                                        Read the value of a key from the key-value store.
+          NOTES: On entry, ValueSize is the size of the Value buffer. On exit, it is the size of the value saved (at most the size of the buffer is copied).
+                 The RAM index built on mount gives the location of the value in flash directly, without scanning flash. Returns 1 if the key doesn't exist.
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_get(UINT16 Key, UINT8 *Value, UINT16 *ValueSize)
+{
+  const UINT8 *Source;
+
+  UINT16 SourceSize;
+
+
+  if (Key > FLASH_KV_MAX_KEY) return 1;
+
+  Source = flash_log_locate(Key, &SourceSize);
+  if (Source == NULL) return 1;
+
+  memcpy(Value, Source, (SourceSize < *ValueSize) ? SourceSize : *ValueSize);
+  *ValueSize = SourceSize;
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_get_str() */
+/* ============================================================================================================================================================= *\
+                                                     Read the value of a string key from the key-value store.
+                                                           NOTE: ValueSize is used as for flash_kv_get().
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_get_str(const UCHAR *Name, UINT8 *Value, UINT16 *ValueSize)
+{
+  const UINT8 *Source;
+
+  UINT16 Key;
+  UINT16 NameSize;
+  UINT16 SourceSize;
+
+
+  NameSize = strlen((char *)Name);
+  if (NameSize > FLASH_KV_MAX_NAME) return 1;
+
+  /* Record data is the length of the string, the string, then the value (string already checked by flash_kv_key()). */
+  Key = flash_kv_key(Name, NULL);
+  if (Key == FLASH_KV_NO_KEY) return 1;
+  Source = flash_log_locate(Key, &SourceSize);
+
+  Source     += NameSize + 1;
+  SourceSize -= NameSize + 1;
+  memcpy(Value, Source, (SourceSize < *ValueSize) ? SourceSize : *ValueSize);
+  *ValueSize = SourceSize;
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_key() */
+/* ============================================================================================================================================================= *\
+                                Find the record ID used for a string key of the key-value store (FNV-1a hash, above integer keys).
+       NOTES: The ID given by the hash and the next ones (FLASH_KV_PROBES in all) are checked, since another string key may already use the first ones.
+              All of them are always checked: an ID freed by a deletion doesn't end the search. Returns the ID whose record holds this string, or
+              FLASH_KV_NO_KEY. FreeKey (may be NULL) then receives the first unused ID that was checked (FLASH_KV_NO_KEY if they are all used).
+\* ============================================================================================================================================================= */
+static UINT16 flash_kv_key(const UCHAR *Name, UINT16 *FreeKey)
+{
+  const UINT8 *Current;
+
+  UINT16 CurrentSize;
+  UINT16 Key;
+  UINT16 Loop1UInt16;
+  UINT16 NameSize;
+
+  UINT32 Hash;
+
+
+  Hash = 2166136261u;
+  for (NameSize = 0; Name[NameSize]; ++NameSize) Hash = (Hash ^ Name[NameSize]) * 16777619u;
+  Hash = (Hash >> 16) ^ Hash;
+
+  if (FreeKey != NULL) *FreeKey = FLASH_KV_NO_KEY;
+  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_KV_PROBES; ++Loop1UInt16)
+  {
+    /* Fold to the record IDs that are not used by integer keys nor reserved (checkpoints, and 0xFFFF which is never used as a record ID). */
+    Key     = (FLASH_KV_MAX_KEY + 1) + ((Hash + Loop1UInt16) % (FLASH_LOG_CHECKPOINT_ID - (FLASH_KV_MAX_KEY + 1)));
+    Current = flash_log_locate(Key, &CurrentSize);
+    if (Current == NULL)
+    {
+      if ((FreeKey != NULL) && (*FreeKey == FLASH_KV_NO_KEY)) *FreeKey = Key;
+    }
+    else if ((CurrentSize >= (NameSize + 1)) && (Current[0] == NameSize) && (memcmp(&Current[1], Name, NameSize) == 0))
+    {
+      return Key;
+    }
+  }
+
+  return FLASH_KV_NO_KEY;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_set() */
+/* ============================================================================================================================================================= *\
+                                                        Write the value of a key to the key-value store.
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_set(UINT16 Key, UINT8 *Value, UINT16 ValueSize)
+{
+  const UINT8 *Current;
+
+  UINT16 CurrentSize;
+
+
+  if (Key > FLASH_KV_MAX_KEY) return 1;
+
+  /* Nothing to write if value is unchanged. */
+  Current = flash_log_locate(Key, &CurrentSize);
+  if ((Current != NULL) && (CurrentSize == ValueSize) && (memcmp(Current, Value, ValueSize) == 0)) return 0;
+
+  return flash_log_write(Key, Value, ValueSize);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_kv_set_str() */
+/* ============================================================================================================================================================= *\
+                                                     Write the value of a string key to the key-value store.
+                NOTES: A string key hashed to the same record ID as another one already in the store gets one of the next IDs (see flash_kv_key()).
+                       Returns 1 only if all FLASH_KV_PROBES IDs tried are used by other string keys. The record is built in the scratch buffer.
+\* ============================================================================================================================================================= */
+UINT8 flash_kv_set_str(const UCHAR *Name, UINT8 *Value, UINT16 ValueSize)
+{
+  UINT8 ReturnCode;
+
+  UINT8 *Record;
+
+  const UINT8 *Current;
+
+  UINT16 CurrentSize;
+  UINT16 FreeKey;
+  UINT16 Key;
+  UINT16 NameSize;
+
+
+  NameSize = strlen((char *)Name);
+  if ((NameSize > FLASH_KV_MAX_NAME) || ((UINT32)(NameSize + 1 + ValueSize) > (UINT32)FLASH_LOG_MAX_DATA_SIZE)) return 1;
+
+  /* Record ID already holding this string, or a free one for a new string key. */
+  Key = flash_kv_key(Name, &FreeKey);
+  if (Key == FLASH_KV_NO_KEY) Key = FreeKey;
+  if (Key == FLASH_KV_NO_KEY)
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Key <%s>: the %u record IDs of its hash are used by other string keys.\r", Name, FLASH_KV_PROBES);
+    return 1;
+  }
+  Current = flash_log_locate(Key, &CurrentSize);
+
+  /* Nothing to write if value is unchanged. */
+  if ((Current != NULL) && (CurrentSize == (NameSize + 1 + ValueSize)) && (memcmp(&Current[NameSize + 1], Value, ValueSize) == 0)) return 0;
+
+  /* Build the record in the scratch buffer (it is too big for the stack). */
+  Record = flash_scratch_acquire(NameSize + 1 + ValueSize);
+  if (Record == NULL) return 1;
+
+  Record[0] = NameSize;
+  memcpy(&Record[1], Name, NameSize);
+  memcpy(&Record[NameSize + 1], Value, ValueSize);
+  ReturnCode = flash_log_write(Key, Record, NameSize + 1 + ValueSize);
+  flash_scratch_release();
+
+  return ReturnCode;
+}
+
+
+
+
+
+#if (FLASH_LATENCY > 0)
+/* $PAGE */
+/* $TITLE=flash_latency_add() */
+/* ============================================================================================================================================================= *\
+                                                      Record a duration (in usec) in a latency histogram.
+\* ============================================================================================================================================================= */
+static void flash_latency_add(struct flash_histogram *Histogram, UINT32 USec)
+{
+  UINT8 Bucket;
+
+
+  /* Bucket is the number of significant bits of the duration (see FLASH_LATENCY_BUCKETS). */
+  Bucket = (USec == 0) ? 0 : (32 - __builtin_clz(USec));
+  if (Bucket >= FLASH_LATENCY_BUCKETS) Bucket = FLASH_LATENCY_BUCKETS - 1;
+
+  ++Histogram->Count[Bucket];
+  ++Histogram->Samples;
+  Histogram->TotalUSec += USec;
+  if (USec > Histogram->MaxUSec) Histogram->MaxUSec = USec;
+
+  return;
+}
+#endif  // FLASH_LATENCY
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_latency_get() */
+/* ============================================================================================================================================================= *\
+                                                              Retrieve a snapshot of the latency histograms.
+\* ============================================================================================================================================================= */
+void flash_latency_get(struct flash_latency *Latency)
+{
+#if (FLASH_LATENCY > 0)
+  UINT32 InterruptMask;
+
+
+  /* Copy with interrupts disabled, so that all histograms of the snapshot are consistent. */
+  InterruptMask = save_and_disable_interrupts();
+  memcpy(Latency, &FlashLatency, sizeof(struct flash_latency));
+  restore_interrupts(InterruptMask);
+#else   // FLASH_LATENCY
+  memset(Latency, 0, sizeof(struct flash_latency));
+#endif  // FLASH_LATENCY
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_latency_reset() */
+/* ============================================================================================================================================================= *\
+                                                                   Clear the latency histograms.
+\* ============================================================================================================================================================= */
+void flash_latency_reset(void)
+{
+#if (FLASH_LATENCY > 0)
+  UINT32 InterruptMask;
+
+
+  InterruptMask = save_and_disable_interrupts();
+  memset(&FlashLatency, 0, sizeof(struct flash_latency));
+  restore_interrupts(InterruptMask);
+#endif  // FLASH_LATENCY
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_lockout_end() */
+/* ============================================================================================================================================================= *\
+                                 Release the other core parked by flash_lockout_start() and keep track of how long it has been parked.
+\* ============================================================================================================================================================= */
+static void flash_lockout_end(UINT8 FlagLockout)
+{
+#ifdef FLASH_MULTICORE_LOCKOUT
+  UINT32 ParkedUSec;
+
+
+  if (!FlagLockout) return;
+
+  multicore_lockout_end_blocking();
+
+  ParkedUSec = (UINT32)(time_us_64() - FlashLockoutTimeStamp);
+  ++FlashStats.LockoutCount;
+  FlashStats.LockoutTotalUSec += ParkedUSec;
+  if (ParkedUSec > FlashStats.LockoutMaxUSec) FlashStats.LockoutMaxUSec = ParkedUSec;
+#endif  // FLASH_MULTICORE_LOCKOUT
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_lockout_start() */
+/* ============================================================================================================================================================= *\
+                                            Park the other core in RAM before a flash erase or program.
+           NOTE: Called for each erase and each page program, so that the other core is parked only for the shortest possible time.
+                 Returns TRUE if the other core has been parked, so that the caller passes it back to flash_lockout_end().
+\* ============================================================================================================================================================= */
+static UINT8 flash_lockout_start(void)
+{
+#ifdef FLASH_MULTICORE_LOCKOUT
+  /* Only possible if the other core has accepted to be parked. */
+  if (multicore_lockout_victim_is_initialized(get_core_num() ^ 1))
+  {
+    FlashLockoutTimeStamp = time_us_64();
+    multicore_lockout_start_blocking();
+
+    return TRUE;
+  }
+#endif  // FLASH_MULTICORE_LOCKOUT
+
+  return FALSE;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_append() */
+/* ============================================================================================================================================================= *\
+                             Append a new version of a record at the head of the log-structured record store (the ring of FLASH_DATA_OFFSETx sectors).
+                    NOTES: The header is programmed before the data, so that a record interrupted by a reset is skipped (data CRC16 error) on next mount.
+                           When relocating live records out of a sector being reclaimed, Data points directly to flash memory.
+\* ============================================================================================================================================================= */
+static UINT8 flash_log_append(UINT16 RecordId, UINT8 *Data, UINT16 DataSize, UINT16 Flags, UINT8 FlagRelocate)
+{
+  struct flash_log_header Header;
+
+  INT16 Entry;
+
+  UINT8 Loop1UInt8;
+
+  UINT32 Offset;
+  UINT32 RecordSize;
+
+
+  RecordSize = FLASH_LOG_RECORD_SIZE(DataSize);
+  if (RecordSize > FLASH_SECTOR_SIZE) return 1;
+
+  /* Make sure there is room in the RAM index for a new record ID. */
+  if ((RecordId != FLASH_LOG_CHECKPOINT_ID) && (flash_log_find(RecordId) < 0) && (FlashLogRecordCount >= FLASH_LOG_MAX_RECORDS))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Too many different records in log-structured store (maximum: %u)\r", FLASH_LOG_MAX_RECORDS);
+    return 1;
+  }
+
+  /* If the record doesn't fit in what is left of the head sector, open the next sector of the ring (which is always kept erased) and reclaim the one after it,
+     so that there is always an erased sector ahead of the head. Relocated records always fit since they come from a single sector and the head has just been opened. */
+  for (Loop1UInt8 = 0; (FlashLogWriteOffset + RecordSize) > FLASH_SECTOR_SIZE; ++Loop1UInt8)
+  {
+    if (FlagRelocate || (Loop1UInt8 >= FLASH_LOG_SECTORS))
+    {
+      uart_send(__LINE__, __func__, "*** ERROR *** Log-structured store is full of live records.\r");
+      return 1;
+    }
+
+    FlashLogHead        = (FlashLogHead + 1) % FLASH_LOG_SECTORS;
+    FlashLogWriteOffset = 0;
+    if (flash_log_reclaim((FlashLogHead + 1) % FLASH_LOG_SECTORS)) return 1;
+  }
+
+  /* Build record header. */
+  Header.Magic       = FLASH_LOG_MAGIC;
+  Header.RecordId    = RecordId;
+  Header.Sequence    = FlashLogSequence + 1;
+  Header.DataSize    = DataSize;
+  Header.Flags       = Flags;
+  Header.DataCrc16   = util_crc16(Data, DataSize);
+  Header.HeaderCrc16 = util_crc16((UINT8 *)&Header, sizeof(Header) - 2);
+
+  /* Program header first, then data. */
+  Offset = FlashLogSectorOffset[FlashLogHead] + FlashLogWriteOffset;
+  if (flash_program(Offset, (UINT8 *)&Header, sizeof(Header))) return 1;
+  if (DataSize && flash_program(Offset + sizeof(Header), Data, DataSize)) return 1;
+
+  FlashLogWriteOffset += RecordSize;
+  FlashLogSequence     = Header.Sequence;
+
+  /* Checkpoints are not part of the RAM index. */
+  if (RecordId == FLASH_LOG_CHECKPOINT_ID) return 0;
+
+  /* Update RAM index (reclaim above may have moved entries, so look for it again). */
+  Entry = flash_log_find(RecordId);
+  if (Entry < 0) Entry = flash_log_insert(RecordId);
+  FlashLogIndex[Entry].DataSize = DataSize;
+  FlashLogIndex[Entry].Flags    = Flags;
+  FlashLogIndex[Entry].Sequence = Header.Sequence;
+  FlashLogIndex[Entry].Offset   = Offset;
+
+#if (FLASH_LOG_CHECKPOINT_INTERVAL > 0)
+  /* Write a new checkpoint from time to time, and after a sector reclaim (the previous checkpoint may refer to records that have been moved). */
+  if (!FlagRelocate && (FlagFlashLogReclaimed || (++FlashLogCheckpointCount >= FLASH_LOG_CHECKPOINT_INTERVAL))) return flash_log_checkpoint();
+#endif  // FLASH_LOG_CHECKPOINT_INTERVAL
+
+  return 0;
+}
+
+
+
+
+
+#if (FLASH_LOG_CHECKPOINT_INTERVAL > 0)
+/* $PAGE */
+/* $TITLE=flash_log_checkpoint() */
+/* ============================================================================================================================================================= *\
+                                             Write a checkpoint of the RAM index to the log-structured record store.
+              NOTES: On mount, only the records more recent than the latest checkpoint need to be replayed (and their data CRC checked).
+                     The RAM index itself is the data of the checkpoint. If appending the checkpoint reclaims a sector, the index has changed while
+                     it was being saved, so the checkpoint is written again (it now fits in the new head sector).
+\* ============================================================================================================================================================= */
+static UINT8 flash_log_checkpoint(void)
+{
+  UINT8 Loop1UInt8;
+
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < 2; ++Loop1UInt8)
+  {
+    FlagFlashLogReclaimed   = FLAG_OFF;
+    FlashLogCheckpointCount = 0;
+    if (flash_log_append(FLASH_LOG_CHECKPOINT_ID, (UINT8 *)FlashLogIndex, FlashLogRecordCount * sizeof(struct flash_log_entry), 0xFFFF, FALSE)) return 1;
+    if (!FlagFlashLogReclaimed) break;
+  }
+
+  return 0;
+}
+#endif  // FLASH_LOG_CHECKPOINT_INTERVAL
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_checkpoint_load() */
+/* ============================================================================================================================================================= *\
+                                               Load the latest checkpoint of the RAM index found by flash_log_scan().
+                 NOTE: Each entry is checked against the header it points to. Returns 1 if the checkpoint is stale (a full replay is then required).
+\* ============================================================================================================================================================= */
+static UINT8 flash_log_checkpoint_load(void)
+{
+  struct flash_log_entry *Checkpoint;
+  struct flash_log_header *Header;
+
+  UINT16 Count;
+  UINT16 Loop1UInt16;
+
+
+  Header     = (struct flash_log_header *)(XIP_BASE + FlashLogCheckpointOffset);
+  Checkpoint = (struct flash_log_entry *)((UINT8 *)Header + sizeof(struct flash_log_header));
+  Count      = Header->DataSize / sizeof(struct flash_log_entry);
+  if (Count > FLASH_LOG_MAX_RECORDS) return 1;
+
+  for (Loop1UInt16 = 0; Loop1UInt16 < Count; ++Loop1UInt16)
+  {
+    Header = (struct flash_log_header *)(XIP_BASE + Checkpoint[Loop1UInt16].Offset);
+    if ((Header->Magic != FLASH_LOG_MAGIC) || (Header->RecordId != Checkpoint[Loop1UInt16].RecordId) || (Header->Sequence != Checkpoint[Loop1UInt16].Sequence) ||
+        (util_crc16((UINT8 *)Header, sizeof(struct flash_log_header) - 2) != Header->HeaderCrc16))
+      return 1;
+
+    FlashLogIndex[Loop1UInt16] = Checkpoint[Loop1UInt16];
+  }
+  FlashLogRecordCount = Count;
+  flash_log_hash_rebuild();
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_delete() */
+/* ============================================================================================================================================================= *\
+                                                     Delete a record from the log-structured record store.
+                NOTE: A deletion marker is appended. It is kept in the RAM index until its sector is reclaimed, so that older versions are never seen again.
+\* ============================================================================================================================================================= */
+UINT8 flash_log_delete(UINT16 RecordId)
+{
+  INT16 Entry;
+
+  UINT8 ReturnCode;
+
+
+  if (!FlagFlashLogMounted && flash_log_mount()) return 1;
+
+  Entry = flash_log_find(RecordId);
+  if ((Entry < 0) || !(FlashLogIndex[Entry].Flags & FLASH_LOG_FLAG_DELETED)) return 0;  // nothing to delete.
+
+  ReturnCode = flash_log_append(RecordId, NULL, 0, (UINT16)~FLASH_LOG_FLAG_DELETED, FALSE);
+  flash_wear_check();
+
+  return ReturnCode;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_erase_count() */
+/* ============================================================================================================================================================= *\
+                                     Return the number of times a sector of the log-structured record store has been erased since power-up.
+\* ============================================================================================================================================================= */
+UINT32 flash_log_erase_count(UINT8 SectorNumber)
+{
+  if (SectorNumber >= FLASH_LOG_SECTORS) return 0;
+
+  return FlashLogEraseCount[SectorNumber];
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_find() */
+/* ============================================================================================================================================================= *\
+                                     Find the RAM index entry of a record of the log-structured record store (-1 if not found).
+\* ============================================================================================================================================================= */
+static INT16 flash_log_find(UINT16 RecordId)
+{
+  UINT16 Slot;
+
+
+  /* Linear probing from the hash slot of the record ID, up to a free slot. */
+  for (Slot = FLASH_LOG_HASH(RecordId); FlashLogHash[Slot] >= 0; Slot = (Slot + 1) % FLASH_LOG_HASH_SIZE)
+    if (FlashLogIndex[FlashLogHash[Slot]].RecordId == RecordId) return FlashLogHash[Slot];
+
+  return -1;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_hash_rebuild() */
+/* ============================================================================================================================================================= *\
+                                     Rebuild the hash table of the RAM index of the log-structured record store.
+\* ============================================================================================================================================================= */
+static void flash_log_hash_rebuild(void)
+{
+  UINT16 Loop1UInt16;
+  UINT16 Slot;
+
+
+  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_LOG_HASH_SIZE; ++Loop1UInt16)
+    FlashLogHash[Loop1UInt16] = -1;
+
+  for (Loop1UInt16 = 0; Loop1UInt16 < FlashLogRecordCount; ++Loop1UInt16)
+  {
+    for (Slot = FLASH_LOG_HASH(FlashLogIndex[Loop1UInt16].RecordId); FlashLogHash[Slot] >= 0; Slot = (Slot + 1) % FLASH_LOG_HASH_SIZE);
+    FlashLogHash[Slot] = Loop1UInt16;
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_insert() */
+/* ============================================================================================================================================================= *\
+                                  Add a record ID to the RAM index of the log-structured record store (-1 if the index is full).
+\* ============================================================================================================================================================= */
+static INT16 flash_log_insert(UINT16 RecordId)
+{
+  INT16 Entry;
+
+  UINT16 Slot;
+
+
+  if (FlashLogRecordCount >= FLASH_LOG_MAX_RECORDS) return -1;
+
+  Entry = FlashLogRecordCount++;
+  FlashLogIndex[Entry].RecordId = RecordId;
+  FlashLogIndex[Entry].Sequence = 0;
+
+  for (Slot = FLASH_LOG_HASH(RecordId); FlashLogHash[Slot] >= 0; Slot = (Slot + 1) % FLASH_LOG_HASH_SIZE);
+  FlashLogHash[Slot] = Entry;
+
+  return Entry;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_locate() */
+/* ============================================================================================================================================================= *\
+                          Return a pointer to the data of the latest version of a record, directly in flash memory (NULL if not found or deleted).
+\* ============================================================================================================================================================= */
+const UINT8 *flash_log_locate(UINT16 RecordId, UINT16 *DataSize)
+{
+  INT16 Entry;
+
+
+  if (!FlagFlashLogMounted && flash_log_mount()) return NULL;
+
+  Entry = flash_log_find(RecordId);
+  if ((Entry < 0) || !(FlashLogIndex[Entry].Flags & FLASH_LOG_FLAG_DELETED)) return NULL;
+
+  *DataSize = FlashLogIndex[Entry].DataSize;
+
+  return (UINT8 *)(XIP_BASE + FlashLogIndex[Entry].Offset + sizeof(struct flash_log_header));
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_mount() */
+/* ============================================================================================================================================================= *\
+                                          Scan the ring of the log-structured record store and rebuild its RAM index.
+                    NOTE: Also completes a sector reclaim that may have been interrupted by a reset, so that there is always an erased sector ahead of the head.
+\* ============================================================================================================================================================= */
+UINT8 flash_log_mount(void)
+{
+  UINT8 Loop1UInt8;
+
+  UINT32 SectorEnd[FLASH_LOG_SECTORS];
+
+  UINT64 TimeStamp;
+
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_LOG, "Entering flash_log_mount()\r");
+
+  TimeStamp                  = time_us_64();
+  FlagFlashLogMounted        = FLAG_OFF;
+  FlashLogHead               = 0;
+  FlashLogRecordCount        = 0;
+  FlashLogSequence           = 0;
+  FlashLogCheckpointSequence = 0;
+  FlashStats.LogReplayed     = 0;
+  flash_log_hash_rebuild();
+
+  /* First pass only walks the record headers of all sectors. It finds the head (the sector containing the highest sequence number) and the latest checkpoint. */
+  for (Loop1UInt8 = 0; Loop1UInt8 < FLASH_LOG_SECTORS; ++Loop1UInt8)
+    SectorEnd[Loop1UInt8] = flash_log_scan(Loop1UInt8, 0xFFFFFFFF);
+
+  /* Start from the latest checkpoint, if any, then replay the records that are more recent. */
+  if (FlashLogCheckpointSequence && flash_log_checkpoint_load())
+  {
+    FlashLogCheckpointSequence = 0;
+    FlashLogRecordCount        = 0;
+    flash_log_hash_rebuild();
+  }
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < FLASH_LOG_SECTORS; ++Loop1UInt8)
+    flash_log_scan(Loop1UInt8, FlashLogCheckpointSequence);
+
+  if (FlashLogSequence == 0)
+  {
+    /* No record found, start a new ring at first sector. */
+    if (!flash_is_blank(FlashLogSectorOffset[0], FLASH_SECTOR_SIZE))
+    {
+      if (flash_erase(FlashLogSectorOffset[0])) return 1;
+      ++FlashLogEraseCount[0];
+    }
+    SectorEnd[0] = 0;
+  }
+  FlashLogWriteOffset = SectorEnd[FlashLogHead];
+
+  /* Make sure the sector ahead of the head is erased. */
+  FlagFlashLogReclaimed   = FLAG_OFF;
+  FlashLogCheckpointCount = 0;
+  if (flash_log_reclaim((FlashLogHead + 1) % FLASH_LOG_SECTORS)) return 1;
+
+  FlagFlashLogMounted = FLAG_ON;
+
+  FlashStats.LogMountUSec  = (UINT32)(time_us_64() - TimeStamp);
+  FlashStats.LogIndexBytes = sizeof(FlashLogIndex) + sizeof(FlashLogHash);
+  FlashStats.LogRecords    = FlashLogRecordCount;
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_LOG)
+  uart_send(__LINE__, __func__, "Head sector: %u   Write offset: 0x%4.4X   Sequence: %lu   Records: %u\r", FlashLogHead, FlashLogWriteOffset, FlashLogSequence, FlashLogRecordCount);
+  uart_send(__LINE__, __func__, "Exiting flash_log_mount()\r");
+#endif  // FLASH_DEBUG_ENABLED
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_read() */
+/* ============================================================================================================================================================= *\
+                                     Read the latest version of a record from the log-structured record store.
+                    NOTE: At most DataSize bytes are copied to Data. Returns 1 if the record has never been written or has been deleted.
+\* ============================================================================================================================================================= */
+UINT8 flash_log_read(UINT16 RecordId, UINT8 *Data, UINT16 DataSize)
+{
+  const UINT8 *Source;
+
+  UINT16 SourceSize;
+
+
+  Source = flash_log_locate(RecordId, &SourceSize);
+  if (Source == NULL) return 1;
+
+  if (DataSize > SourceSize) DataSize = SourceSize;
+  memcpy(Data, Source, DataSize);
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_reclaim() */
+/* ============================================================================================================================================================= *\
+                                     Move the live records out of a sector of the ring (to the head sector) and erase it.
+\* ============================================================================================================================================================= */
+static UINT8 flash_log_reclaim(UINT8 SectorNumber)
+{
+  UINT16 Loop1UInt16;
+
+  UINT32 SectorOffset;
+
+
+  SectorOffset = FlashLogSectorOffset[SectorNumber];
+
+  /* Records whose latest version is in this sector are appended again at the head. Deletion markers are simply dropped from the RAM index, since all older
+     versions were in this sector or in sectors already reclaimed. */
+  for (Loop1UInt16 = FlashLogRecordCount; Loop1UInt16-- > 0; )
+  {
+    if ((FlashLogIndex[Loop1UInt16].Offset < SectorOffset) || (FlashLogIndex[Loop1UInt16].Offset >= (SectorOffset + FLASH_SECTOR_SIZE))) continue;
+
+    if (FlashLogIndex[Loop1UInt16].Flags & FLASH_LOG_FLAG_DELETED)
+    {
+      if (flash_log_append(FlashLogIndex[Loop1UInt16].RecordId, (UINT8 *)(XIP_BASE + FlashLogIndex[Loop1UInt16].Offset + sizeof(struct flash_log_header)),
+                           FlashLogIndex[Loop1UInt16].DataSize, FlashLogIndex[Loop1UInt16].Flags, TRUE)) return 1;
+    }
+    else
+    {
+      FlashLogIndex[Loop1UInt16] = FlashLogIndex[--FlashLogRecordCount];
+      flash_log_hash_rebuild();
+    }
+  }
+
+  /* Only erase when required. */
+  if (!flash_is_blank(SectorOffset, FLASH_SECTOR_SIZE))
+  {
+    if (flash_erase(SectorOffset)) return 1;
+    ++FlashLogEraseCount[SectorNumber];
+    FlagFlashLogReclaimed = FLAG_ON;
+  }
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_scan() */
+/* ============================================================================================================================================================= *\
+                                     Scan the records of a sector of the ring and update the RAM index with the latest version of each record.
+                    NOTES: Returns the offset of free space in the sector. A torn or foreign header closes the sector (returns FLASH_SECTOR_SIZE).
+                           Only records whose sequence number is above MinSequence are checked and added to the RAM index.
+                           Checkpoints are never added to the RAM index; the latest valid one is remembered for flash_log_mount().
+\* ============================================================================================================================================================= */
+static UINT32 flash_log_scan(UINT8 SectorNumber, UINT32 MinSequence)
+{
+  struct flash_log_header *Header;
+
+  INT16 Entry;
+
+  UINT32 Offset;
+  UINT32 SectorOffset;
+
+
+  SectorOffset = FlashLogSectorOffset[SectorNumber];
+
+  for (Offset = 0; (Offset + sizeof(struct flash_log_header)) <= FLASH_SECTOR_SIZE; Offset += FLASH_LOG_RECORD_SIZE(Header->DataSize))
+  {
+    Header = (struct flash_log_header *)(XIP_BASE + SectorOffset + Offset);
+
+    /* Beginning of free space. */
+    if (flash_is_blank(SectorOffset + Offset, sizeof(struct flash_log_header))) break;
+
+    /* Torn or foreign header, the rest of this sector can't be trusted. */
+    if ((Header->Magic != FLASH_LOG_MAGIC) || (util_crc16((UINT8 *)Header, sizeof(struct flash_log_header) - 2) != Header->HeaderCrc16) ||
+        (FLASH_LOG_RECORD_SIZE(Header->DataSize) > (FLASH_SECTOR_SIZE - Offset)))
+      return FLASH_SECTOR_SIZE;
+
+    if (Header->Sequence > FlashLogSequence)
+    {
+      FlashLogSequence = Header->Sequence;
+      FlashLogHead     = SectorNumber;
+    }
+
+    if (Header->RecordId == FLASH_LOG_CHECKPOINT_ID)
+    {
+      if ((Header->Sequence > FlashLogCheckpointSequence) && (util_crc16((UINT8 *)Header + sizeof(struct flash_log_header), Header->DataSize) == Header->DataCrc16))
+      {
+        FlashLogCheckpointOffset   = SectorOffset + Offset;
+        FlashLogCheckpointSequence = Header->Sequence;
+      }
+      continue;
+    }
+
+    /* Records already in the checkpoint. */
+    if (Header->Sequence <= MinSequence) continue;
+
+    /* Skip records whose data has been torn by a reset. */
+    ++FlashStats.LogReplayed;
+    if (util_crc16((UINT8 *)Header + sizeof(struct flash_log_header), Header->DataSize) != Header->DataCrc16) continue;
+
+    Entry = flash_log_find(Header->RecordId);
+    if ((Entry < 0) && ((Entry = flash_log_insert(Header->RecordId)) < 0)) continue;
+
+    if (Header->Sequence > FlashLogIndex[Entry].Sequence)
+    {
+      FlashLogIndex[Entry].DataSize = Header->DataSize;
+      FlashLogIndex[Entry].Flags    = Header->Flags;
+      FlashLogIndex[Entry].Sequence = Header->Sequence;
+      FlashLogIndex[Entry].Offset   = SectorOffset + Offset;
+    }
+  }
+
+  return Offset;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_log_write() */
+/* ============================================================================================================================================================= *\
+                                          Append a new version of a record to the log-structured record store.
+             NOTE: Contrary to flash_save_data(), no sector is erased here, except when the ring wraps around and the oldest sector must be reclaimed.
+\* ============================================================================================================================================================= */
+UINT8 flash_log_write(UINT16 RecordId, UINT8 *Data, UINT16 DataSize)
+{
+  UINT8 ReturnCode;
+
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_LOG, "Entering flash_log_write() - RecordId: %u   DataSize: %u\r", RecordId, DataSize);
+
+  if (DataSize > FLASH_LOG_MAX_DATA_SIZE)
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Record size is too big (0x%4.4X), must be 0x%4.4X maximum.\r", DataSize, (UINT32)FLASH_LOG_MAX_DATA_SIZE);
+    return 1;
+  }
+
+  if (RecordId == FLASH_LOG_CHECKPOINT_ID) return 1;
+
+  if (!FlagFlashLogMounted && flash_log_mount()) return 1;
+
+  FlashWearPending.BytesRequested += DataSize;
+
+  ReturnCode = flash_log_append(RecordId, Data, DataSize, 0xFFFF, FALSE);
+  flash_wear_check();
+
+  return ReturnCode;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_page_compare() */
+/* ============================================================================================================================================================= *\
+                                                  Compare a page of new data with current flash content.
+      NOTE: Returns FLASH_PAGE_IDENTICAL, FLASH_PAGE_PROGRAM (only 1 bits become 0, page may be programmed as is) or FLASH_PAGE_ERASE (some 0 bits become 1).
+\* ============================================================================================================================================================= */
+static UINT8 flash_page_compare(UINT8 *CurrentPage, UINT8 *NewPage)
+{
+  UINT8 Result;
+
+  UINT16 Loop1UInt16;
+
+  UINT32 *CurrentWord;
+  UINT32 *NewWord;
+
+
+  Result = FLASH_PAGE_IDENTICAL;
+
+  if (((uintptr_t)NewPage % sizeof(UINT32)) == 0)
+  {
+    /* Compare 32 bits at a time (flash pages are always word-aligned). */
+    CurrentWord = (UINT32 *)CurrentPage;
+    NewWord     = (UINT32 *)NewPage;
+
+    for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_PAGE_SIZE / sizeof(UINT32)); ++Loop1UInt16)
+    {
+      if (CurrentWord[Loop1UInt16] != NewWord[Loop1UInt16])
+      {
+        if ((CurrentWord[Loop1UInt16] & NewWord[Loop1UInt16]) != NewWord[Loop1UInt16]) return FLASH_PAGE_ERASE;
+        Result = FLASH_PAGE_PROGRAM;
+      }
+    }
+  }
+  else
+  {
+    for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_PAGE_SIZE; ++Loop1UInt16)
+    {
+      if (CurrentPage[Loop1UInt16] != NewPage[Loop1UInt16])
+      {
+        if ((CurrentPage[Loop1UInt16] & NewPage[Loop1UInt16]) != NewPage[Loop1UInt16]) return FLASH_PAGE_ERASE;
+        Result = FLASH_PAGE_PROGRAM;
+      }
+    }
+  }
+
+  return Result;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_payload_check() */
+/* ============================================================================================================================================================= *\
+                                                    Check the header saved by flash_save_data() in front of data.
+            NOTE: Returns 0 if the header is valid and announces DataSize bytes of data. A blank sector, a sector written by something else or data saved with
+                  another size are rejected after reading only the header, without computing the CRC16 of data. Always valid when FLASH_PAYLOAD_HEADER is 0.
+\* ============================================================================================================================================================= */
+static UINT8 flash_payload_check(const UINT8 *Sector, UINT16 DataSize)
+{
+#if FLASH_PAYLOAD_HEADER
+  const struct flash_payload_header *Header;
+
+
+  Header = (const struct flash_payload_header *)Sector;
+
+  /* Magic number first: an erased sector (0xFFFF) is rejected here. */
+  if ((Header->Magic != FLASH_PAYLOAD_MAGIC) || (Header->Version != FLASH_PAYLOAD_VERSION) || (Header->DataSize != DataSize)) return 1;
+  if (util_crc16((UINT8 *)Header, offsetof(struct flash_payload_header, HeaderCrc16)) != Header->HeaderCrc16) return 1;
+#endif  // FLASH_PAYLOAD_HEADER
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_payload_stage() */
+/* ============================================================================================================================================================= *\
+                                  Build the image of data saved by flash_save_data() at the beginning of a sector (header, then data).
+\* ============================================================================================================================================================= */
+static void flash_payload_stage(UINT8 *Sector, UINT8 *Data, UINT16 DataSize)
+{
+#if FLASH_PAYLOAD_HEADER
+  struct flash_payload_header Header;
+
+
+  Header.Magic       = FLASH_PAYLOAD_MAGIC;
+  Header.Version     = FLASH_PAYLOAD_VERSION;
+  Header.Reserved    = 0xFF;
+  Header.DataSize    = DataSize;
+  Header.HeaderCrc16 = util_crc16((UINT8 *)&Header, offsetof(struct flash_payload_header, HeaderCrc16));
+  memcpy(Sector, &Header, sizeof(Header));
+#endif  // FLASH_PAYLOAD_HEADER
+
+  memcpy(&Sector[FLASH_PAYLOAD_OFFSET], Data, DataSize);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_program() */
+/* ============================================================================================================================================================= *\
+                                          Program data to an erased area of flash memory, one page at a time.
+               NOTES: DataOffset and DataSize don't need to be aligned. Bytes of the pages that are not part of Data are programmed as 0xFF (left unchanged).
+                      Data may point to flash memory, since each page is first copied to RAM before interrupts (and XIP) are disabled.
+\* ============================================================================================================================================================= */
+static UINT8 flash_program(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize)
+{
+  UINT8 FlagLockout;
+  UINT8 PageBuffer[FLASH_PAGE_SIZE];
+
+  UINT32 ChunkSize;
+  UINT32 InterruptMask;
+  UINT32 PageIndex;
+  UINT32 PageOffset;
+  UINT32 TimeStamp;
+
+
+  while (DataSize > 0)
+  {
+    PageOffset = DataOffset & ~(FLASH_PAGE_SIZE - 1);
+    PageIndex  = DataOffset - PageOffset;
+    ChunkSize  = FLASH_PAGE_SIZE - PageIndex;
+    if (ChunkSize > DataSize) ChunkSize = DataSize;
+
+    memset(PageBuffer, 0xFF, FLASH_PAGE_SIZE);
+    memcpy(&PageBuffer[PageIndex], Data, ChunkSize);
+    flash_view_invalidate(DataOffset, ChunkSize);
+#if (FLASH_CACHE_SECTORS > 0)
+    flash_cache_invalidate(DataOffset, ChunkSize);
+#endif  // FLASH_CACHE_SECTORS
+
+    /* Park the other core and disable interrupts during flash writing, for one page at a time. */
+    FlagLockout   = flash_lockout_start();
+    InterruptMask = save_and_disable_interrupts();
+    TimeStamp     = time_us_32();
+    flash_range_program(PageOffset, PageBuffer, FLASH_PAGE_SIZE);
+    TimeStamp     = time_us_32() - TimeStamp;
+    restore_interrupts(InterruptMask);
+    flash_lockout_end(FlagLockout);
+    FlashWearPending.BytesProgrammed += FLASH_PAGE_SIZE;
+    FLASH_LATENCY_ADD(Program, TimeStamp);
+    FLASH_LATENCY_ADD(IrqOff,  TimeStamp);
+
+    FLASH_TRACE("Page 0x%6.6X programmed (0x%X bytes)\r", PageOffset, ChunkSize);
+
+    Data       += ChunkSize;
+    DataOffset += ChunkSize;
+    DataSize   -= ChunkSize;
+  }
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_read_data() */
+/* ============================================================================================================================================================= *\
+                                                                   Read data from flash memory.
+\* ============================================================================================================================================================= */
+UINT8 flash_read_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
+{
+#if (FLASH_CACHE_SECTORS > 0)
+  INT16 Entry;
+#endif  // FLASH_CACHE_SECTORS
+
+  UINT8 *Source;
+
+  UINT16 Crc16Computed;
+  UINT16 Crc16Extracted;
+  UINT16 Loop1UInt16;
+
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_READ)
+  uart_send(__LINE__, __func__, " =======================================================================================================================\r");
+  uart_send(__LINE__, __func__, "      Entering flash_read_data()\r");
+  uart_send(__LINE__, __func__, "      Read current data from Pico's flash\r");
+  uart_send(__LINE__, __func__, "      XIP_BASE (flash base address):              0x%8.8X\r", XIP_BASE);
+  uart_send(__LINE__, __func__, "      Data offset in flash:                       0x%8.8X\r", DataOffset);
+  uart_send(__LINE__, __func__, "      Pointer to variable that will contain data: 0x%8.8X\r", Data);
+  uart_send(__LINE__, __func__, "      Size of data to be read from flash:             0x%4.4X  (%u)\r", DataSize, DataSize);
+  uart_send(__LINE__, __func__, "      Displaying data retrieved from flash memory...\r");
+  uart_send(__LINE__, __func__, " =======================================================================================================================\r");
+#endif  // FLASH_DEBUG_ENABLED
+
+  /* Read configuration data from Pico's flash memory (as an array of UINT8), or from the write-back cache if the sector is cached. */
+  Source = (UINT8 *)(XIP_BASE + DataOffset);
+#if (FLASH_CACHE_SECTORS > 0)
+  Entry  = flash_cache_find(DataOffset & ~(FLASH_SECTOR_SIZE - 1));
+  if ((Entry >= 0) && (((DataOffset % FLASH_SECTOR_SIZE) + FLASH_PAYLOAD_OFFSET + DataSize) <= FLASH_SECTOR_SIZE)) Source = &FlashCache[Entry].Data[DataOffset % FLASH_SECTOR_SIZE];
+#endif  // FLASH_CACHE_SECTORS
+
+  /* Blank sector, foreign data or data saved with another size is rejected before reading data itself. */
+  if (flash_payload_check(Source, DataSize))
+  {
+    if (stdio_usb_connected()) uart_send(__LINE__, __func__, "No valid data header in flash.\r");
+
+    return 1;
+  }
+
+  Source += FLASH_PAYLOAD_OFFSET;
+  for (Loop1UInt16 = 0; Loop1UInt16 < DataSize; ++Loop1UInt16)
+    Data[Loop1UInt16] = Source[Loop1UInt16];
+
+  Crc16Extracted = flash_extract_crc(Data, DataSize);  // CRC16 extracted from data retrieved from flash memory.
+  Crc16Computed  = util_crc16(Data, DataSize - 2);     // CRC16 computed from data retrieved from flash (excluding the CRC16 itself).
+
+
+  /* Optionally display configuration data retrieved from flash memory and CRC16. */
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_READ)
+  util_display_data(Data, DataSize);
+  uart_send(__LINE__, __func__, "CRC16 extracted from packet:   0x%4.4X\r",     Crc16Extracted);
+  uart_send(__LINE__, __func__, "CRC16 computed from data read: 0x%4.4X\r\r\r", Crc16Computed);
+#endif  // FLASH_DEBUG_ENABLED
+
+
+  if (Crc16Extracted != Crc16Computed)
+  {
+    /* CRC16 is not valid. */
+    if (stdio_usb_connected()) uart_send(__LINE__, __func__, "Flash configuration is invalid.\r");
+
+    return 1;
+  }
+
+  return 0;  // CRC is valid.
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_read_range() */
+/* ============================================================================================================================================================= *\
+                                 Read data of any size from any offset of Pico's flash memory, across as many sectors as required.
+                                       NOTE: Contrary to flash_read_data(), no CRC16 is expected nor validated.
+\* ============================================================================================================================================================= */
+UINT8 flash_read_range(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize)
+{
+#if (FLASH_CACHE_SECTORS > 0)
+  INT16 Entry;
+
+  UINT32 End;
+  UINT32 Start;
+
+
+#endif  // FLASH_CACHE_SECTORS
+  if ((DataOffset > PICO_FLASH_SIZE_BYTES) || (DataSize > (PICO_FLASH_SIZE_BYTES - DataOffset)))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Range 0x%8.8X + 0x%8.8X is outside of flash memory.\r", DataOffset, DataSize);
+    return 1;
+  }
+
+  memcpy(Data, (UINT8 *)(XIP_BASE + DataOffset), DataSize);
+
+#if (FLASH_CACHE_SECTORS > 0)
+  /* Sectors in the write-back cache may be more recent than flash. */
+  for (Entry = 0; Entry < FLASH_CACHE_SECTORS; ++Entry)
+  {
+    if (!FlashCache[Entry].FlagValid) continue;
+
+    Start = (FlashCache[Entry].SectorOffset > DataOffset) ? FlashCache[Entry].SectorOffset : DataOffset;
+    End   = ((FlashCache[Entry].SectorOffset + FLASH_SECTOR_SIZE) < (DataOffset + DataSize)) ? (FlashCache[Entry].SectorOffset + FLASH_SECTOR_SIZE) : (DataOffset + DataSize);
+    if (Start < End) memcpy(&Data[Start - DataOffset], &FlashCache[Entry].Data[Start - FlashCache[Entry].SectorOffset], End - Start);
+  }
+#endif  // FLASH_CACHE_SECTORS
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_save_data() */
+/* ============================================================================================================================================================= *\
+                                                                    Save current data to flash.
+            NOTE: Returns FLASH_SAVE_WRITTEN, FLASH_SAVE_SKIPPED when flash already contained the same data (nothing written), or FLASH_SAVE_ERROR.
+                  A caller only interested in errors must thus compare the return code with FLASH_SAVE_ERROR.
+\* ============================================================================================================================================================= */
+UINT8 flash_save_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
+{
+#if (FLASH_CACHE_SECTORS > 0)
+  UINT8 ReturnCode;
+#endif  // FLASH_CACHE_SECTORS
+
+  UINT16 Crc16;
+
+  UINT32 TimeStamp;
+
+
+  FLASH_TRACE("Saving 0x%X bytes to offset 0x%6.6X\r", DataSize, DataOffset);
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_SAVE)
+  uart_send(__LINE__, __func__, "Entering flash_save_data()\r");
+  uart_send(__LINE__, __func__, "=========================================================================================================\r");
+  uart_send(__LINE__, __func__, "     FLASH_SECTOR_SIZE:                      %8u\r",        FLASH_SECTOR_SIZE);
+  uart_send(__LINE__, __func__, "     XIP_BASE (flash base address):        0x%8.8X\r",      XIP_BASE);
+  uart_send(__LINE__, __func__, "     Data offset:                          0x%8.8X\r",      DataOffset);
+  uart_send(__LINE__, __func__, "     Pointer to beginning of Data:         0x%8.8X\r",      Data);
+  uart_send(__LINE__, __func__, "     Data size:                            0x%8.8X (%u)\r", DataSize, DataSize);
+  uart_send(__LINE__, __func__, "     Data size for CRC16 calculation:      0x%8.8X (%u)\r", (((Data - RAM_BASE_ADDRESS + DataSize) - (Data - RAM_BASE_ADDRESS)) - 2), (((Data - RAM_BASE_ADDRESS + DataSize) - (Data - RAM_BASE_ADDRESS)) - 2));
+  uart_send(__LINE__, __func__, "     Pointer to CRC16:                     0x%8.8X\r",      Data + DataSize - 2);
+  uart_send(__LINE__, __func__, "=========================================================================================================\r");
+  
+  /* Display data being saved. */
+  uart_send(__LINE__, __func__, "     Current data before computing CRC16:\r");
+  util_display_data(Data, DataSize);
+
+  /* Make sure all debug output has been sent before interrupts are disabled. */
+  stdio_flush();
+#endif  // FLASH_DEBUG_ENABLED
+
+  /* Beginning of the save (debug output above is not part of its latency). */
+  TimeStamp = time_us_32();
+
+  /* Validate size of data (the header saved in front of data uses FLASH_PAYLOAD_OFFSET bytes of the sector). */
+  if (DataSize > FLASH_PAYLOAD_MAX_SIZE)
+  {
+    printf("\r\r\r\r\r");
+    uart_send(__LINE__, __func__, "*** FATAL *** Data size to save to flash is too big (0x%4.4X)\r", DataSize);
+    uart_send(__LINE__, __func__, "Must be 0x%4.4X maximum. Fix this problem and rebuild the Firmware...\r\r", FLASH_PAYLOAD_MAX_SIZE);
+
+    return FLASH_SAVE_ERROR;
+  }
+
+
+  if (DataOffset % FLASH_SECTOR_SIZE)
+  {
+    /* Data offset specified is not aligned on a flash sector boundary. */
+    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
+    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
+    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
+
+    return FLASH_SAVE_ERROR;
+  }
+
+
+  /* Compute CRC16 of packet to be saved. */
+  Crc16 = util_crc16(Data, DataSize - 2);
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_SAVE)
+  uart_send(__LINE__, __func__, "Pointer to data to be saved to flash: 0x%p\r", Data);
+  uart_send(__LINE__, __func__, "Data size:                                  %4u (0x%X)\r", DataSize,     DataSize);
+  uart_send(__LINE__, __func__, "Data size for CRC calculation:              %4u (0x%X)\r", DataSize - 2, DataSize - 2);
+  uart_send(__LINE__, __func__, "CRC computed:                             0x%4.4X\r", Crc16);
+#endif  // FLASH_DEBUG_ENABLED
+
+  /* Insert CRC16 as last 16 bits of the packet. */
+  *(UINT16 *)(Data + DataSize - 2) = Crc16;
+
+  if (flash_async_pending(DataOffset, FLASH_SECTOR_SIZE))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** An asynchronous save of offset 0x%8.8X is queued or in progress.\r", DataOffset);
+    return FLASH_SAVE_ERROR;
+  }
+
+  ++FlashStats.SaveRequests;
+  FlashStats.LastSaveWritten = FALSE;
+  FlashWearPending.BytesRequested += DataSize;
+
+#if (FLASH_CACHE_SECTORS > 0)
+  /* Only update the write-back cache, flash is written later. */
+  ReturnCode = flash_cache_update(DataOffset, Data, DataSize);
+  FLASH_LATENCY_ADD(Save, time_us_32() - TimeStamp);
+
+  return ReturnCode;
+#else   // FLASH_CACHE_SECTORS
+  /* Nothing to do if flash already contains the same data (for example, periodic saves of unchanged settings). */
+  if ((flash_payload_check((UINT8 *)(XIP_BASE + DataOffset), DataSize) == 0) && flash_is_identical(DataOffset + FLASH_PAYLOAD_OFFSET, Data, DataSize))
+  {
+    ++FlashStats.SaveSkipped;
+    ++FlashWearPending.WritesSkipped;
+    FLASH_TRACE("Data at offset 0x%6.6X is identical, nothing to write\r", DataOffset);
+    FLASH_LATENCY_ADD(Save, time_us_32() - TimeStamp);
+
+    return FLASH_SAVE_SKIPPED;
+  }
+
+  /* Save data to flash. */
+  if (flash_write(DataOffset, Data, DataSize)) return FLASH_SAVE_ERROR;
+  FlashStats.LastSaveWritten = TRUE;
+  FLASH_LATENCY_ADD(Save, time_us_32() - TimeStamp);
+
+  /* Display flash data as saved. NOTE: Will crash the firmware if done inside a callback. */
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_SAVE)
+  uart_send(__LINE__, __func__, "Display flash data as saved:\r");
+  util_display_data(Data, DataSize);
+  uart_send(__LINE__, __func__, "Exiting flash_save_data())\r");
+#endif  // FLASH_DEBUG_ENABLED
+
+  return FLASH_SAVE_WRITTEN;
+#endif  // FLASH_CACHE_SECTORS
+}
+
+
+
+
+
+#if ((FLASH_CACHE_SECTORS == 0) || (FLASH_BENCH_SECTORS > 0))
+/* $PAGE */
+/* $TITLE=flash_write() */
+/* ============================================================================================================================================================= *\
+                                                               Write data to Pico's flash memory.
+        NOTE: Not power-fail safe. A reset after the sector has been erased and before its last page has been programmed loses the data (flash_read_data()
+              then reports that no valid data is found, it never returns corrupted data). Use flash_ab_save() or the log-structured record store when data
+              must survive a reset at any time (see the power-loss campaign in Pico-Flash-Fault.c).
+\* ============================================================================================================================================================= */
+UINT8 flash_write(UINT32 DataOffset, UINT8 *NewData, UINT16 NewDataSize)
+{
+  UINT8 *FlashBaseAddress;
+  UINT8 *FlashSector;
+
+  UINT16 Loop1UInt16;
+
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_WRITE)
+  uart_send(__LINE__, __func__, "Entering flash_write()\r");
+  uart_send(__LINE__, __func__, "=========================================================================================================\r");
+  uart_send(__LINE__, __func__, "     FLASH_SECTOR_SIZE:                    0x%8.8X (%u)\r", FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+  uart_send(__LINE__, __func__, "     XIP_BASE (flash base address):        0x%8.8X\r",      XIP_BASE);
+  uart_send(__LINE__, __func__, "     Data offset:                          0x%8.8X\r",      DataOffset);
+  uart_send(__LINE__, __func__, "     Pointer to beginning of data:         0x%8.8X\r",      NewData);
+  uart_send(__LINE__, __func__, "     Data size for CRC16 calculation:      0x%8.8X (%u)\r", (((NewData - RAM_BASE_ADDRESS + NewDataSize) - (NewData - RAM_BASE_ADDRESS)) - 2), (((NewData - RAM_BASE_ADDRESS + NewDataSize) - (NewData - RAM_BASE_ADDRESS)) - 2));
+  uart_send(__LINE__, __func__, "     Pointer to CRC16:                     0x%8.8X\r",      NewData + NewDataSize - 2);
+  uart_send(__LINE__, __func__, "     Data size:                            0x%8.8X (%u)\r", NewDataSize, NewDataSize);
+  uart_send(__LINE__, __func__, "=========================================================================================================\r");
+  uart_send(__LINE__, __func__, "     Displaying data to be written to flash.\r");
+  util_display_data(NewData, NewDataSize);
+
+  /* Make sure all debug output has been sent before interrupts are disabled. */
+  stdio_flush();
+#endif  // FLASH_DEBUG_ENABLED
+
+
+  if (DataOffset % FLASH_SECTOR_SIZE)
+  {
+    /* Data offset specified is not aligned on a flash sector boundary. */
+    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
+    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
+    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
+
+    return 1;
+  }
+
+
+  /* NOTE: A wear leveling algorithm has not been implemented here since the flash usage for saving configuration data will usually not require it.
+     However, flash write should not be used for intensive data logging. Use the log-structured record store (flash_log_write()) instead. */
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+  FlashSector      = flash_scratch_acquire(FLASH_SECTOR_SIZE);
+  if (FlashSector == NULL) return 1;  // scratch buffer not available.
+  FLASH_DEBUG(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_WRITE, "FlashSector address: 0x%p\r", FlashSector);
+
+
+  /* Take a copy of current flash sector content. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_SECTOR_SIZE; ++Loop1UInt16) FlashSector[Loop1UInt16] = FlashBaseAddress[DataOffset + Loop1UInt16];
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_WRITE)
+  uart_send(__LINE__, __func__, "FlashSector: 0x%p   FlashBaseAddress: 0x%p   Data offset: 0x%6.6X\r", FlashSector, FlashBaseAddress, DataOffset);
+  uart_send(__LINE__, __func__, "Displaying original data retrieved from flash\r");
+  util_display_data(FlashSector, FLASH_SECTOR_SIZE);
+#endif  // FLASH_DEBUG_ENABLED
+
+
+  /* Overwrite the sector area that we want to save (header, then data). */
+  flash_payload_stage(FlashSector, NewData, NewDataSize);
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_WRITE)
+  uart_send(__LINE__, __func__, "Display data to be written back to flash at offset %X:\r", DataOffset);
+  util_display_data(FlashSector, FLASH_SECTOR_SIZE);
+
+  /* Make sure all debug output has been sent before interrupts are disabled. */
+  stdio_flush();
+#endif  // FLASH_DEBUG_ENABLED
+
+
+  /* Compare with current content and erase / program only what is required. */
+  if (flash_write_sector(DataOffset, FlashSector))
+  {
+    flash_scratch_release();
+    return 1;
+  }
+
+  /* Release scratch buffer when done. */
+  flash_scratch_release();
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_WRITE, "Exiting flash_write()\r");
+
+  return 0;
+}
+#endif  // FLASH_CACHE_SECTORS / FLASH_BENCH_SECTORS
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_scratch_acquire() */
+/* ============================================================================================================================================================= *\
+                                           Reserve the scratch buffer used to stage a sector before writing it to flash.
+              NOTE: Returns NULL if the scratch buffer is too small or already in use (for example, a save requested from a callback while another one
+                    is in progress), so that the nested request fails cleanly.
+\* ============================================================================================================================================================= */
+static UINT8 *flash_scratch_acquire(UINT32 DataSize)
+{
+  UINT8 FlagBusy;
+
+  UINT32 InterruptMask;
+  UINT32 Needed;
+
+
+  /* Test and set the busy flag with interrupts disabled, so that an interrupt handler can't acquire it at the same time. */
+  InterruptMask = save_and_disable_interrupts();
+  FlagBusy      = FlagFlashScratchBusy;
+  if (!FlagBusy && (DataSize <= FlashScratchSize)) FlagFlashScratchBusy = FLAG_ON;
+
+  /* Bytes needed at once for this request, on top of the current user's for a nested request. */
+  Needed = FlagBusy ? (FlashScratchInUse + DataSize) : DataSize;
+  if (Needed > FlashStats.ScratchHighWater) FlashStats.ScratchHighWater = Needed;
+  if (!FlagBusy && (DataSize <= FlashScratchSize)) FlashScratchInUse = DataSize;
+  restore_interrupts(InterruptMask);
+
+  if (FlagBusy || (DataSize > FlashScratchSize))
+  {
+    ++FlashStats.ScratchBusy;
+    uart_send(__LINE__, __func__, "*** ERROR *** Scratch buffer %s (0x%X bytes requested).\r", FlagBusy ? "already in use" : "too small", DataSize);
+    return NULL;
+  }
+
+  return FlashScratch;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_scratch_release() */
+/* ============================================================================================================================================================= *\
+                                                     Release the scratch buffer reserved by flash_scratch_acquire().
+\* ============================================================================================================================================================= */
+static void flash_scratch_release(void)
+{
+  FlashScratchInUse    = 0;
+  FlagFlashScratchBusy = FLAG_OFF;
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_set_scratch() */
+/* ============================================================================================================================================================= *\
+                              Provide a scratch buffer used to stage a sector before writing it to flash, instead of the static one.
+                     NOTE: Buffer must be word-aligned and at least FLASH_SECTOR_SIZE bytes. It can't be changed while a save is in progress.
+\* ============================================================================================================================================================= */
+UINT8 flash_set_scratch(UINT8 *Buffer, UINT32 BufferSize)
+{
+  if ((Buffer == NULL) || ((uintptr_t)Buffer % sizeof(UINT32)) || (BufferSize < FLASH_SECTOR_SIZE) || FlagFlashScratchBusy) return 1;
+
+  FlashScratch     = Buffer;
+  FlashScratchSize = BufferSize;
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_trace_add() */
+/* ============================================================================================================================================================= *\
+                                               Record an event in the binary trace ring (normally through FLASH_TRACE()).
+         NOTES: The ring is lock-free for a single producer and a single consumer. Only the code doing flash operations (one core) may record events,
+                while flash_trace_drain() is called from the idle loop or from the other core. Format and Function must remain valid (string literals).
+                Nothing is formatted here, so it may be called with interrupts disabled. When the ring is full, the event is dropped and counted.
+\* ============================================================================================================================================================= */
+void flash_trace_add(UINT16 Line, const CHAR *Function, const CHAR *Format, UINT32 Arg0, UINT32 Arg1, UINT32 Arg2)
+{
+#if (FLASH_TRACE_SIZE > 0)
+  struct flash_trace_event *Event;
+
+  UINT32 Head;
+
+
+  Head = FlashTraceHead;
+  if ((Head - FlashTraceTail) >= FLASH_TRACE_SIZE)
+  {
+    ++FlashStats.TraceDropped;
+    return;
+  }
+
+  Event           = &FlashTrace[Head & (FLASH_TRACE_SIZE - 1)];
+  Event->Format   = Format;
+  Event->Function = Function;
+  Event->Line     = Line;
+  Event->Arg[0]   = Arg0;
+  Event->Arg[1]   = Arg1;
+  Event->Arg[2]   = Arg2;
+
+  /* Event must be completely written before the consumer can see it. */
+  __dmb();
+  FlashTraceHead = Head + 1;
+#endif  // FLASH_TRACE_SIZE
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_trace_drain() */
+/* ============================================================================================================================================================= *\
+                                                      Format and send the events waiting in the binary trace ring.
+                         NOTE: At most MaxEvents events are sent (0 = all events waiting). Returns the number of events sent.
+\* ============================================================================================================================================================= */
+UINT16 flash_trace_drain(UINT16 MaxEvents)
+{
+#if (FLASH_TRACE_SIZE > 0)
+  struct flash_trace_event Event;
+
+  UINT16 Count;
+
+  UINT32 Tail;
+
+
+  for (Count = 0; (MaxEvents == 0) || (Count < MaxEvents); ++Count)
+  {
+    Tail = FlashTraceTail;
+    if (Tail == FlashTraceHead) break;
+
+    /* Copy the event before giving its slot back to the producer. */
+    __dmb();
+    Event = FlashTrace[Tail & (FLASH_TRACE_SIZE - 1)];
+    __dmb();
+    FlashTraceTail = Tail + 1;
+
+    uart_send(Event.Line, (const UCHAR *)Event.Function, (UCHAR *)Event.Format, Event.Arg[0], Event.Arg[1], Event.Arg[2]);
+  }
+
+  return Count;
+#else   // FLASH_TRACE_SIZE
+  return 0;
+#endif  // FLASH_TRACE_SIZE
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_verify_crc() */
+/* ============================================================================================================================================================= *\
+                      Validate the CRC16 of data of any size directly in flash memory, without copying it to RAM (the CRC16 is the last 16 bits of the data).
+                  NOTE: Data may span several sectors. It is checksummed in chunks straight from XIP. Returns 0 if the CRC16 is valid, 1 otherwise.
+\* ============================================================================================================================================================= */
+UINT8 flash_verify_crc(UINT32 DataOffset, UINT32 DataSize)
+{
+  struct crc16_context Context;
+
+  UINT8 *Data;
+
+
+  if ((DataSize < 2) || (DataOffset >= PICO_FLASH_SIZE_BYTES) || (DataSize > (PICO_FLASH_SIZE_BYTES - DataOffset))) return 1;
+
+  Data = (UINT8 *)(XIP_BASE + DataOffset);
+
+  util_crc16_init(&Context);
+  util_crc16_update(&Context, Data, DataSize - 2);
+
+  /* CRC16 is saved little-endian in the last two bytes (same as flash_extract_crc(), which is limited to 64KB). */
+  return (util_crc16_final(&Context) != (Data[DataSize - 2] | (Data[DataSize - 1] << 8)));
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_view_invalidate() */
+/* ============================================================================================================================================================= *\
+                                 Invalidate the validated views overlapping an area of flash that is being erased or programmed.
+\* ============================================================================================================================================================= */
+static void flash_view_invalidate(UINT32 DataOffset, UINT32 DataSize)
+{
+  UINT8 Loop1UInt8;
+
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < FLASH_VIEW_CACHE_SIZE; ++Loop1UInt8)
+  {
+    if ((FlashViewCache[Loop1UInt8].DataOffset < (DataOffset + DataSize)) && (DataOffset < (FlashViewCache[Loop1UInt8].DataOffset + FLASH_PAYLOAD_OFFSET + FlashViewCache[Loop1UInt8].DataSize)))
+      FlashViewCache[Loop1UInt8].FlagValid = FALSE;
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_wear_check() */
+/* ============================================================================================================================================================= *\
+                                  Save wear statistics to the journal if enough erases have been counted since last save.
+        NOTE: Called at the end of a write, so that the journal is never saved between the erase and the program of a sector, which would make longer
+              the window during which a power failure loses the data being written.
+\* ============================================================================================================================================================= */
+static void flash_wear_check(void)
+{
+#if FLASH_WEAR_JOURNAL
+  if (FlashWearPendingErases >= FLASH_WEAR_SAVE_INTERVAL) flash_wear_save();
+#endif  // FLASH_WEAR_JOURNAL
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_wear_get() */
+/* ============================================================================================================================================================= *\
+                                        Retrieve wear statistics (saved in the journal, plus what has been counted since).
+\* ============================================================================================================================================================= */
+void flash_wear_get(struct flash_wear *Wear)
+{
+  UINT8 Loop1UInt8;
+
+
+#if FLASH_WEAR_JOURNAL
+  flash_wear_load();
+#endif  // FLASH_WEAR_JOURNAL
+
+  *Wear = FlashWearSaved;
+  Wear->BytesRequested  += FlashWearPending.BytesRequested;
+  Wear->BytesProgrammed += FlashWearPending.BytesProgrammed;
+  Wear->WritesSkipped   += FlashWearPending.WritesSkipped;
+  Wear->WritesCoalesced += FlashWearPending.WritesCoalesced;
+  Wear->PoweredSeconds  += (UINT32)((time_us_64() - FlashWearTimeStamp) / 1000000);
+  for (Loop1UInt8 = 0; Loop1UInt8 < FLASH_WEAR_SECTORS; ++Loop1UInt8)
+    Wear->EraseCount[Loop1UInt8] += FlashWearPending.EraseCount[Loop1UInt8];
+
+  return;
+}
+
+
+
+
+
+#if FLASH_WEAR_JOURNAL
+/* $PAGE */
+/* $TITLE=flash_wear_load() */
+/* ============================================================================================================================================================= *\
+                                 Find the newest valid record of the wear journal, and the slot where the next one will be written.
+                  NOTE: Done once, on first use. Records that are not valid (torn by a reset, or never written) are ignored.
+\* ============================================================================================================================================================= */
+static void flash_wear_load(void)
+{
+  struct flash_wear_record *Record;
+
+  UINT8 Sector;
+  UINT8 Slot;
+
+
+  if (FlagFlashWearLoaded) return;
+  FlagFlashWearLoaded = FLAG_ON;
+
+  memset(&FlashWearSaved, 0, sizeof(FlashWearSaved));
+  FlashWearSequence = 0;
+  FlashWearSector   = 0;
+  FlashWearSlot     = 0;
+
+  for (Sector = 0; Sector < 2; ++Sector)
+  {
+    for (Slot = 0; Slot < (FLASH_SECTOR_SIZE / FLASH_WEAR_SLOT_SIZE); ++Slot)
+    {
+      Record = (struct flash_wear_record *)(XIP_BASE + FlashWearOffset[Sector] + (Slot * FLASH_WEAR_SLOT_SIZE));
+      if ((Record->Magic != FLASH_WEAR_MAGIC) || (Record->Sequence <= FlashWearSequence)) continue;
+      if (Record->Crc16 != util_crc16((UINT8 *)&Record->Sequence, sizeof(struct flash_wear_record) - offsetof(struct flash_wear_record, Sequence))) continue;
+
+      FlashWearSaved    = Record->Wear;
+      FlashWearSequence = Record->Sequence;
+      FlashWearSector   = Sector;
+      FlashWearSlot     = Slot + 1;
+    }
+  }
+
+  FLASH_TRACE("Wear journal loaded (sequence %lu)\r", FlashWearSequence);
+
+  return;
+}
+#endif  // FLASH_WEAR_JOURNAL
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_wear_save() */
+/* ============================================================================================================================================================= *\
+                                                                Save wear statistics to the journal.
+        NOTES: Called automatically at the end of a write, once FLASH_WEAR_SAVE_INTERVAL erases of the data sectors have been counted. May also be called
+               before a planned power-off, so that nothing counted is lost. Each save programs one slot. When a journal sector is full, the other one is
+               erased and used (the newest valid record remains in the full sector in the meantime, so that a reset during the erase loses nothing).
+               Returns 1 when FLASH_WEAR_JOURNAL is 0 (statistics are then only kept in RAM, since power-up).
+\* ============================================================================================================================================================= */
+UINT8 flash_wear_save(void)
+{
+#if FLASH_WEAR_JOURNAL
+  struct flash_wear_record Record;
+
+  UINT8 ReturnCode;
+
+  UINT32 SlotOffset;
+
+
+  flash_wear_load();
+
+  memset(&Record, 0, sizeof(Record));
+  Record.Magic    = FLASH_WEAR_MAGIC;
+  Record.Sequence = FlashWearSequence + 1;
+  flash_wear_get(&Record.Wear);
+  Record.Crc16    = util_crc16((UINT8 *)&Record.Sequence, sizeof(Record) - offsetof(struct flash_wear_record, Sequence));
+
+  /* Find next blank slot (a slot left programmed by a torn save is skipped). */
+  while (1)
+  {
+    if (FlashWearSlot >= (FLASH_SECTOR_SIZE / FLASH_WEAR_SLOT_SIZE))
+    {
+      FlashWearSector ^= 1;
+      FlashWearSlot    = 0;
+      if (flash_erase(FlashWearOffset[FlashWearSector])) return 1;
+    }
+
+    SlotOffset = FlashWearOffset[FlashWearSector] + (FlashWearSlot * FLASH_WEAR_SLOT_SIZE);
+    if (flash_is_blank(SlotOffset, FLASH_WEAR_SLOT_SIZE)) break;
+    ++FlashWearSlot;
+  }
+
+  /* Counters are now in the record. What is counted while the record is programmed (the journal's own page) goes to the next save. */
+  FlashWearTimeStamp    += (UINT64)(Record.Wear.PoweredSeconds - FlashWearSaved.PoweredSeconds) * 1000000;
+  FlashWearSaved         = Record.Wear;
+  FlashWearSequence      = Record.Sequence;
+  FlashWearPendingErases = 0;
+  memset(&FlashWearPending, 0, sizeof(FlashWearPending));
+
+  ReturnCode = flash_program(SlotOffset, (UINT8 *)&Record, sizeof(Record));
+  ++FlashWearSlot;
+
+  FLASH_TRACE("Wear journal saved to 0x%6.6X (sequence %lu)\r", SlotOffset, Record.Sequence);
+
+  return ReturnCode;
+#else   // FLASH_WEAR_JOURNAL
+  return 1;
+#endif  // FLASH_WEAR_JOURNAL
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_write_range() */
+/* ============================================================================================================================================================= *\
+                                 Write data of any size to any offset of Pico's flash memory, across as many sectors as required.
+            NOTES: Partial sectors at the beginning and at the end of the range are read, modified and written back (the rest of those sectors is preserved).
+                   Whole sectors in between are written directly from Data, without being copied to RAM first.
+                   A range beginning below FLASH_WRITE_RANGE_MIN (program code) is rejected.
+\* ============================================================================================================================================================= */
+UINT8 flash_write_range(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize)
+{
+  UINT8 ReturnCode;
+
+  UINT8 *FlashSector;
+
+  UINT32 ChunkSize;
+  UINT32 SectorIndex;
+  UINT32 SectorOffset;
+
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_WRITE, "Entering flash_write_range() - DataOffset: 0x%8.8X   DataSize: 0x%8.8X (%lu)\r", DataOffset, DataSize, DataSize);
+
+  if ((DataOffset < FLASH_WRITE_RANGE_MIN) || (DataOffset >= PICO_FLASH_SIZE_BYTES) || (DataSize > (PICO_FLASH_SIZE_BYTES - DataOffset)))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** Range 0x%8.8X + 0x%8.8X is outside of flash memory area 0x%8.8X to 0x%8.8X.\r", DataOffset, DataSize, FLASH_WRITE_RANGE_MIN, PICO_FLASH_SIZE_BYTES - 1);
+    return 1;
+  }
+
+  FlashWearPending.BytesRequested += DataSize;
+  ReturnCode = 0;
+
+  while ((DataSize > 0) && (ReturnCode == 0))
+  {
+    SectorOffset = DataOffset & ~(FLASH_SECTOR_SIZE - 1);
+    SectorIndex  = DataOffset - SectorOffset;
+    ChunkSize    = FLASH_SECTOR_SIZE - SectorIndex;
+    if (ChunkSize > DataSize) ChunkSize = DataSize;
+
+    if (ChunkSize == FLASH_SECTOR_SIZE)
+    {
+      /* Whole sector, write directly from caller's data. */
+      ReturnCode = flash_write_sector(SectorOffset, Data);
+    }
+    else
+    {
+      /* Partial sector, merge with current flash content. */
+      FlashSector = flash_scratch_acquire(FLASH_SECTOR_SIZE);
+      if (FlashSector == NULL) return 1;
+
+      memcpy(FlashSector, (UINT8 *)(XIP_BASE + SectorOffset), FLASH_SECTOR_SIZE);
+      memcpy(&FlashSector[SectorIndex], Data, ChunkSize);
+      ReturnCode = flash_write_sector(SectorOffset, FlashSector);
+      flash_scratch_release();
+    }
+
+    Data       += ChunkSize;
+    DataOffset += ChunkSize;
+    DataSize   -= ChunkSize;
+  }
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_WRITE, "Exiting flash_write_range()\r");
+
+  return ReturnCode;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=flash_write_sector() */
+/* ============================================================================================================================================================= *\
+                                      Write a full sector image to flash, erasing and programming only what is required.
+         NOTES: A changed page can be programmed over current flash content if it only turns 1 bits into 0 bits. If any bit must go from 0 to 1, the whole
+                sector must be erased first, and then only the pages that are not blank are programmed.
+                A sector with an asynchronous save queued or in progress is refused (see flash_async_pending()).
+\* ============================================================================================================================================================= */
+static UINT8 flash_write_sector(UINT32 SectorOffset, UINT8 *SectorData)
+{
+  UINT8 FlagErase;
+
+  UINT8 *FlashBaseAddress;
+
+  UINT16 ChangedPages;  // one bit per page of the sector.
+  UINT16 Loop1UInt16;
+
+
+  if (flash_async_pending(SectorOffset, FLASH_SECTOR_SIZE))
+  {
+    uart_send(__LINE__, __func__, "*** ERROR *** An asynchronous save of offset 0x%8.8X is queued or in progress.\r", SectorOffset);
+    return 1;
+  }
+
+  FlashBaseAddress = (UINT8 *)(XIP_BASE);
+
+  /* Compare each page with current flash content. */
+  FlagErase    = FALSE;
+  ChangedPages = 0;
+  for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
+  {
+    switch (flash_page_compare(&FlashBaseAddress[SectorOffset + (Loop1UInt16 * FLASH_PAGE_SIZE)], &SectorData[Loop1UInt16 * FLASH_PAGE_SIZE]))
+    {
+      case (FLASH_PAGE_ERASE):
+        FlagErase = TRUE;
+        /* Fall through - page must also be programmed. */
+      case (FLASH_PAGE_PROGRAM):
+        ChangedPages |= (1 << Loop1UInt16);
+      break;
+    }
+  }
+
+  if (FlagErase)
+  {
+    /* Erase flash before reprogramming. */
+    if (flash_erase(SectorOffset)) return 1;
+
+    /* After an erase, every page that is not blank must be programmed. */
+    ChangedPages = 0;
+    for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
+      if (flash_page_compare(&FlashBaseAddress[SectorOffset + (Loop1UInt16 * FLASH_PAGE_SIZE)], &SectorData[Loop1UInt16 * FLASH_PAGE_SIZE]) != FLASH_PAGE_IDENTICAL)
+        ChangedPages |= (1 << Loop1UInt16);
+  }
+
+  /* Save data to flash memory, only programming pages that need it. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE); ++Loop1UInt16)
+    if ((ChangedPages & (1 << Loop1UInt16)) && flash_program(SectorOffset + (Loop1UInt16 * FLASH_PAGE_SIZE), &SectorData[Loop1UInt16 * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE)) return 1;
+
+  /* Sector is complete, the wear journal may now be saved. */
+  flash_wear_check();
+
+  return 0;
+}
+
+
+
+
+
+#if (FLASH_XFER > 0)
+/* $PAGE */
+/* $TITLE=flash_xfer_export() */
+/* ============================================================================================================================================================= *\
+                                                               Export a flash range to the host tool.
+         NOTES: Data frames are numbered from 1 and read directly from flash. Up to FLASH_XFER_WINDOW frames are sent before waiting for an acknowledge.
+                The END frame follows the last data frame, with the CRC16 of the whole range, and is answered by the host with its own status.
+\* ============================================================================================================================================================= */
+static UINT8 flash_xfer_export(UINT32 DataOffset, UINT32 DataSize)
+{
+  struct crc16_context Context;
+
+  UINT8 Retry;
+  UINT8 Sequence;
+  UINT8 Status[3];
+  UINT8 Type;
+
+  UINT16 Length;
 
-  UINT16 Crc16;
+  UINT32 Base;      // first frame not acknowledged yet.
+  UINT32 Frame;
+  UINT32 FrameCount;
+  UINT32 Next;      // next frame to send.
 
 
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "Entering flash_extract()\r");
-    uart_send(__LINE__, __func__, "Data: 0x%8.8lX     DataSize: 0x%4.4X  (%u)\r\r\r", Data, DataSize, DataSize);
-  }
+  /* CRC16 of the whole range, sent in the END frame. */
+  util_crc16_init(&Context);
+  util_crc16_update(&Context, (UINT8 *)(XIP_BASE + DataOffset), DataSize);
+  Status[0] = util_crc16_final(&Context) & 0xFF;
+  Status[1] = util_crc16_final(&Context) >> 8;
+  Status[2] = 0;
 
-  Crc16 = *(UINT16 *)(Data + DataSize - 2);
+  FrameCount = (DataSize + FLASH_XFER_CHUNK_SIZE - 1) / FLASH_XFER_CHUNK_SIZE;
+  Base       = 1;
+  Next       = 1;
+  Retry      = 0;
 
-  /* Extract CRC16 from packet passed as an argument (last packet 16 bits). */
-  if (FlagLocalDebug)
+  /* Last frame (FrameCount + 1) is the END frame. */
+  while (Base <= (FrameCount + 1))
   {
-    uart_send(__LINE__, __func__, "RAM base address:         0x%X\r",       RAM_BASE_ADDRESS);
-    uart_send(__LINE__, __func__, "Data pointer:             0x%X\r",       Data);
-    uart_send(__LINE__, __func__, "Data size:                0x%X  (%u)\r", DataSize, DataSize);
-    uart_send(__LINE__, __func__, "Pointer to CRC16:         0x%X\r",       Data + DataSize - 2);
-    uart_send(__LINE__, __func__, "Value of CRC found:       0x%X\r\r\r",   Crc16);
+    for (; (Next <= (FrameCount + 1)) && (Next < (Base + FLASH_XFER_WINDOW)); ++Next)
+    {
+      if (Next <= FrameCount)
+      {
+        Length = ((DataSize - ((Next - 1) * FLASH_XFER_CHUNK_SIZE)) < FLASH_XFER_CHUNK_SIZE) ? (DataSize - ((Next - 1) * FLASH_XFER_CHUNK_SIZE)) : FLASH_XFER_CHUNK_SIZE;
+        flash_xfer_send(FLASH_XFER_DATA, Next, (UINT8 *)(XIP_BASE + DataOffset + ((Next - 1) * FLASH_XFER_CHUNK_SIZE)), Length);
+      }
+      else
+        flash_xfer_send(FLASH_XFER_END, Next, Status, sizeof(Status));
+    }
+
+    switch (flash_xfer_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 1000))
+    {
+      case (0):
+        /* Find the frame number from its 8-bit sequence number (always within the window). */
+        Frame = Base + (UINT8)(Sequence - (UINT8)Base);
+        if (Frame >= Next) break;  // old or unknown sequence number.
+        Retry = 0;
+
+        if ((Type == FLASH_XFER_END) && (Frame == (FrameCount + 1))) return ((Length < 3) || FlashXferPayload[2]);  // status from the host.
+        if (Type == FLASH_XFER_ACK) Base = Frame + 1;
+        if (Type == FLASH_XFER_NAK) Next = Base = Frame;
+      break;
+
+      case (1):
+        /* Time-out, send again all frames not acknowledged. */
+        if (++Retry > FLASH_XFER_RETRY_MAX) return 1;
+        Next = Base;
+      break;
+    }
   }
 
-  return Crc16;
+  return 1;
 }
 
 
@@ -225,68 +3396,111 @@ UINT16 flash_extract_crc(UINT8 *Data, UINT16 DataSize)
 
 
 /* $PAGE */
-/* $TITLE=flash_read_data() */
+/* $TITLE=flash_xfer_import() */
 /* ============================================================================================================================================================= *\
-                                                                   Read data from flash memory.
+                                                            Import an image from the host tool to a flash range.
+         NOTES: Data frames must be received in order, they are acknowledged one by one. An unexpected frame is answered with a NAK (once per gap).
+                Received data is rebuilt one sector at a time, so that each sector is erased at most once. When the END frame is received, the range is
+                checked against the CRC16 sent by the host and the status is sent back in an END frame (sent again if the host repeats its END frame).
 \* ============================================================================================================================================================= */
-UINT8 flash_read_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
+static UINT8 flash_xfer_import(UINT32 DataOffset, UINT32 DataSize)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
-
-  UINT8 *FlashBaseAddress;
-
-  UINT16 Crc16Computed;
-  UINT16 Crc16Extracted;
-  UINT16 Loop1UInt16;
-
+  struct crc16_context Context;
 
-  /* Check if an external terminal is connected to the Pico. */
-  if (!stdio_usb_connected()) FlagLocalDebug = FLAG_OFF;
+  UINT8 FlagNak;
+  UINT8 Result;
+  UINT8 Retry;
+  UINT8 Sequence;
+  UINT8 Status[3];
+  UINT8 Type;
 
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, " =======================================================================================================================\r");
-    uart_send(__LINE__, __func__, "      Entering flash_read_data()\r");
-    uart_send(__LINE__, __func__, "      Read current data from Pico's flash\r");
-    uart_send(__LINE__, __func__, "      XIP_BASE (flash base address):              0x%8.8X\r", XIP_BASE);
-    uart_send(__LINE__, __func__, "      Data offset in flash:                       0x%8.8X\r", DataOffset);
-    uart_send(__LINE__, __func__, "      Pointer to variable that will contain data: 0x%8.8X\r", Data);
-    uart_send(__LINE__, __func__, "      Size of data to be read from flash:             0x%4.4X  (%u)\r", DataSize, DataSize);
-    uart_send(__LINE__, __func__, "      Displaying data retrieved from flash memory...\r");
-    uart_send(__LINE__, __func__, " =======================================================================================================================\r");
-  }
+  UINT16 ChunkSize;
+  UINT16 Index;
+  UINT16 Length;
 
-  /* Read configuration data from Pico's flash memory (as an array of UINT8). */
-  FlashBaseAddress = (UINT8 *)(XIP_BASE);
-  for (Loop1UInt16 = 0; Loop1UInt16 < DataSize; ++Loop1UInt16)
-    Data[Loop1UInt16] = FlashBaseAddress[DataOffset + Loop1UInt16];
+  UINT32 Expected;    // next frame expected.
+  UINT32 Received;    // number of bytes received.
+  UINT32 SectorFill;  // number of bytes in FlashXferSector[].
 
-  Crc16Extracted = flash_extract_crc(Data, DataSize);  // CRC16 extracted from data retrieved from flash memory.
-  Crc16Computed  = util_crc16(Data, DataSize - 2);     // CRC16 computed from data retrieved from flash (excluding the CRC16 itself).
 
+  Expected   = 1;
+  Received   = 0;
+  SectorFill = 0;
+  Result     = 0;
+  FlagNak    = FLAG_OFF;
+  Retry      = 0;
 
-  /* Optionally display configuration data retrieved from flash memory and CRC16. */
-  if (FlagLocalDebug)
+  while (1)
   {
-    util_display_data(Data, DataSize);
-    uart_send(__LINE__, __func__, "CRC16 extracted from packet:   0x%4.4X\r",     Crc16Extracted);
-    uart_send(__LINE__, __func__, "CRC16 computed from data read: 0x%4.4X\r\r\r", Crc16Computed);
-  }
+    switch (flash_xfer_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 1000))
+    {
+      case (0):
+        Retry = 0;
 
+        if (Sequence != (UINT8)Expected)
+        {
+          /* Frame already received (acknowledge lost), or frames missing. */
+          if ((UINT8)(Expected - Sequence) <= FLASH_XFER_WINDOW)
+            flash_xfer_send(FLASH_XFER_ACK, Expected - 1, NULL, 0);
+          else if (!FlagNak)
+          {
+            flash_xfer_send(FLASH_XFER_NAK, Expected, NULL, 0);
+            FlagNak = FLAG_ON;
+          }
+          break;
+        }
 
-  if (Crc16Extracted != Crc16Computed)
-  {
-    /* CRC16 is not valid. */
-    if (stdio_usb_connected()) uart_send(__LINE__, __func__, "Flash configuration is invalid.\r");
+        if (Type == FLASH_XFER_DATA)
+        {
+          if (Length > (DataSize - Received)) Length = DataSize - Received;
+
+          /* Copy to the sector being rebuilt, and write it to flash when it is complete. */
+          for (Index = 0; Index < Length; Index += ChunkSize)
+          {
+            ChunkSize = FLASH_SECTOR_SIZE - ((DataOffset + Received) % FLASH_SECTOR_SIZE);  // room left up to the end of current sector.
+            if (ChunkSize > (Length - Index)) ChunkSize = Length - Index;
+            memcpy(&FlashXferSector[SectorFill], &FlashXferPayload[Index], ChunkSize);
+            SectorFill += ChunkSize;
+            Received   += ChunkSize;
+
+            if ((((DataOffset + Received) % FLASH_SECTOR_SIZE) == 0) || (Received == DataSize))
+            {
+              if (flash_write_range(DataOffset + Received - SectorFill, FlashXferSector, SectorFill)) Result = 1;
+              SectorFill = 0;
+            }
+          }
+
+          flash_xfer_send(FLASH_XFER_ACK, Sequence, NULL, 0);
+          ++Expected;
+          FlagNak = FLAG_OFF;
+          break;
+        }
 
-    return 1;
-  }
+        if (Type == FLASH_XFER_END)
+        {
+          /* Check what has been written against the CRC16 of the host. */
+          util_crc16_init(&Context);
+          util_crc16_update(&Context, (UINT8 *)(XIP_BASE + DataOffset), DataSize);
+          Status[0] = util_crc16_final(&Context) & 0xFF;
+          Status[1] = util_crc16_final(&Context) >> 8;
+          if ((Received != DataSize) || (Length < 2) || (Status[0] != FlashXferPayload[0]) || (Status[1] != FlashXferPayload[1])) Result = 1;
+          Status[2] = Result;
+
+          /* Answer the END frame until the host stops sending it. */
+          do
+          {
+            flash_xfer_send(FLASH_XFER_END, Sequence, Status, sizeof(Status));
+          } while (flash_xfer_receive(&Type, &Sequence, &Length, 2 * FLASH_XFER_TIMEOUT_MSEC * 1000) != 1);
+
+          return Result;
+        }
+      break;
 
-  return 0;  // CRC is valid.
+      case (1):
+        if (++Retry > FLASH_XFER_RETRY_MAX) return 1;
+      break;
+    }
+  }
 }
 
 
@@ -294,88 +3508,59 @@ UINT8 flash_read_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
 
 
 /* $PAGE */
-/* $TITLE=flash_save_data() */
+/* $TITLE=flash_xfer_receive() */
 /* ============================================================================================================================================================= *\
-                                                                    Save current data to flash.
+                                                                 Receive a frame from the host tool.
+         NOTES: Bytes received before a start of frame are ignored. Payload is returned in FlashXferPayload[].
+                Returns 0 if a valid frame has been received, 1 on time-out, 2 if the frame is not valid (bad length or CRC16).
 \* ============================================================================================================================================================= */
-UINT8 flash_save_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
+static UINT8 flash_xfer_receive(UINT8 *Type, UINT8 *Sequence, UINT16 *Length, UINT32 TimeoutUSec)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_ON;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
-
-  UINT16 Crc16;
+  struct crc16_context Context;
 
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "Entering flash_save_data()\r");
-    uart_send(__LINE__, __func__, "=========================================================================================================\r");
-    uart_send(__LINE__, __func__, "     FLASH_SECTOR_SIZE:                      %8u\r",        FLASH_SECTOR_SIZE);
-    uart_send(__LINE__, __func__, "     XIP_BASE (flash base address):        0x%8.8X\r",      XIP_BASE);
-    uart_send(__LINE__, __func__, "     Data offset:                          0x%8.8X\r",      DataOffset);
-    uart_send(__LINE__, __func__, "     Pointer to beginning of Data:         0x%8.8X\r",      Data);
-    uart_send(__LINE__, __func__, "     Data size:                            0x%8.8X (%u)\r", DataSize, DataSize);
-    uart_send(__LINE__, __func__, "     Data size for CRC16 calculation:      0x%8.8X (%u)\r", (((Data - RAM_BASE_ADDRESS + DataSize) - (Data - RAM_BASE_ADDRESS)) - 2), (((Data - RAM_BASE_ADDRESS + DataSize) - (Data - RAM_BASE_ADDRESS)) - 2));
-    uart_send(__LINE__, __func__, "     Pointer to CRC16:                     0x%8.8X\r",      Data + DataSize - 2);
-    uart_send(__LINE__, __func__, "=========================================================================================================\r");
-    
-    /* Display data being saved. */
-    uart_send(__LINE__, __func__, "     Current data before computing CRC16:\r");
-    util_display_data(Data, DataSize);
-
-    /* Wait for interrupts to clear in uart_send() above before disable them. */
-    wait_ms(500);
-  }
+  INT16 Character;
 
-  /* Validate size of data. */
-  if (DataSize > 0x1000)
-  {
-    printf("\r\r\r\r\r");
-    uart_send(__LINE__, __func__, "*** FATAL *** Data size to save to flash is too big (0x%4.4X)\r", DataSize);
-    uart_send(__LINE__, __func__, "Must be 0x1000 maximum. Fix this problem and rebuild the Firmware...\r\r");
+  UINT8 Header[4];
 
-    return 1;
-  }
+  UINT16 Crc16;
+  UINT16 Loop1UInt16;
 
 
-  if (DataOffset % FLASH_SECTOR_SIZE)
+  /* Wait for start of frame. */
+  do
   {
-    /* Data offset specified is not aligned on a flash sector boundary. */
-    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
-    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
-    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
-
-    return 1;
-  }
-
+    Character = getchar_timeout_us(TimeoutUSec);
+    if (Character == PICO_ERROR_TIMEOUT) return 1;
+  } while (Character != FLASH_XFER_SOF);
 
-  /* Compute CRC16 of packet to be saved. */
-  Crc16 = util_crc16(Data, DataSize - 2);
-  if (FlagLocalDebug)
+  /* Type, sequence number and payload length. Then payload and CRC16. Bytes of a frame are never far apart. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Header); ++Loop1UInt16)
   {
-    uart_send(__LINE__, __func__, "Pointer to data to be saved to flash: 0x%p\r", Data);
-    uart_send(__LINE__, __func__, "Data size:                                  %4u (0x%X)\r", DataSize,     DataSize);
-    uart_send(__LINE__, __func__, "Data size for CRC calculation:              %4u (0x%X)\r", DataSize - 2, DataSize - 2);
-    uart_send(__LINE__, __func__, "CRC computed:                             0x%4.4X\r", Crc16);
+    if ((Character = getchar_timeout_us(FLASH_XFER_TIMEOUT_MSEC * 1000)) == PICO_ERROR_TIMEOUT) return 1;
+    Header[Loop1UInt16] = Character;
   }
+  *Type     = Header[0];
+  *Sequence = Header[1];
+  *Length   = Header[2] | (Header[3] << 8);
+  if (*Length > FLASH_XFER_CHUNK_SIZE) return 2;
 
-  /* Insert CRC16 as last 16 bits of the packet. */
-  *(UINT16 *)(Data + DataSize - 2) = Crc16;
-
-  /* Save data to flash. */
-  flash_write(DataOffset, Data, DataSize);
-
-  /* Display flash data as saved. NOTE: Will crash the firmware if done inside a callback. */
-  if (FlagLocalDebug)
+  for (Loop1UInt16 = 0; Loop1UInt16 < (*Length + 2); ++Loop1UInt16)
   {
-    uart_send(__LINE__, __func__, "Display flash data as saved:\r");
-    util_display_data(Data, DataSize);
-    uart_send(__LINE__, __func__, "Exiting flash_save_data())\r");
+    if ((Character = getchar_timeout_us(FLASH_XFER_TIMEOUT_MSEC * 1000)) == PICO_ERROR_TIMEOUT) return 1;
+    if (Loop1UInt16 < *Length)
+      FlashXferPayload[Loop1UInt16] = Character;
+    else
+      Header[Loop1UInt16 - *Length] = Character;
   }
 
-  return 0;
+  util_crc16_init(&Context);
+  util_crc16_update(&Context, Type, 1);
+  util_crc16_update(&Context, Sequence, 1);
+  util_crc16_update(&Context, &Header[2], 2);
+  util_crc16_update(&Context, FlashXferPayload, *Length);
+  Crc16 = Header[0] | (Header[1] << 8);
+
+  return ((util_crc16_final(&Context) == Crc16) ? 0 : 2);
 }
 
 
@@ -383,111 +3568,98 @@ UINT8 flash_save_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize)
 
 
 /* $PAGE */
-/* $TITLE=flash_write() */
+/* $TITLE=flash_xfer_send() */
 /* ============================================================================================================================================================= *\
-                                                               Write data to Pico's flash memory.
+                                                                    Send a frame to the host tool.
+                        NOTE: Bytes are sent with putchar_raw(), so that no CR / LF translation is done by stdio on binary data.
 \* ============================================================================================================================================================= */
-UINT8 flash_write(UINT32 DataOffset, UINT8 *NewData, UINT16 NewDataSize)
+static void flash_xfer_send(UINT8 Type, UINT8 Sequence, const UINT8 *Payload, UINT16 Length)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
-
-  UCHAR String[32];
+  struct crc16_context Context;
 
-  UINT8 *FlashBaseAddress;
-  UINT8 *FlashSector;
+  UINT8 Header[5];
 
+  UINT16 Crc16;
   UINT16 Loop1UInt16;
 
-  UINT32 InterruptMask;
-
 
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "Entering flash_write()\r");
-    uart_send(__LINE__, __func__, "=========================================================================================================\r");
-    uart_send(__LINE__, __func__, "     FLASH_SECTOR_SIZE:                    0x%8.8X (%u)\r", FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
-    uart_send(__LINE__, __func__, "     XIP_BASE (flash base address):        0x%8.8X\r",      XIP_BASE);
-    uart_send(__LINE__, __func__, "     Data offset:                          0x%8.8X\r",      DataOffset);
-    uart_send(__LINE__, __func__, "     Pointer to beginning of data:         0x%8.8X\r",      NewData);
-    uart_send(__LINE__, __func__, "     Data size for CRC16 calculation:      0x%8.8X (%u)\r", (((NewData - RAM_BASE_ADDRESS + NewDataSize) - (NewData - RAM_BASE_ADDRESS)) - 2), (((NewData - RAM_BASE_ADDRESS + NewDataSize) - (NewData - RAM_BASE_ADDRESS)) - 2));
-    uart_send(__LINE__, __func__, "     Pointer to CRC16:                     0x%8.8X\r",      NewData + NewDataSize - 2);
-    uart_send(__LINE__, __func__, "     Data size:                            0x%8.8X (%u)\r", NewDataSize, NewDataSize);
-    uart_send(__LINE__, __func__, "=========================================================================================================\r");
-    uart_send(__LINE__, __func__, "     Displaying data to be written to flash.\r");
-    util_display_data(NewData, NewDataSize);
+  Header[0] = FLASH_XFER_SOF;
+  Header[1] = Type;
+  Header[2] = Sequence;
+  Header[3] = Length & 0xFF;
+  Header[4] = Length >> 8;
 
-    /* Wait for interrupts to clear from uart_send() above before disabling them. */
-    wait_ms(100);
-  }
+  util_crc16_init(&Context);
+  util_crc16_update(&Context, &Header[1], sizeof(Header) - 1);
+  util_crc16_update(&Context, Payload, Length);
+  Crc16 = util_crc16_final(&Context);
 
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Header); ++Loop1UInt16) putchar_raw(Header[Loop1UInt16]);
+  for (Loop1UInt16 = 0; Loop1UInt16 < Length; ++Loop1UInt16) putchar_raw(Payload[Loop1UInt16]);
+  putchar_raw(Crc16 & 0xFF);
+  putchar_raw(Crc16 >> 8);
+  stdio_flush();
 
-  if (DataOffset % FLASH_SECTOR_SIZE)
-  {
-    /* Data offset specified is not aligned on a flash sector boundary. */
-    uart_send(__LINE__, __func__, "*** FATAL *** The data offset specified (0x%8.8X) is not aligned on a flash sector boundary (multiple of 0x1000)\r", DataOffset);
-    uart_send(__LINE__, __func__, "Phased out by 0x%X (%u) bytes.\r", DataOffset % FLASH_SECTOR_SIZE, DataOffset % FLASH_SECTOR_SIZE);
-    uart_send(__LINE__, __func__, "Three last hex digits of DataOffset must be 0x000.\r");
+  return;
+}
+#endif  // FLASH_XFER
 
-    return 1;
-  }
 
 
-  /* NOTE: A wear leveling algorithm has not been implemented since the flash usage for saving configuration data will usually not require it.
-     However, flash write should not be used for intensive data logging without adding a wear leveling algorithm. */
-  FlashBaseAddress = (UINT8 *)(XIP_BASE);
-  FlashSector      = malloc(FLASH_SECTOR_SIZE);
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "FlashSector address: 0x%p\r", FlashSector);
-    uart_send(__LINE__, __func__, "malloc() returned 0x%p for FlashSector\r", FlashSector);
-    sleep_ms(100);    ///
-  }
 
 
-  /* Take a copy of current flash sector content. */
-  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_SECTOR_SIZE; ++Loop1UInt16) FlashSector[Loop1UInt16] = FlashBaseAddress[DataOffset + Loop1UInt16];
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "FlashSector: 0x%p   FlashBaseAddress: 0x%p   Data offset: 0x%6.6X\r", FlashSector, FlashBaseAddress, DataOffset);
-    uart_send(__LINE__, __func__, "Displaying original data retrieved from flash\r");
-    util_display_data(FlashSector, FLASH_SECTOR_SIZE);
-  }
+/* $PAGE */
+/* $TITLE=flash_xfer_serve() */
+/* ============================================================================================================================================================= *\
+                              Wait for a binary transfer request from the host tool and perform it (export or import of a flash range).
+         NOTES: The host tool (Pico-Flash-Tool.c) must be started within TimeoutMSec. No text must be sent to stdio while the transfer is in progress.
+                The request is acknowledged (sequence number 0) before the transfer begins, or answered with an END frame giving an error status.
+                Returns 0 if the transfer has been completed successfully.
+\* ============================================================================================================================================================= */
+UINT8 flash_xfer_serve(UINT32 TimeoutMSec)
+{
+#if (FLASH_XFER > 0)
+  UINT8 Sequence;
+  UINT8 Status[3];
+  UINT8 Type;
 
+  UINT16 Length;
 
-  /* Overwrite the sector area that we want to save. */
-  memcpy(FlashSector, NewData, NewDataSize);
-  if (FlagLocalDebug)
-  {
-    uart_send(__LINE__, __func__, "Display data to be written back to flash at offset %X:\r", DataOffset);
-    util_display_data(FlashSector, FLASH_SECTOR_SIZE);
+  UINT32 DataOffset;
+  UINT32 DataSize;
+  UINT64 TimeStamp;
 
-    /* Wait for interrupts to clear from uart_send() above before disable them. */
-    wait_ms(1000);
-  }
 
+  TimeStamp = time_us_64();
+  do
+  {
+    if (time_us_64() > (TimeStamp + ((UINT64)TimeoutMSec * 1000))) return 1;
+  } while ((flash_xfer_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 1000) != 0) || ((Type != FLASH_XFER_READ) && (Type != FLASH_XFER_WRITE)) ||
+           (Sequence != 0) || (Length != 8));
 
-  /* Erase flash before reprogramming. */
-  if (flash_erase(DataOffset)) return 1;  // return in case of error while trying to erase.
+  DataOffset = FlashXferPayload[0] | (FlashXferPayload[1] << 8) | (FlashXferPayload[2] << 16) | ((UINT32)FlashXferPayload[3] << 24);
+  DataSize   = FlashXferPayload[4] | (FlashXferPayload[5] << 8) | (FlashXferPayload[6] << 16) | ((UINT32)FlashXferPayload[7] << 24);
 
-  /* Keep track of interrupt mask and disable interrupts during flash writing. */
-  InterruptMask = save_and_disable_interrupts();
+  if ((DataSize == 0) || (DataOffset >= PICO_FLASH_SIZE_BYTES) || (DataSize > (PICO_FLASH_SIZE_BYTES - DataOffset)))
+  {
+    Status[0] = 0;
+    Status[1] = 0;
+    Status[2] = 1;
+    flash_xfer_send(FLASH_XFER_END, 0, Status, sizeof(Status));
 
-  /* Save data to flash memory. */
-  flash_range_program(DataOffset, FlashSector, FLASH_SECTOR_SIZE);
+    return 1;
+  }
 
-  /* Restore original interrupt mask when done. */
-  restore_interrupts(InterruptMask);
+  flash_xfer_send(FLASH_XFER_ACK, 0, NULL, 0);
 
-  /* Release memory when done. */
-  free(FlashSector);
+  if (Type == FLASH_XFER_READ) return flash_xfer_export(DataOffset, DataSize);
 
-  if (FlagLocalDebug) uart_send(__LINE__, __func__, "Exiting flash_write()\r");
+  return flash_xfer_import(DataOffset, DataSize);
+#else   // FLASH_XFER
+  uart_send(__LINE__, __func__, "*** ERROR *** Binary transfer is not built in (FLASH_XFER is 0).\r");
 
-  return 0;
+  return 1;
+#endif  // FLASH_XFER
 }
 
 
@@ -499,7 +3671,7 @@ UINT8 flash_write(UINT32 DataOffset, UINT8 *NewData, UINT16 NewDataSize)
 /* ============================================================================================================================================================= *\
                                                                             Read a string from stdin.
 \* ============================================================================================================================================================= */
-void static input_string(UCHAR *String)
+static void input_string(UCHAR *String)
 {
   INT8 DataInput;
 
@@ -583,28 +3755,131 @@ void static input_string(UCHAR *String)
 \* ============================================================================================================================================================= */
 UINT16 util_crc16(UINT8 *Data, UINT16 DataSize)
 {
-#ifdef RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // must remain OFF at all times.
-#else   // RELEASE_VERSION
-  UINT8 FlagLocalDebug = FLAG_OFF;  // may be modified for debug purposes.
-#endif  // RELEASE_VERSION
+  struct crc16_context Context;
+
+
+  /* Validate data pointer. */
+  if (Data == NULL) return 0;
+
+#if FLASH_DEBUG_ENABLED(FLASH_DEBUG_VERBOSE, FLASH_DEBUG_CRC)
+  uart_send(__LINE__, __func__, "Calculating CRC16 of this packet (Data pointer: 0x%8.8X   size: %u):\r", Data, DataSize);
+  util_display_data(Data, DataSize);
+#endif  // FLASH_DEBUG_ENABLED
+
+  util_crc16_init(&Context);
+  util_crc16_update(&Context, Data, DataSize);
+
+  FLASH_DEBUG(FLASH_DEBUG_INFO, FLASH_DEBUG_CRC, "CRC16 computed: 0x%4.4X\r\r\r", Context.CrcValue);
+
+  return util_crc16_final(&Context);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=util_crc16_final() */
+/* ============================================================================================================================================================= *\
+                                                    Return the CRC16 of all data processed with a CRC16 context.
+\* ============================================================================================================================================================= */
+UINT16 util_crc16_final(struct crc16_context *Context)
+{
+  return (Context->CrcValue & 0xFFFF);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=util_crc16_init() */
+/* ============================================================================================================================================================= *\
+                                                        Initialize a context to compute a CRC16 in chunks.
+\* ============================================================================================================================================================= */
+void util_crc16_init(struct crc16_context *Context)
+{
+  Context->CrcValue = 0;
+  Context->DataSize = 0;
+
+  return;
+}
+
+
 
+
+
+/* $PAGE */
+/* $TITLE=util_crc16_table_init() */
+/* ============================================================================================================================================================= *\
+                                       Generate the lookup tables used by the table-driven CRC16 engines for the CRC16_POLYNOM selected.
+\* ============================================================================================================================================================= */
+static void util_crc16_table_init(void)
+{
+#if (CRC16_ENGINE != CRC16_ENGINE_BITWISE)
   UINT8 Loop1UInt8;
 
   UINT16 CrcValue;
+  UINT16 Loop1UInt16;
 
 
-  /* Validate data pointer. */
-  if (Data == NULL) return 0;
+  /* First table is the CRC16 of each single byte value, computed the bit-serial way. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < 256; ++Loop1UInt16)
+  {
+    CrcValue = Loop1UInt16 << 8;
+
+    for (Loop1UInt8 = 0; Loop1UInt8 < 8; ++Loop1UInt8)
+    {
+      if (CrcValue & 0x8000)
+        CrcValue = CrcValue << 1 ^ CRC16_POLYNOM;
+      else
+        CrcValue = CrcValue << 1;
+    }
+
+    Crc16Table[0][Loop1UInt16] = CrcValue;
+  }
 
-  if (FlagLocalDebug)
+  /* Each following table pushes the previous one through one more zero byte (used only by slice-by-4 / slice-by-8 engines). */
+  for (Loop1UInt8 = 1; Loop1UInt8 < CRC16_ENGINE; ++Loop1UInt8)
   {
-    uart_send(__LINE__, __func__, "Calculating CRC16 of this packet (Data pointer: 0x%8.8X   size: %u):\r", Data, DataSize);
-    util_display_data(Data, DataSize);
+    for (Loop1UInt16 = 0; Loop1UInt16 < 256; ++Loop1UInt16)
+    {
+      CrcValue = Crc16Table[Loop1UInt8 - 1][Loop1UInt16];
+      Crc16Table[Loop1UInt8][Loop1UInt16] = (CrcValue << 8) ^ Crc16Table[0][CrcValue >> 8];
+    }
   }
 
-  CrcValue = 0;
+  /* Tables must be complete in memory before the other core may see the flag. If both cores build them at the same time, they write the same values. */
+  __dmb();
+  FlagCrc16TableReady = FLAG_ON;
+#endif  // CRC16_ENGINE
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=util_crc16_update() */
+/* ============================================================================================================================================================= *\
+                                                    Add a chunk of data to the CRC16 computed with a CRC16 context.
+              NOTE: Chunks may be of any size and anywhere in memory (RAM or directly in flash through XIP). The result doesn't depend on how data is split.
+\* ============================================================================================================================================================= */
+void util_crc16_update(struct crc16_context *Context, const UINT8 *Data, UINT32 DataSize)
+{
+#if (CRC16_ENGINE == CRC16_ENGINE_BITWISE)
+  UINT8 Loop1UInt8;
+#endif  // CRC16_ENGINE
+
+  UINT16 CrcValue;
+
 
+  CrcValue           = Context->CrcValue;
+  Context->DataSize += DataSize;
+
+#if (CRC16_ENGINE == CRC16_ENGINE_BITWISE)
   while (DataSize-- > 0)
   {
     CrcValue = CrcValue ^ (UINT8)*Data++ << 8;
@@ -617,11 +3892,37 @@ UINT16 util_crc16(UINT8 *Data, UINT16 DataSize)
         CrcValue = CrcValue << 1;
     }
   }
+#else   // CRC16_ENGINE
+  /* Generate lookup tables on first use. Once the flag has been seen, the barrier makes sure tables are not read before it (from the other core). */
+  if (!FlagCrc16TableReady) util_crc16_table_init();
+  __dmb();
+
+#if (CRC16_ENGINE >= CRC16_ENGINE_SLICE4)
+  /* Process CRC16_ENGINE bytes at a time: the two bytes merged with current CRC are pushed through the highest tables, all others through the lower ones. */
+  while (DataSize >= CRC16_ENGINE)
+  {
+    CrcValue ^= (UINT16)((Data[0] << 8) | Data[1]);
+
+#if (CRC16_ENGINE == CRC16_ENGINE_SLICE8)
+    CrcValue = Crc16Table[7][CrcValue >> 8] ^ Crc16Table[6][CrcValue & 0xFF] ^ Crc16Table[5][Data[2]] ^ Crc16Table[4][Data[3]] ^
+               Crc16Table[3][Data[4]]       ^ Crc16Table[2][Data[5]]         ^ Crc16Table[1][Data[6]] ^ Crc16Table[0][Data[7]];
+#else   // CRC16_ENGINE
+    CrcValue = Crc16Table[3][CrcValue >> 8] ^ Crc16Table[2][CrcValue & 0xFF] ^ Crc16Table[1][Data[2]] ^ Crc16Table[0][Data[3]];
+#endif  // CRC16_ENGINE
+
+    Data     += CRC16_ENGINE;
+    DataSize -= CRC16_ENGINE;
+  }
+#endif  // CRC16_ENGINE
+
+  /* Process remaining bytes one at a time. */
+  while (DataSize-- > 0)
+    CrcValue = (CrcValue << 8) ^ Crc16Table[0][(CrcValue >> 8) ^ *Data++];
+#endif  // CRC16_ENGINE
 
-  if (FlagLocalDebug)
-    uart_send(__LINE__, __func__, "CRC16 computed: 0x%4.4X\r\r\r", CrcValue & 0xFFFF);
+  Context->CrcValue = CrcValue;
 
-  return (CrcValue & 0xFFFF);
+  return;
 }
 
 
@@ -635,10 +3936,10 @@ UINT16 util_crc16(UINT8 *Data, UINT16 DataSize)
 \* ============================================================================================================================================================= */
 void util_display_data(UCHAR *Data, UINT32 DataSize)
 {
-  UCHAR String[256];
+  UCHAR String[128];
+  UCHAR *Line;
 
   UINT32 Loop1UInt32;
-  UINT32 Loop2UInt32;
 
 
   uart_send(__LINE__, __func__, " ===========================================================================================\r");
@@ -651,42 +3952,108 @@ void util_display_data(UCHAR *Data, UINT32 DataSize)
 
   for (Loop1UInt32 = 0; Loop1UInt32 < DataSize; Loop1UInt32 += 16)
   {
-    /* First, display memory address, offset and hex part. */
-    sprintf(String, "[0x%8.8X] [0x%4.4X] - ", &Data[Loop1UInt32], Loop1UInt32);
+    /* Memory address and offset, then hex part and ASCII part. Lines are sent in batches, with no fixed delay. */
+    Line    = String;
+    *Line++ = '[';
+    *Line++ = '0';
+    *Line++ = 'x';
+    Line    = util_hex(Line, (UINT32)(uintptr_t)&Data[Loop1UInt32], 8);
+    *Line++ = ']';
+    *Line++ = ' ';
+    *Line++ = '[';
+    *Line++ = '0';
+    *Line++ = 'x';
+    Line    = util_hex(Line, Loop1UInt32, 4);
+    *Line++ = ']';
+    *Line++ = ' ';
+    *Line++ = '-';
+    *Line++ = ' ';
+    Line   += util_dump_line(Line, &Data[Loop1UInt32], ((DataSize - Loop1UInt32) < 16) ? (DataSize - Loop1UInt32) : 16);
+
+    util_dump_write(String, Line - String, FALSE);
+  }
+  util_dump_write(NULL, 0, TRUE);
+
+  uart_send(__LINE__, __func__, "===========================================================================================\r\r");
+
+  return;
+}
+
+
+
+
 
-    for (Loop2UInt32 = 0; Loop2UInt32 < 16; ++Loop2UInt32)
+/* $PAGE */
+/* $TITLE=util_dump_line() */
+/* ============================================================================================================================================================= *\
+                                                  Format one line of a hex dump (hex bytes, then printable characters).
+             NOTES: Up to 16 bytes per line. Missing bytes of a short line are padded with spaces in the hex part. Returns the length of the line.
+                    Each byte is converted with a table lookup, so that a whole line is built in a single pass (no sprintf() nor strlen()).
+\* ============================================================================================================================================================= */
+static UINT16 util_dump_line(UCHAR *Line, const UINT8 *Data, UINT32 DataSize)
+{
+  UCHAR *Start;
+
+  UINT8 Loop1UInt8;
+
+
+  Start = Line;
+
+  for (Loop1UInt8 = 0; Loop1UInt8 < 16; ++Loop1UInt8)
+  {
+    if (Loop1UInt8 < DataSize)
     {
-      if ((Loop1UInt32 + Loop2UInt32) >= DataSize)
-        strcat(String, "   ");
-      else
-        sprintf(&String[strlen(String)], "%2.2X ", Data[Loop1UInt32 + Loop2UInt32]);
+      *Line++ = UtilHexDigit[Data[Loop1UInt8] >> 4];
+      *Line++ = UtilHexDigit[Data[Loop1UInt8] & 0x0F];
+    }
+    else
+    {
+      *Line++ = ' ';
+      *Line++ = ' ';
     }
+    *Line++ = ' ';
+  }
 
+  /* Separator, then character if it is displayable ASCII (or <.> if it is not). */
+  *Line++ = '|';
+  *Line++ = ' ';
+  for (Loop1UInt8 = 0; Loop1UInt8 < DataSize; ++Loop1UInt8)
+    *Line++ = ((Data[Loop1UInt8] >= 0x20) && (Data[Loop1UInt8] <= 0x7E)) ? Data[Loop1UInt8] : '.';
+  *Line++ = '\r';
 
-    uart_send(__LINE__, __func__, String);
+  return (Line - Start);
+}
 
 
-    /* Add separator. */
-    sprintf(String, "| ");
 
 
-    /* Then, display ASCII character if it is displayable ASCII (or <.> if it is not). */
-    for (Loop2UInt32 = 0; Loop2UInt32 < 16; ++Loop2UInt32)
-    {
-      if ((Loop1UInt32 + Loop2UInt32) >= DataSize)
-        break; // do not count up to 16 if we already reached end of data to display.
 
-      /* Display character if it is displayable ASCII. */
-      if ((Data[Loop1UInt32 + Loop2UInt32] >= 0x20) && (Data[Loop1UInt32 + Loop2UInt32] <= 0x7E) && (Data[Loop1UInt32 + Loop2UInt32] != 0x25))
-        sprintf(&String[strlen(String)], "%c", Data[Loop1UInt32 + Loop2UInt32]);
-      else
-        strcat(String, ".");
-    }
-    strcat(String, "\r");
-    uart_send(__LINE__, __func__, String);
-    sleep_ms(10);  // prevent communication override.
+/* $PAGE */
+/* $TITLE=util_dump_write() */
+/* ============================================================================================================================================================= *\
+                                Add a string to the batch of hex dump lines, and send the batch when full or when requested.
+               NOTE: stdio_flush() waits until the batch has been accepted by the UART / USB CDC driver, so output is paced by the link itself
+                     instead of a fixed delay, and nothing is lost when the terminal reads slower than the dump is produced.
+\* ============================================================================================================================================================= */
+static void util_dump_write(const UCHAR *String, UINT16 Size, UINT8 FlagFlush)
+{
+  /* Send current batch first if the string doesn't fit. */
+  if ((UtilDumpSize + Size) > UTIL_DUMP_BUFFER_SIZE)
+  {
+    fwrite(UtilDumpBuffer, 1, UtilDumpSize, stdout);
+    stdio_flush();
+    UtilDumpSize = 0;
+  }
+
+  memcpy(&UtilDumpBuffer[UtilDumpSize], String, Size);
+  UtilDumpSize += Size;
+
+  if (FlagFlush && UtilDumpSize)
+  {
+    fwrite(UtilDumpBuffer, 1, UtilDumpSize, stdout);
+    stdio_flush();
+    UtilDumpSize = 0;
   }
-  uart_send(__LINE__, __func__, "===========================================================================================\r\r");
 
   return;
 }
@@ -696,18 +4063,17 @@ void util_display_data(UCHAR *Data, UINT32 DataSize)
 
 
 /* $PAGE */
-/* $TITLE=wait_ms() */
+/* $TITLE=util_hex() */
 /* ============================================================================================================================================================= *\
-                                                                  Pause for specified number of msec.
-                       NOTE: This function does not use a sleep_xx(), so it can be used inside a hardware or software interrupt (callback).
+                                             Format a value as fixed-width hexadecimal digits. Returns a pointer after the last digit.
 \* ============================================================================================================================================================= */
-void static wait_ms(UINT16 WaitMSec)
+static UCHAR *util_hex(UCHAR *String, UINT32 Value, UINT8 Digits)
 {
-  UINT64 TimeStamp;
+  UINT8 Loop1UInt8;
 
 
-  TimeStamp = time_us_64();
-  while (time_us_64() < (TimeStamp + (WaitMSec * 1000ll)));
+  for (Loop1UInt8 = Digits; Loop1UInt8 > 0; --Loop1UInt8)
+    *String++ = UtilHexDigit[(Value >> ((Loop1UInt8 - 1) * 4)) & 0x0F];
 
-  return;
+  return String;
 }
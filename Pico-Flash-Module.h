@@ -25,10 +25,16 @@
                                                                         Include files.
 \* ============================================================================================================================================================= */
 #include "baseline.h"
+#ifdef PICO_FLASH_HOST
+#include "Pico-Flash-Host.h"  // Linux build, flash emulated in a file.
+#else   // PICO_FLASH_HOST
 #include "hardware/flash.h"
 /// #include "hardware/irq.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
+#endif  // PICO_FLASH_HOST
+#include "Pico-Flash-Xfer.h"  // binary transfer protocol, shared with Pico-Flash-Tool.c.
+#include "stddef.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
@@ -51,9 +57,81 @@
 #endif  // RELEASE_VERSION
 
 
-/* Polynom used for CRC16 calculation. Different authorities use different polynoms:
-   0x8005, 0x1021, 0x1DCF, 0x755B, 0x5935, 0x3D65, 0x8BB7, 0x0589, 0xC867, 0xA02B, 0x2F15, 0x6815, 0xC599, 0x202D, 0x0805, 0x1CF5 */
-#define CRC16_POLYNOM           0x1021
+/* Debug levels. A debug message is built in only if its level is not higher than FLASH_DEBUG_LEVEL and its module is part of FLASH_DEBUG_MASK.
+   Otherwise, its format string, arguments and work buffers are removed at compile time. In a release version, no debug message is ever built in. */
+#define FLASH_DEBUG_OFF         0  // no debug message.
+#define FLASH_DEBUG_INFO        1  // entry / exit of functions and short status messages.
+#define FLASH_DEBUG_VERBOSE     2  // parameter blocks and data dumps.
+
+/* Debug modules (bit mask). */
+#define FLASH_DEBUG_AB          0x0001  // flash_ab_read(), flash_ab_save().
+#define FLASH_DEBUG_ERASE       0x0002  // flash_erase().
+#define FLASH_DEBUG_READ        0x0004  // flash_display(), flash_extract_crc(), flash_read_data().
+#define FLASH_DEBUG_SAVE        0x0008  // flash_save_data().
+#define FLASH_DEBUG_WRITE       0x0010  // flash_write(), flash_write_range().
+#define FLASH_DEBUG_LOG         0x0020  // log-structured store.
+#define FLASH_DEBUG_CRC         0x0040  // util_crc16().
+#define FLASH_DEBUG_ALL         0xFFFF
+
+#ifdef RELEASE_VERSION
+#undef  FLASH_DEBUG_LEVEL
+#define FLASH_DEBUG_LEVEL       FLASH_DEBUG_OFF  // must remain OFF at all times.
+#endif  // RELEASE_VERSION
+#ifndef FLASH_DEBUG_LEVEL
+#define FLASH_DEBUG_LEVEL       FLASH_DEBUG_VERBOSE  // may be modified for debug purposes.
+#endif  // FLASH_DEBUG_LEVEL
+#ifndef FLASH_DEBUG_MASK
+#define FLASH_DEBUG_MASK        FLASH_DEBUG_SAVE     // may be modified for debug purposes.
+#endif  // FLASH_DEBUG_MASK
+
+/* May be used with #if around a group of debug statements. */
+#define FLASH_DEBUG_ENABLED(Level, Module)  (((Level) <= FLASH_DEBUG_LEVEL) && ((Module) & FLASH_DEBUG_MASK))
+
+/* Send one debug message through uart_send(). */
+#if FLASH_DEBUG_LEVEL == FLASH_DEBUG_OFF
+#define FLASH_DEBUG(Level, Module, ...)  do {} while (0)
+#else   // FLASH_DEBUG_LEVEL
+#define FLASH_DEBUG(Level, Module, ...)  do { if (FLASH_DEBUG_ENABLED(Level, Module)) uart_send(__LINE__, __func__, __VA_ARGS__); } while (0)
+#endif  // FLASH_DEBUG_LEVEL
+
+
+/* Binary trace ring. FLASH_TRACE() only records the format string, line number, function and up to 3 arguments of an event (no formatting, no output),
+   so it may be left around flash operations, even with interrupts disabled. Events are formatted and sent later by flash_trace_drain().
+   FLASH_TRACE_SIZE must be a power of 2 (0 = no trace ring, FLASH_TRACE() is compiled out). */
+#ifndef FLASH_TRACE_SIZE
+#define FLASH_TRACE_SIZE        64
+#endif  // FLASH_TRACE_SIZE
+#define FLASH_TRACE_ARGS        3   // maximum number of arguments of a trace event (each argument is saved as an UINT32).
+
+#if (FLASH_TRACE_SIZE > 0)
+#define FLASH_TRACE(...)        FLASH_TRACE_EVENT(__VA_ARGS__, 0, 0, 0)
+#define FLASH_TRACE_EVENT(Format, Arg0, Arg1, Arg2, ...)  flash_trace_add(__LINE__, __func__, Format, (UINT32)(Arg0), (UINT32)(Arg1), (UINT32)(Arg2))
+#else   // FLASH_TRACE_SIZE
+#define FLASH_TRACE(...)        do {} while (0)
+#endif  // FLASH_TRACE_SIZE
+
+
+/* Define to park the other core in RAM (multicore lockout) during each flash erase and each page program. The other core must have called
+   multicore_lockout_victim_init() for this to take effect. While it is parked, the other core doesn't execute from flash (XIP), which is disabled during those operations. */
+/// #define FLASH_MULTICORE_LOCKOUT
+
+
+/* Polynom used for CRC16 calculation: CRC16_POLYNOM, defined in Pico-Flash-Xfer.h (0x1021 by default). */
+
+/* Engine used by util_crc16() to compute the CRC16. Table-driven engines trade RAM for speed. Their tables are generated in RAM on first use (from either core) for
+   the CRC16_POLYNOM selected above, so they are always consistent with it.
+   CRC16_ENGINE_BITWISE:    0 bytes of RAM - original bit-serial algorithm (8 shift / XOR per byte of data).
+   CRC16_ENGINE_TABLE:    512 bytes of RAM - one table lookup per byte of data.
+   CRC16_ENGINE_SLICE4:  2048 bytes of RAM - four table lookups for every 4 bytes of data.
+   CRC16_ENGINE_SLICE8:  4096 bytes of RAM - eight table lookups for every 8 bytes of data. */
+#define CRC16_ENGINE_BITWISE    0
+#define CRC16_ENGINE_TABLE      1
+#define CRC16_ENGINE_SLICE4     4
+#define CRC16_ENGINE_SLICE8     8
+
+#ifndef CRC16_ENGINE
+#define CRC16_ENGINE            CRC16_ENGINE_TABLE
+#endif  // CRC16_ENGINE
 
 /* Offsets in Pico's 2 MB flash where to save configuration data. Starting at 2 MB flash highest limit minus 4096 bytes (0x1000) - At the very end of flash.
    More offsets are added in case we want to save more than 0x1000 (4096) bytes. Data saved must not override program's bytes. */
@@ -68,9 +146,332 @@
 #define FLASH_DATA_OFFSET9  0x1F7000  // one sector before FLASH_DATA_OFFSET8
 #define FLASH_DATA_OFFSET10 0x1F6000  // one sector before FLASH_DATA_OFFSET9
 
+/* Sectors below FLASH_DATA_OFFSET10 used by optional parts of Pico-Flash-Module, only when they are enabled:
+   0x1F5000 and 0x1F4000:  wear journal (FLASH_WEAR_OFFSET1 and FLASH_WEAR_OFFSET2), when FLASH_WEAR_JOURNAL is 1.
+   0x1F0000 up to 0x1F3FFF: area overwritten by the benchmark of Pico-Flash-Example (FLASH_BENCH_OFFSET), when FLASH_BENCH_SECTORS is not 0. */
+
+/* Header saved by flash_save_data() in front of data (struct flash_payload_header), so that a blank sector, a sector written by something else or data
+   saved with another size are rejected by flash_read_data() after reading only a few bytes. Data then begins at FLASH_PAYLOAD_OFFSET in the sector.
+   Disabled (0) by default to keep the original layout, where data begins at the very beginning of the sector.
+   NOTES: When enabled, the maximum size of data saved by flash_save_data() goes from 0x1000 down to 0xFF8 (4088) bytes, and data saved with the original
+          layout (by a previous firmware) can't be read anymore: it must be saved again after the update. */
+#ifndef FLASH_PAYLOAD_HEADER
+#define FLASH_PAYLOAD_HEADER    0
+#endif  // FLASH_PAYLOAD_HEADER
+#define FLASH_PAYLOAD_MAGIC     0x4446  // "FD" - identifies data saved by flash_save_data().
+#define FLASH_PAYLOAD_VERSION   1       // format version of the header.
+#if FLASH_PAYLOAD_HEADER
+#define FLASH_PAYLOAD_OFFSET    8       // sizeof(struct flash_payload_header).
+#else   // FLASH_PAYLOAD_HEADER
+#define FLASH_PAYLOAD_OFFSET    0
+#endif  // FLASH_PAYLOAD_HEADER
+#define FLASH_PAYLOAD_MAX_SIZE  (FLASH_SECTOR_SIZE - FLASH_PAYLOAD_OFFSET)  // maximum data size for flash_save_data().
+
+/* Return codes of flash_save_data(). A save that finds the same data already in flash (or in the write-back cache) writes nothing and says so, so that
+   the caller knows whether a physical write happened without relying on FlashStats.LastSaveWritten, which any later save may overwrite. */
+#define FLASH_SAVE_WRITTEN      0  // data has been written to flash (or to the write-back cache, when FLASH_CACHE_SECTORS is not 0).
+#define FLASH_SAVE_ERROR        1  // invalid request, or data could not be written.
+#define FLASH_SAVE_SKIPPED      2  // flash already contained the same data, nothing has been written.
+
+/* Power-fail-safe A/B commit (flash_ab_xxx() functions). Data is saved alternately to two sectors, with a header in the first page of the sector and data
+   beginning on the second page. The commit marker is programmed last, so a copy interrupted by a reset is never considered valid. */
+#define FLASH_AB_MAGIC          0x42415046  // "FPAB" - identifies an A/B header.
+#define FLASH_AB_COMMIT         0x54494D43  // "CMIT" - programmed in the header once data has been completely written.
+#define FLASH_AB_MAX_DATA_SIZE  (FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE)
+
+/* Asynchronous save engine (flash_async_xxx() functions). Saves are queued by flash_async_submit() and performed step by step by flash_async_task(), which
+   must be called regularly from the main loop (or from the other core). Each call performs at most one sector erase or one page program.
+   The engine stages the sector being written in its own buffer (FLASH_SECTOR_SIZE bytes of RAM), so that flash_save_data() and flash_write() may still be
+   used for other sectors while an asynchronous save is pending. They are refused (error returned) for a sector that has a save queued or in progress, since
+   the sector image staged by the engine would then be programmed over the new data: wait for the save to complete first (see flash_async_status()).
+   FLASH_ASYNC_QUEUE_SIZE may be set to 0 to remove the engine and its buffer. */
+#ifndef FLASH_ASYNC_QUEUE_SIZE
+#define FLASH_ASYNC_QUEUE_SIZE  4  // maximum number of saves waiting in the queue.
+#endif  // FLASH_ASYNC_QUEUE_SIZE
+
+/* Status of a save submitted to the asynchronous save engine. */
+#define FLASH_ASYNC_FREE        0  // slot not used (or status already retrieved).
+#define FLASH_ASYNC_QUEUED      1  // waiting in the queue.
+#define FLASH_ASYNC_BUSY        2  // being written to flash.
+#define FLASH_ASYNC_DONE        3  // completed successfully.
+#define FLASH_ASYNC_ERROR       4  // completed with an error.
+
+/* Steps of the save being written by the asynchronous save engine. */
+#define FLASH_ASYNC_STEP_START    0  // build sector image and find pages to program.
+#define FLASH_ASYNC_STEP_ERASE    1  // erase sector.
+#define FLASH_ASYNC_STEP_PROGRAM  2  // program one page.
+
+/* Size of the static scratch buffer used to stage a sector before writing it to flash (replaces a malloc() on every save). It may be set to 0 to save RAM,
+   in which case the program must provide its own scratch buffer with flash_set_scratch() before any save. */
+#define FLASH_SCRATCH_SIZE      FLASH_SECTOR_SIZE
+
+/* Write-back RAM cache for flash_save_data(). When FLASH_CACHE_SECTORS is not 0, saves only update a RAM copy of the sector, and flash is written later, when
+   flash_cache_flush() is called, when the sector has not been updated for FLASH_CACHE_IDLE_MSEC (checked by flash_cache_task()) or when it has been updated
+   FLASH_CACHE_DIRTY_MAX times. flash_read_data() and flash_read_range() return cached data. Each cached sector uses FLASH_SECTOR_SIZE bytes of RAM.
+   NOTE: Sectors saved through the cache must not be written with other functions of the module while they are dirty. */
+#ifndef FLASH_CACHE_SECTORS
+#define FLASH_CACHE_SECTORS     0     // number of sectors that may be cached (0 = no cache, flash_save_data() writes immediately).
+#endif  // FLASH_CACHE_SECTORS
+#define FLASH_CACHE_IDLE_MSEC   2000  // write a dirty sector to flash when it has not been updated for this time.
+#define FLASH_CACHE_DIRTY_MAX   8     // write a dirty sector to flash when it has been updated this number of times.
+
+/* Number of validated views kept by flash_get_view(). A view remains valid until the module itself erases or programs any part of it. */
+#define FLASH_VIEW_CACHE_SIZE   4
+
+/* Size of the buffer used by flash_display() and util_display_data() to send a hex dump in large batches (a multiple of a dump line is not required). */
+#define UTIL_DUMP_BUFFER_SIZE   1024
+
+/* Benchmark of the main paths of the module (flash_benchmark()). Each operation is timed for sizes going from 16 bytes up to a full sector, then up to
+   FLASH_BENCH_SECTORS sectors for operations that may span several sectors. Operations that don't touch flash are timed FLASH_BENCH_BATCH calls at a time,
+   so that their latency is not lost in the 1 usec resolution of the timer. Disabled (0) by default: the benchmark uses FLASH_BENCH_SECTORS sectors of RAM.
+   It is enabled by the build of Pico-Flash-Example and of the host benchmark (see CMakeLists.txt). */
+#ifndef FLASH_BENCH_SECTORS
+#define FLASH_BENCH_SECTORS     0         // largest area benchmarked, in sectors (size of the RAM buffer holding data written to flash).
+#endif  // FLASH_BENCH_SECTORS
+#define FLASH_BENCH_OFFSET      0x1F0000  // area used by Pico-Flash-Example (below the log-structured record store). Its content is lost.
+#define FLASH_BENCH_SAMPLES     64        // maximum number of iterations for each operation and size (one latency sample per iteration).
+#define FLASH_BENCH_BATCH       16        // calls timed together for operations that don't write to flash.
+
+/* Lowest offset accepted by flash_write_range() (and thus by the binary transfer of flash_xfer_import()), so that a wrong offset can't overwrite the program
+   code at the beginning of flash. By default, the benchmark area and every sector above it (see memory map above). May be lowered when the area between
+   the end of the program and FLASH_BENCH_OFFSET is known to be free. */
+#ifndef FLASH_WRITE_RANGE_MIN
+#define FLASH_WRITE_RANGE_MIN   FLASH_BENCH_OFFSET
+#endif  // FLASH_WRITE_RANGE_MIN
+
+/* Operations timed by flash_benchmark(), in the order they are run. Operations before FLASH_BENCH_SAVE_DATA don't write to flash. */
+#define FLASH_BENCH_CRC16       0  // util_crc16() of data in RAM.
+#define FLASH_BENCH_VERIFY_CRC  1  // flash_verify_crc() of data in flash.
+#define FLASH_BENCH_READ_RANGE  2  // flash_read_range().
+#define FLASH_BENCH_READ_DATA   3  // flash_read_data() (header and CRC16 validated).
+#define FLASH_BENCH_DUMP        4  // hex dump formatting done by flash_display() (lines are built, but not sent).
+#define FLASH_BENCH_SAVE_SAME   5  // flash_save_data() of data identical to flash content (nothing written).
+#define FLASH_BENCH_SAVE_DATA   6  // flash_save_data() of new data.
+#define FLASH_BENCH_WRITE       7  // flash_write() of new data.
+#define FLASH_BENCH_WRITE_RANGE 8  // flash_write_range() of new data.
+#define FLASH_BENCH_ERASE       9  // flash_erase() of a sector that is not blank.
+#define FLASH_BENCH_OPS         10
+
+/* Binary transfer of flash ranges with a host computer (flash_xfer_serve() on the Pico, Pico-Flash-Tool.c on the host). The frame format and the
+   FLASH_XFER_xxx protocol values are defined in Pico-Flash-Xfer.h, shared by both sides.
+   Disabled (0) by default: the transfer uses FLASH_XFER_CHUNK_SIZE + FLASH_SECTOR_SIZE bytes of RAM. Set FLASH_XFER to 1 to build flash_xfer_serve(). */
+#ifndef FLASH_XFER
+#define FLASH_XFER              0
+#endif  // FLASH_XFER
+
+/* Key-value store (flash_kv_xxx() functions), built on the log-structured record store. Integer keys go from 0 to FLASH_KV_MAX_KEY. String keys are hashed
+   to the remaining record IDs and the string itself is saved in front of the value. When two strings are hashed to the same ID, the next IDs are tried in
+   turn (up to FLASH_KV_PROBES of them), and the one whose saved string matches is used. */
+#define FLASH_KV_MAX_KEY        0x7FFF
+#define FLASH_KV_MAX_NAME       32      // maximum length of a string key.
+#define FLASH_KV_PROBES         8       // record IDs tried for a string key, starting with the one given by its hash.
+#define FLASH_KV_NO_KEY         0xFFFF  // no record ID (never used as a record ID by the log-structured record store).
+
+/* Result of the comparison of a page of new data with current flash content. */
+#define FLASH_PAGE_IDENTICAL    0  // nothing to program.
+#define FLASH_PAGE_PROGRAM      1  // only 1 bits become 0, page may be programmed without erasing the sector.
+#define FLASH_PAGE_ERASE        2  // some 0 bits must become 1, sector must be erased.
+
 /* RAM base address. */
 #define RAM_BASE_ADDRESS  0x20000000
 
+/* Log-structured record store (flash_log_xxx() functions). The ten sectors FLASH_DATA_OFFSET1 to FLASH_DATA_OFFSET10 are used as a ring. Each new version of a
+   record is appended after the previous one with a sequence number, and a sector is erased only when the ring wraps around and the sector is reclaimed.
+   NOTE: When the log-structured record store is used, those ten sectors belong to it and must not be written with flash_save_data(). */
+#define FLASH_LOG_SECTORS       10      // number of sectors in the ring (FLASH_DATA_OFFSET1 to FLASH_DATA_OFFSET10).
+#define FLASH_LOG_MAX_RECORDS   32      // maximum number of different record IDs kept in the RAM index.
+#define FLASH_LOG_MAGIC         0x4C52  // "RL" - identifies a record header.
+#define FLASH_LOG_HASH_SIZE     (2 * FLASH_LOG_MAX_RECORDS)  // slots of the RAM hash table used to find a record ID in the index.
+#define FLASH_LOG_ALIGN         4       // records begin on a 4-byte boundary.
+#define FLASH_LOG_FLAG_DELETED  0x0001  // bit cleared in the header Flags of a record that marks the deletion of a record ID.
+#define FLASH_LOG_CHECKPOINT_ID 0xFFFE  // record ID reserved for the checkpoints of the RAM index.
+#ifndef FLASH_LOG_CHECKPOINT_INTERVAL
+#define FLASH_LOG_CHECKPOINT_INTERVAL 64  // records appended between two checkpoints, also written after each sector reclaim (0 = no checkpoint, full replay on mount).
+#endif  // FLASH_LOG_CHECKPOINT_INTERVAL
+#define FLASH_LOG_MAX_DATA_SIZE (FLASH_SECTOR_SIZE - sizeof(struct flash_log_header))
+
+/* Slot of the RAM hash table where the search for a record ID begins. */
+#define FLASH_LOG_HASH(RecordId) (((UINT32)(RecordId) * 40503u) % FLASH_LOG_HASH_SIZE)
+
+/* Number of bytes of flash used by a record (header and data, rounded up to FLASH_LOG_ALIGN). */
+#define FLASH_LOG_RECORD_SIZE(DataSize) ((sizeof(struct flash_log_header) + (DataSize) + (FLASH_LOG_ALIGN - 1)) & ~(FLASH_LOG_ALIGN - 1))
+
+/* Wear statistics (flash_wear_xxx() functions). Erases of the sectors FLASH_DATA_OFFSET1 to FLASH_DATA_OFFSET10, bytes requested and programmed, skipped and
+   coalesced saves are counted in RAM since power-up. When FLASH_WEAR_JOURNAL is 1, they are also saved to a journal in the two sectors FLASH_WEAR_OFFSET1 and
+   FLASH_WEAR_OFFSET2 (which must not be used for anything else), so that they are kept across power cycles. The journal is saved when flash_wear_save() is
+   called, and at the end of a write (never between the erase and the program of a sector) once FLASH_WEAR_SAVE_INTERVAL erases have been counted.
+   Each save appends a record in the next blank slot, so that a journal sector is erased only once every (FLASH_SECTOR_SIZE / FLASH_WEAR_SLOT_SIZE) saves,
+   and the newest valid record is always kept in the other sector while it is erased. Disabled (0) by default. */
+#ifndef FLASH_WEAR_JOURNAL
+#define FLASH_WEAR_JOURNAL      0
+#endif  // FLASH_WEAR_JOURNAL
+#define FLASH_WEAR_SECTORS      10        // sectors whose erases are counted (FLASH_DATA_OFFSET1 to FLASH_DATA_OFFSET10).
+#define FLASH_WEAR_OFFSET1      0x1F5000  // first sector of the journal (one sector before FLASH_DATA_OFFSET10).
+#define FLASH_WEAR_OFFSET2      0x1F4000  // second sector of the journal.
+#define FLASH_WEAR_SLOT_SIZE    128       // space used by each record of the journal (a record must fit in a slot).
+#define FLASH_WEAR_MAGIC        0x5757    // "WW" - identifies a record of the journal.
+#define FLASH_WEAR_SAVE_INTERVAL 16       // erases of counted sectors between two automatic saves of the journal.
+#define FLASH_WEAR_ENDURANCE    100000    // erase cycles guaranteed for each sector of the Pico's flash (W25Q16JV).
+
+/* Latency histograms (flash_latency_xxx() functions) of sector erases, page programs, calls to flash_save_data() and windows during which the module keeps
+   interrupts disabled. Bucket 0 counts durations of 0 usec, bucket n counts durations from 2^(n-1) up to (2^n - 1) usec, and the last bucket also counts
+   everything longer. Recording a duration only reads the timer and increments a few counters, so that histograms may remain enabled in RELEASE_VERSION.
+   FLASH_LATENCY may be set to 0 to remove them. */
+#ifndef FLASH_LATENCY
+#define FLASH_LATENCY           1
+#endif  // FLASH_LATENCY
+#define FLASH_LATENCY_BUCKETS   24        // last bucket begins at 2^22 usec (about 4 seconds).
+
+#if (FLASH_LATENCY > 0)
+#define FLASH_LATENCY_ADD(Histogram, USec)  flash_latency_add(&FlashLatency.Histogram, (USec))
+#else   // FLASH_LATENCY
+#define FLASH_LATENCY_ADD(Histogram, USec)  do { (void)(USec); } while (0)
+#endif  // FLASH_LATENCY
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Structures. */
+/* ============================================================================================================================================================= *\
+                                                                        Structures.
+\* ============================================================================================================================================================= */
+/* Header in the first page of each sector used by the A/B commit. */
+struct flash_ab_header
+{
+  UINT32 Magic;        // FLASH_AB_MAGIC.
+  UINT32 Generation;   // incremented on every save, the highest valid one is the current copy.
+  UINT16 DataSize;     // number of data bytes beginning on the second page of the sector.
+  UINT16 DataCrc16;    // CRC16 of data bytes.
+  UINT16 HeaderCrc16;  // CRC16 of all the above members of the header.
+  UINT16 Reserved;     // 0xFFFF.
+  UINT32 Commit;       // FLASH_AB_COMMIT once data has been completely programmed, 0xFFFFFFFF before.
+};
+
+/* Header written in front of each record of the log-structured record store. */
+struct flash_log_header
+{
+  UINT16 Magic;        // FLASH_LOG_MAGIC for a record, 0xFFFF for free space.
+  UINT16 RecordId;     // identifier of the record, chosen by the caller.
+  UINT32 Sequence;     // monotonically increasing over the whole ring, the highest one is the latest version of a record.
+  UINT16 DataSize;     // number of data bytes following the header.
+  UINT16 Flags;        // FLASH_LOG_FLAG_xxx bits, cleared when active (0xFFFF for a normal record).
+  UINT16 DataCrc16;    // CRC16 of the data bytes following the header.
+  UINT16 HeaderCrc16;  // CRC16 of all the above members of the header.
+};
+
+/* Header saved by flash_save_data() in front of data (FLASH_PAYLOAD_HEADER). */
+struct flash_payload_header
+{
+  UINT16 Magic;        // FLASH_PAYLOAD_MAGIC
+  UINT8  Version;      // FLASH_PAYLOAD_VERSION
+  UINT8  Reserved;     // 0xFF
+  UINT16 DataSize;     // size of data following the header (including its CRC16).
+  UINT16 HeaderCrc16;  // CRC16 of all the above members of the header.
+};
+
+/* Statistics of flash operations performed by the module since power-up. */
+struct flash_stats
+{
+  UINT32 SaveRequests;     // calls to flash_save_data().
+  UINT32 SaveSkipped;      // calls to flash_save_data() skipped because flash already contained the same data.
+  UINT8  LastSaveWritten;  // TRUE if last call to flash_save_data() physically wrote to flash (the return code of each save also tells it).
+  UINT32 LockoutCount;     // number of times the other core has been parked (FLASH_MULTICORE_LOCKOUT).
+  UINT32 LockoutMaxUSec;   // longest time the other core has been parked (in usec).
+  UINT64 LockoutTotalUSec; // total time the other core has been parked (in usec).
+  UINT32 ScratchBusy;      // requests that failed because the scratch buffer was already in use (nested call from a callback, for example).
+  UINT32 ScratchHighWater; // most bytes of scratch buffer requested at once, nested requests included (FLASH_SECTOR_SIZE unless ScratchBusy is not 0).
+  UINT32 CacheFlushes;     // dirty sectors physically written from the write-back cache.
+  UINT32 SaveCoalesced;    // calls to flash_save_data() merged with a later one by the write-back cache (physical writes avoided).
+  UINT32 LogMountUSec;     // time taken by last flash_log_mount() (in usec).
+  UINT32 LogIndexBytes;    // RAM used by the index of the log-structured record store / key-value store.
+  UINT16 LogRecords;       // number of record IDs in the index.
+  UINT16 LogReplayed;      // records replayed (data CRC checked) by last flash_log_mount(), after the latest valid checkpoint.
+  UINT32 EraseRequests;    // sector erases requested (flash_erase()).
+  UINT32 EraseSkipped;     // sector erases skipped because the sector was already blank (EraseSkipped / EraseRequests is the fraction avoided).
+  UINT32 TraceDropped;     // trace events lost because the trace ring was full (flash_trace_drain() not called often enough).
+};
+
+
+
+
+
+/* Wear statistics, since the journal has been created. */
+struct flash_wear
+{
+  UINT64 BytesRequested;                   // bytes given to flash_save_data(), flash_ab_save(), flash_async_submit(), flash_log_write() and flash_write_range().
+  UINT64 BytesProgrammed;                  // bytes physically programmed (whole pages). BytesProgrammed / BytesRequested is the write amplification.
+  UINT32 EraseCount[FLASH_WEAR_SECTORS];   // erases of each sector, [0] for FLASH_DATA_OFFSET1 up to [9] for FLASH_DATA_OFFSET10.
+  UINT32 WritesSkipped;                    // saves not written because flash already contained the same data.
+  UINT32 WritesCoalesced;                  // saves merged with a later one by the write-back cache.
+  UINT32 PoweredSeconds;                   // time the firmware has been running, to compute the erase rate.
+};
+
+
+/* Record of the wear journal (one per slot of FLASH_WEAR_SLOT_SIZE bytes). */
+struct flash_wear_record
+{
+  UINT16            Magic;                 // FLASH_WEAR_MAGIC.
+  UINT16            Crc16;                 // CRC16 of the rest of the record.
+  UINT32            Sequence;              // incremented at each save, the newest valid record is used.
+  struct flash_wear Wear;
+};
+
+
+
+
+
+/* Log2-bucketed histogram of durations (in usec). */
+struct flash_histogram
+{
+  UINT32 Count[FLASH_LATENCY_BUCKETS];     // see FLASH_LATENCY_BUCKETS for the range of each bucket.
+  UINT32 Samples;                          // durations recorded.
+  UINT32 MaxUSec;                          // longest duration recorded.
+  UINT64 TotalUSec;                        // sum of durations recorded (TotalUSec / Samples is the average).
+};
+
+
+/* Latency histograms of the module, since power-up or last flash_latency_reset(). */
+struct flash_latency
+{
+  struct flash_histogram Erase;            // flash_range_erase() of a sector.
+  struct flash_histogram Program;          // flash_range_program() of a page.
+  struct flash_histogram Save;             // whole call to flash_save_data() (including skipped and cached saves).
+  struct flash_histogram IrqOff;           // interrupts disabled by the module for an erase or a page program. IrqOff.MaxUSec is the longest window.
+};
+
+
+
+
+
+/* Event recorded in the binary trace ring by FLASH_TRACE(). */
+struct flash_trace_event
+{
+  const CHAR  *Format;            // format string, as for uart_send().
+  const CHAR  *Function;          // name of the function that recorded the event.
+  UINT16       Line;              // line number in the source file.
+  UINT32       Arg[FLASH_TRACE_ARGS];
+};
+
+
+
+
+
+/* Context of a CRC16 computed in chunks, with util_crc16_init(), util_crc16_update() and util_crc16_final(). Data may be anywhere, including directly in flash. */
+struct crc16_context
+{
+  UINT16 CrcValue;    // CRC16 of the data processed so far.
+  UINT32 DataSize;    // number of bytes processed so far.
+};
+
+
+
+
+
+/* Function called by flash_async_task() when an asynchronous save is completed. Status is FLASH_ASYNC_DONE or FLASH_ASYNC_ERROR. */
+typedef void (*flash_async_callback)(INT16 Handle, UINT8 Status, void *Context);
+
 
 
 
@@ -87,6 +488,33 @@
 /* ============================================================================================================================================================= *\
                                                                      Functions prototype.
 \* ============================================================================================================================================================= */
+/* Read the newest valid copy of data saved with the power-fail-safe A/B commit. */
+UINT8 flash_ab_read(UINT32 OffsetA, UINT32 OffsetB, UINT8 *Data, UINT16 DataSize);
+
+/* Save data with the power-fail-safe A/B commit. */
+UINT8 flash_ab_save(UINT32 OffsetA, UINT32 OffsetB, UINT8 *Data, UINT16 DataSize);
+
+/* Check if an asynchronous save is queued or in progress in an area of flash. */
+UINT8 flash_async_pending(UINT32 DataOffset, UINT32 DataSize);
+
+/* Return the status of a save submitted to the asynchronous save engine. */
+UINT8 flash_async_status(INT16 Handle);
+
+/* Queue a save to the asynchronous save engine. */
+INT16 flash_async_submit(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize, flash_async_callback Callback, void *Context);
+
+/* Perform the next step (one erase or one page program) of the asynchronous save engine. */
+void flash_async_task(void);
+
+/* Measure throughput and latency of the main paths of the module over an area of flash, and print results as CSV lines (content of the area is lost). */
+UINT8 flash_benchmark(UINT32 DataOffset, UINT8 SectorCount, UINT16 Iterations);
+
+/* Write all dirty sectors of the write-back cache to flash. */
+UINT8 flash_cache_flush(void);
+
+/* Write to flash the dirty sectors of the write-back cache that have not been updated for FLASH_CACHE_IDLE_MSEC. */
+void flash_cache_task(void);
+
 /* Display flash content through external monitor. */
 void flash_display(UINT32 Offset, UINT32 Length);
 
@@ -96,14 +524,91 @@ static UINT8 flash_erase(UINT32 DataOffset);
 /* Extract the CRC16 from the packet passed as an argument (it is the last 16 bits of the packet). */
 UINT16 flash_extract_crc(UINT8 *Data, UINT16 DataSize);
 
+/* Retrieve statistics of flash operations performed by the module. */
+void flash_get_stats(struct flash_stats *Stats);
+
+/* Return a pointer directly to data in flash memory, once its CRC16 has been validated. */
+const UINT8 *flash_get_view(UINT32 DataOffset, UINT16 DataSize);
+
+/* Delete a key from the key-value store. */
+UINT8 flash_kv_delete(UINT16 Key);
+
+/* Delete a string key from the key-value store. */
+UINT8 flash_kv_delete_str(const UCHAR *Name);
+
+/* Read the value of a key from the key-value store. */
+UINT8 flash_kv_get(UINT16 Key, UINT8 *Value, UINT16 *ValueSize);
+
+/* Read the value of a string key from the key-value store. */
+UINT8 flash_kv_get_str(const UCHAR *Name, UINT8 *Value, UINT16 *ValueSize);
+
+/* Write the value of a key to the key-value store. */
+UINT8 flash_kv_set(UINT16 Key, UINT8 *Value, UINT16 ValueSize);
+
+/* Write the value of a string key to the key-value store. */
+UINT8 flash_kv_set_str(const UCHAR *Name, UINT8 *Value, UINT16 ValueSize);
+
+/* Retrieve a snapshot of the latency histograms. */
+void flash_latency_get(struct flash_latency *Latency);
+
+/* Clear the latency histograms. */
+void flash_latency_reset(void);
+
+/* Delete a record from the log-structured record store. */
+UINT8 flash_log_delete(UINT16 RecordId);
+
+/* Return the number of times a sector of the log-structured record store has been erased since power-up. */
+UINT32 flash_log_erase_count(UINT8 SectorNumber);
+
+/* Scan the ring of the log-structured record store and rebuild its RAM index. */
+UINT8 flash_log_mount(void);
+
+/* Return a pointer to the data of the latest version of a record, directly in flash memory. */
+const UINT8 *flash_log_locate(UINT16 RecordId, UINT16 *DataSize);
+
+/* Read the latest version of a record from the log-structured record store. */
+UINT8 flash_log_read(UINT16 RecordId, UINT8 *Data, UINT16 DataSize);
+
+/* Append a new version of a record to the log-structured record store. */
+UINT8 flash_log_write(UINT16 RecordId, UINT8 *Data, UINT16 DataSize);
+
 /* Read data from flash memory at the specified offset. */
 UINT8 flash_read_data(UINT32 DataOffset, UINT8 *Data, UINT16 DataSize);
 
+/* Read data of any size from any offset of flash memory. */
+UINT8 flash_read_range(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize);
+
 /* Save current data to flash. */
 UINT8 flash_save_data(UINT32 DataOffset, UINT8 *Data,  UINT16 DataSize);
 
-/* Write data to Pico's flash memory. */
+/* Retrieve wear statistics (saved in the journal, plus what has been counted since). */
+void flash_wear_get(struct flash_wear *Wear);
+
+/* Save wear statistics to the journal. */
+UINT8 flash_wear_save(void);
+
+#if ((FLASH_CACHE_SECTORS == 0) || (FLASH_BENCH_SECTORS > 0))
+/* Write data to Pico's flash memory (used by flash_save_data() when there is no write-back cache, and by the benchmark). */
 static UINT8 flash_write(UINT32 DataOffset, UINT8 *NewData, UINT16 NewDataSize);
+#endif  // FLASH_CACHE_SECTORS / FLASH_BENCH_SECTORS
+
+/* Validate the CRC16 of data of any size directly in flash memory, without copying it to RAM (the CRC16 is the last 16 bits of the data). */
+UINT8 flash_verify_crc(UINT32 DataOffset, UINT32 DataSize);
+
+/* Provide a scratch buffer used to stage a sector before writing it to flash, instead of the static one. */
+UINT8 flash_set_scratch(UINT8 *Buffer, UINT32 BufferSize);
+
+/* Record an event in the binary trace ring (normally through FLASH_TRACE()). */
+void flash_trace_add(UINT16 Line, const CHAR *Function, const CHAR *Format, UINT32 Arg0, UINT32 Arg1, UINT32 Arg2);
+
+/* Format and send the events waiting in the binary trace ring. */
+UINT16 flash_trace_drain(UINT16 MaxEvents);
+
+/* Write data of any size to any offset of flash memory. */
+UINT8 flash_write_range(UINT32 DataOffset, UINT8 *Data, UINT32 DataSize);
+
+/* Wait for a binary transfer request from the host tool and perform it (export or import of a flash range). */
+UINT8 flash_xfer_serve(UINT32 TimeoutMSec);
 
 /* Send a string to external monitor through Pico's UART or CDC USB. */
 extern void uart_send(UINT LineNumber, const UCHAR *FunctionName, UCHAR *Format, ...);
@@ -111,6 +616,15 @@ extern void uart_send(UINT LineNumber, const UCHAR *FunctionName, UCHAR *Format,
 /* Find the cyclic redundancy check of the specified data. */
 UINT16 util_crc16(UINT8 *Data, UINT16 DataSize);
 
+/* Return the CRC16 of all data processed with a CRC16 context. */
+UINT16 util_crc16_final(struct crc16_context *Context);
+
+/* Initialize a context to compute a CRC16 in chunks. */
+void util_crc16_init(struct crc16_context *Context);
+
+/* Add a chunk of data to the CRC16 computed with a CRC16 context. */
+void util_crc16_update(struct crc16_context *Context, const UINT8 *Data, UINT32 DataSize);
+
 /* Display binary data - whose pointer is passed has an argument - to an external monitor. */
 void util_display_data(UCHAR *Data, UINT32 DataSize);
 
@@ -0,0 +1,147 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Mount.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Host benchmark of the mount of the log-structured record store (flash_log_mount()), over the emulated flash of Pico-Flash-Host.c. The ring is filled
+        one sector at a time with small records (MOUNT_RECORD_IDS different record IDs, rewritten in turn), until all sectors but the last two are full.
+        After each sector, the store is mounted again MOUNT_RUNS times. One CSV line per number of filled sectors is printed on stdout:
+            checkpoint_interval - FLASH_LOG_CHECKPOINT_INTERVAL the module has been built with (0 = no checkpoint, every record is replayed).
+            filled_sectors      - sectors of the ring filled with records.
+            records_written     - records written to the ring so far (checkpoints excluded).
+            records_replayed    - records replayed by the mount (LogReplayed of struct flash_stats).
+            mount_usec          - median time taken by the mount (LogMountUSec of struct flash_stats).
+
+        The interval is selected at compile time, so the program is built once for each interval (see PICO_FLASH_MOUNT_INTERVALS in CMakeLists.txt), named
+        pico-flash-mount-<interval>. Erase and program are not timed: mount only reads flash, its time is the time taken by the host to scan the ring.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host:   cmake -S . -B build-host -DPICO_FLASH_HOST=ON -DCMAKE_BUILD_TYPE=Release && cmake --build build-host
+
+            build-host/pico-flash-mount-64                                                  (default checkpoint interval)
+            for Bench in build-host/pico-flash-mount-*; do $Bench; done | awk 'NR == 1 || !/^checkpoint/'     (all intervals in one CSV)
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+#define MOUNT_RECORD_IDS        16   // different record IDs written (all of them stay live).
+#define MOUNT_RECORD_SIZE       48   // size of each record.
+#define MOUNT_RUNS              15   // mounts timed after each sector (median is reported).
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Compare two mount times (for qsort()). */
+static INT mount_compare(const void *Time1, const void *Time2);
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(void)
+{
+  struct host_flash_config Config;
+  struct flash_stats       Stats;
+
+  UINT8 Data[MOUNT_RECORD_SIZE];
+  UINT8 Loop1UInt8;
+
+  UINT16 Loop1UInt16;
+
+  UINT32 MountUSec[MOUNT_RUNS];
+  UINT32 Records;
+
+
+  /* No time model: only the time taken to scan the ring is measured. */
+  memset(&Config, 0, sizeof(Config));
+  if (host_flash_init(&Config) || flash_log_mount())
+  {
+    fprintf(stderr, "Can't initialize emulated flash.\n");
+    return 1;
+  }
+
+  printf("checkpoint_interval,filled_sectors,records_written,records_replayed,mount_usec\n");
+
+  Records = 0;
+  for (Loop1UInt8 = 1; Loop1UInt8 < (FLASH_LOG_SECTORS - 1); ++Loop1UInt8)
+  {
+    /* Fill sectors up to the first record of the next one (the ring is used from FLASH_DATA_OFFSET1 down). Opening the last sector of the ring would
+       reclaim the first one, so the ring is never filled further. */
+    while (*(UINT32 *)(XIP_BASE + FLASH_DATA_OFFSET1 - (Loop1UInt8 * FLASH_SECTOR_SIZE)) == 0xFFFFFFFF)
+    {
+      memset(Data, Records, sizeof(Data));
+      if (flash_log_write(Records % MOUNT_RECORD_IDS, Data, sizeof(Data)))
+      {
+        fprintf(stderr, "Record %u can't be written.\n", Records);
+        return 1;
+      }
+      ++Records;
+    }
+
+    for (Loop1UInt16 = 0; Loop1UInt16 < MOUNT_RUNS; ++Loop1UInt16)
+    {
+      if (flash_log_mount())
+      {
+        fprintf(stderr, "Mount failed.\n");
+        return 1;
+      }
+      flash_get_stats(&Stats);
+      MountUSec[Loop1UInt16] = Stats.LogMountUSec;
+    }
+    qsort(MountUSec, MOUNT_RUNS, sizeof(MountUSec[0]), mount_compare);
+
+    printf("%u,%u,%u,%u,%u\n", FLASH_LOG_CHECKPOINT_INTERVAL, Loop1UInt8, Records, Stats.LogReplayed, MountUSec[MOUNT_RUNS / 2]);
+  }
+
+  host_flash_close();
+
+  return 0;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=mount_compare() */
+/* ============================================================================================================================================================= *\
+                                                                   Compare two mount times (for qsort()).
+\* ============================================================================================================================================================= */
+static INT mount_compare(const void *Time1, const void *Time2)
+{
+  return (*(const UINT32 *)Time1 > *(const UINT32 *)Time2) - (*(const UINT32 *)Time1 < *(const UINT32 *)Time2);
+}
@@ -0,0 +1,800 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Test.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Host tests of Pico-Flash-Module over the emulated flash of Pico-Flash-Host.c. Each check prints one line, and the exit status is 1 if any check failed.
+            crc16 - util_crc16() gives the catalogued check value of CRC16_POLYNOM (when it is one of TestCrcCatalog[]) and the same result as the
+                    original bit-serial algorithm for every size and alignment of data. The incremental API (util_crc16_init() / update() / final()) gives
+                    the same result however data is split, and flash_verify_crc() the same result directly from flash. The throughput of the engine and
+                    of the bit-serial algorithm is then printed on an "info" line (meaningful only in an optimized build).
+            read  - flash_save_data() / flash_read_data() round trip, detection of corrupted data and of a blank sector, flash_read_range() at any offset.
+            async - asynchronous save engine: flash_async_submit() must return in less time than a sector erase (it never erases nor programs, its
+                    only cost is the CRC16 of data), while synchronous writes to the sector are refused until flash_async_task() has completed the save.
+                    The time taken by the submit, by the erase step and by the longest page program step is printed on an "info" line.
+            log   - log-structured record store: mount of a blank ring, append and read back, remount (with and without a checkpoint), reclaim of every
+                    sector of the ring while live records are kept, and deletion markers (tombstones) that survive reclaims and remounts.
+            kv    - key-value store: two string keys hashed to the same record ID are both kept, read back and deleted independently.
+            wear  - only when "wear <saves>" is given on the command line: that many saves to the log-structured record store (a few hot records
+                    rewritten, and cold records written once that must be moved on each reclaim), over an emulated flash without time model. The erase
+                    count of each ring sector is printed, and must not differ by more than one erase from one sector to another.
+
+        The program is built for each CRC16 engine and each polynom listed in Pico-Flash-Module.h (see PICO_FLASH_TEST_POLYNOMS in CMakeLists.txt), so that
+        all engines are checked against the same reference, bit for bit, with every polynom.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host:   cmake -S . -B build-host -DPICO_FLASH_HOST=ON && cmake --build build-host
+
+            ctest --test-dir build-host --output-on-failure
+            ctest --test-dir build-host -R 1021 -V | grep info      (throughput of each engine with polynom 0x1021)
+            build-host/pico-flash-test-slice8-1021                  (one engine and polynom, all checks)
+            build-host/pico-flash-wear wear 10000000                (wear leveling over 10 million saves)
+
+      Add -DCMAKE_BUILD_TYPE=Release for throughput figures, and -DPICO_FLASH_TEST_POLYNOMS=1021 to build only the tests of one polynom.
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+#define TEST_CRC_MAX_SIZE       1100  // largest buffer checked against the reference CRC16 (sizes 0 up to this one).
+#define TEST_READ_OFFSET        FLASH_BENCH_OFFSET  // sector used by the read path checks (outside the log-structured record store).
+#define TEST_CRC_SPEED_SIZE     FLASH_SECTOR_SIZE  // size of data used to measure the throughput of the CRC16 engine.
+#define TEST_CRC_SPEED_COUNT    256   // CRC16 computed for each throughput measurement.
+#define TEST_CRC_OFFSET         (FLASH_BENCH_OFFSET + (2 * FLASH_SECTOR_SIZE) - 100)  // data spanning two sectors, checked by flash_verify_crc().
+#define TEST_READ_SIZE          600   // size of data saved by the read path checks (CRC16 included).
+#define TEST_ASYNC_OFFSET       (FLASH_BENCH_OFFSET + (3 * FLASH_SECTOR_SIZE))  // sector saved by the asynchronous save engine checks.
+#define TEST_ASYNC_SIZE         2000  // size of data saved by the asynchronous save engine checks (CRC16 included).
+#define TEST_LOG_RECORDS        5     // live records kept in the store while it is filled.
+#define TEST_LOG_BIG_SIZE       1000  // size of the record rewritten to fill the ring.
+#define TEST_LOG_DELETED        3     // record deleted by the tombstone checks.
+#define TEST_KV_NAMES           2000  // string keys tried to find two of them hashed to the same record ID.
+#define TEST_WEAR_HOT           4     // hot records (IDs 1 and up), one of them is rewritten on each save.
+#define TEST_WEAR_HOT_SIZE      32    // size of a hot record.
+#define TEST_WEAR_COLD          8     // cold records (IDs 100 and up), written once.
+#define TEST_WEAR_COLD_SIZE     200   // size of a cold record.
+
+/* Catalogued CRC16 algorithms without reflection, with an initial value of 0 and no final XOR (same as util_crc16()), and their check value,
+   which is the CRC16 of "123456789". */
+static const struct
+{
+  UINT16      Polynom;
+  UINT16      Check;
+  const CHAR *Name;
+} TestCrcCatalog[] = {{0x1021, 0x31C3, "CRC-16/XMODEM"}, {0x8005, 0xFEE8, "CRC-16/UMTS"},        {0x8BB7, 0xD0DB, "CRC-16/T10-DIF"},
+                      {0x0589, 0x007F, "CRC-16/DECT-X"}, {0x5935, 0x5D38, "CRC-16/OPENSAFETY-A"}, {0x755B, 0x20FE, "CRC-16/OPENSAFETY-B"}};
+
+static UINT32 TestChecks;
+static UINT32 TestFailures;
+static UINT32 TestRandom = 12345;
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Asynchronous save engine. */
+static void test_async(void);
+
+/* Count a check and print its result. */
+static void test_check(UINT8 FlagPassed, const CHAR *Description);
+
+/* CRC16 engine and incremental API. */
+static void test_crc16(void);
+
+/* Original bit-serial CRC16 (before table-driven engines), used as reference. */
+static UINT16 test_crc16_reference(const UINT8 *Data, UINT32 DataSize);
+
+/* Print the throughput of the CRC16 engine and of the bit-serial reference. */
+static void test_crc16_speed(void);
+
+/* Key-value store, string keys hashed to the same record ID. */
+static void test_kv(void);
+
+/* Record ID given by the hash of a string key of the key-value store (same as flash_kv_key(), before probing the next IDs). */
+static UINT16 test_kv_hash(const CHAR *Name);
+
+/* Log-structured record store. */
+static void test_log(void);
+
+/* Check that the live records of the log-structured record store hold their expected version. */
+static UINT8 test_log_verify(UINT16 Version);
+
+/* Return the next value of the pseudo-random sequence (same sequence on every run). */
+static UINT32 test_random(void);
+
+/* Read path. */
+static void test_read(void);
+
+/* Wear leveling of the log-structured record store over many saves. */
+static void test_wear(UINT32 Saves);
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(INT argc, CHAR *argv[])
+{
+  struct host_flash_config Config;
+
+
+  /* Wear run: emulated flash without time model (no time is accounted for erases and programs). */
+  memset(&Config, 0, sizeof(Config));
+  if (host_flash_init((argc > 2) && (strcmp(argv[1], "wear") == 0) ? &Config : NULL))
+  {
+    fprintf(stderr, "Can't initialize emulated flash.\n");
+    return 1;
+  }
+
+  if ((argc > 2) && (strcmp(argv[1], "wear") == 0))
+  {
+    test_wear(strtoul(argv[2], NULL, 0));
+  }
+  else
+  {
+    printf("CRC16 engine: %u   polynom: 0x%4.4X\n", CRC16_ENGINE, CRC16_POLYNOM);
+    test_crc16();
+    test_crc16_speed();
+    test_read();
+    test_async();
+    test_log();
+    test_kv();
+  }
+
+  host_flash_close();
+
+  printf("%u checks, %u failed\n", TestChecks, TestFailures);
+
+  return (TestFailures != 0);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_async() */
+/* ============================================================================================================================================================= *\
+                                                                      Asynchronous save engine.
+        NOTE: Times are taken from the clock of the emulated flash, to which the timing model adds each erase and page program.
+\* ============================================================================================================================================================= */
+static void test_async(void)
+{
+  CHAR Description[120];
+
+  UINT8 Data[TEST_ASYNC_SIZE];
+  UINT8 Expected[TEST_ASYNC_SIZE];
+  UINT8 Other[TEST_ASYNC_SIZE];
+  UINT8 Status;
+
+  INT16 Handle;
+
+  UINT16 Loop1UInt16;
+  UINT16 TaskCalls;
+
+  UINT32 EraseCount;
+  UINT32 EraseUSec;
+  UINT32 ProgramUSec;
+  UINT32 SubmitUSec;
+  UINT32 TaskUSec;
+  UINT32 TimeStamp;
+
+
+  /* Old version, then a new version that differs in every bit (the sector must be erased). */
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Data); ++Loop1UInt16) Data[Loop1UInt16] = test_random() >> 8;
+  flash_save_data(TEST_ASYNC_OFFSET, Data, sizeof(Data));
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Data); ++Loop1UInt16) Data[Loop1UInt16] = ~Data[Loop1UInt16];
+
+  TimeStamp  = time_us_32();
+  Handle     = flash_async_submit(TEST_ASYNC_OFFSET, Data, sizeof(Data), NULL, NULL);
+  SubmitUSec = time_us_32() - TimeStamp;
+  memcpy(Expected, Data, sizeof(Expected));  // CRC16 inserted by flash_async_submit().
+  test_check(Handle >= 0, "async: save submitted");
+  test_check(flash_async_pending(TEST_ASYNC_OFFSET + 100, 1) && !flash_async_pending(TEST_READ_OFFSET, FLASH_SECTOR_SIZE), "async: sector reported pending, other sectors are not");
+
+  /* Synchronous writes to the sector are refused while the save is pending (Data itself must not be modified before the save is completed). */
+  memset(Other, 0x55, sizeof(Other));
+  test_check(flash_save_data(TEST_ASYNC_OFFSET, Other, sizeof(Other)) == FLASH_SAVE_ERROR, "async: flash_save_data() of a pending sector is refused");
+  test_check(flash_write_range(TEST_ASYNC_OFFSET + 100, Other, 1) != 0, "async: flash_write_range() in a pending sector is refused");
+
+  /* Drive the engine to completion, one erase or one page program per call. */
+  EraseUSec   = 0;
+  ProgramUSec = 0;
+  TaskCalls   = 0;
+  do
+  {
+    EraseCount = host_flash_erase_count(TEST_ASYNC_OFFSET / FLASH_SECTOR_SIZE);
+    TimeStamp  = time_us_32();
+    flash_async_task();
+    TaskUSec   = time_us_32() - TimeStamp;
+    if (host_flash_erase_count(TEST_ASYNC_OFFSET / FLASH_SECTOR_SIZE) != EraseCount)
+      EraseUSec = TaskUSec;
+    else if (TaskUSec > ProgramUSec)
+      ProgramUSec = TaskUSec;
+
+    Status = flash_async_status(Handle);
+  } while ((Status != FLASH_ASYNC_DONE) && (Status != FLASH_ASYNC_ERROR) && (++TaskCalls < 100));
+
+  test_check(Status == FLASH_ASYNC_DONE, "async: save completed by flash_async_task()");
+  test_check((EraseUSec > 0) && !flash_async_pending(TEST_ASYNC_OFFSET, FLASH_SECTOR_SIZE), "async: sector erased, then not pending anymore");
+  test_check((flash_read_data(TEST_ASYNC_OFFSET, Data, sizeof(Data)) == 0) && (memcmp(Data, Expected, sizeof(Data)) == 0), "async: new version read back");
+
+  printf("info  async: flash_async_submit() %lu usec, erase step %lu usec, longest page program step %lu usec, %u calls of flash_async_task()\n",
+         (unsigned long)SubmitUSec, (unsigned long)EraseUSec, (unsigned long)ProgramUSec, TaskCalls + 1);
+  snprintf(Description, sizeof(Description), "async: flash_async_submit() returns in less time than the erase step (%lu usec)", (unsigned long)SubmitUSec);
+  test_check(SubmitUSec < EraseUSec, Description);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_check() */
+/* ============================================================================================================================================================= *\
+                                                                Count a check and print its result.
+\* ============================================================================================================================================================= */
+static void test_check(UINT8 FlagPassed, const CHAR *Description)
+{
+  ++TestChecks;
+  if (!FlagPassed) ++TestFailures;
+
+  printf("%s  %s\n", FlagPassed ? "ok  " : "FAIL", Description);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_crc16() */
+/* ============================================================================================================================================================= *\
+                                                                  CRC16 engine and incremental API.
+        NOTE: Sizes go up to TEST_CRC_MAX_SIZE and data begins at each of the 8 first alignments, so that every tail of the slice-by-4 / slice-by-8 engines is used.
+\* ============================================================================================================================================================= */
+static void test_crc16(void)
+{
+  struct crc16_context Context;
+
+  CHAR Description[80];
+
+  UINT8 Data[TEST_CRC_MAX_SIZE + 8];
+  UINT8 FlagPassed;
+
+  UINT16 Alignment;
+  UINT16 Crc16;
+  UINT16 DataSize;
+  UINT16 Loop1UInt16;
+
+  UINT32 Chunk;
+  UINT32 Done;
+
+
+  /* Check value of the catalogued algorithm using the same polynom, if any. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < (sizeof(TestCrcCatalog) / sizeof(TestCrcCatalog[0])); ++Loop1UInt16)
+  {
+    if (TestCrcCatalog[Loop1UInt16].Polynom != CRC16_POLYNOM) continue;
+
+    snprintf(Description, sizeof(Description), "crc16: check value of %s is 0x%4.4X", TestCrcCatalog[Loop1UInt16].Name, TestCrcCatalog[Loop1UInt16].Check);
+    test_check(util_crc16((UINT8 *)"123456789", 9) == TestCrcCatalog[Loop1UInt16].Check, Description);
+  }
+#if (CRC16_POLYNOM == 0x1021)
+  test_check(util_crc16((UINT8 *)"A", 1) == 0x58E5,          "crc16: check value of \"A\" is 0x58E5");
+#endif  // CRC16_POLYNOM
+  test_check(util_crc16((UINT8 *)"", 0) == 0,                "crc16: CRC16 of no data is 0");
+  test_check(util_crc16(NULL, 16) == 0,                      "crc16: NULL data is rejected");
+
+  for (DataSize = 0; DataSize < sizeof(Data); ++DataSize) Data[DataSize] = test_random() >> 8;
+
+  /* Same result as the reference for every size and alignment. */
+  FlagPassed = FLAG_ON;
+  for (Alignment = 0; Alignment < 8; ++Alignment)
+    for (DataSize = 0; DataSize <= TEST_CRC_MAX_SIZE; ++DataSize)
+      if (util_crc16(&Data[Alignment], DataSize) != test_crc16_reference(&Data[Alignment], DataSize)) FlagPassed = FLAG_OFF;
+  test_check(FlagPassed, "crc16: same as the bit-serial reference for every size and alignment");
+
+  /* Incremental API, data split in chunks of random sizes (including empty ones). */
+  FlagPassed = FLAG_ON;
+  for (DataSize = 0; DataSize <= TEST_CRC_MAX_SIZE; DataSize += 7)
+  {
+    util_crc16_init(&Context);
+    for (Done = 0; Done < DataSize; Done += Chunk)
+    {
+      Chunk = test_random() % 20;
+      if (Chunk > (DataSize - Done)) Chunk = DataSize - Done;
+      util_crc16_update(&Context, &Data[Done], Chunk);
+    }
+    if ((util_crc16_final(&Context) != util_crc16(Data, DataSize)) || (Context.DataSize != DataSize)) FlagPassed = FLAG_OFF;
+  }
+  test_check(FlagPassed, "crc16: incremental CRC16 doesn't depend on how data is split");
+
+  /* Directly from flash, over a sector boundary (CRC16 little-endian in the last 2 bytes). */
+  Crc16 = util_crc16(Data, TEST_CRC_MAX_SIZE - 2);
+  Data[TEST_CRC_MAX_SIZE - 2] = Crc16 & 0xFF;
+  Data[TEST_CRC_MAX_SIZE - 1] = Crc16 >> 8;
+  flash_write_range(TEST_CRC_OFFSET, Data, TEST_CRC_MAX_SIZE);
+  test_check(flash_verify_crc(TEST_CRC_OFFSET, TEST_CRC_MAX_SIZE) == 0, "crc16: flash_verify_crc() accepts valid data spanning two sectors");
+  Data[10] ^= 0x01;
+  flash_write_range(TEST_CRC_OFFSET, Data, TEST_CRC_MAX_SIZE);
+  test_check(flash_verify_crc(TEST_CRC_OFFSET, TEST_CRC_MAX_SIZE) != 0, "crc16: flash_verify_crc() rejects a flipped bit");
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_crc16_reference() */
+/* ============================================================================================================================================================= *\
+                                              Original bit-serial CRC16 (before table-driven engines), used as reference.
+\* ============================================================================================================================================================= */
+static UINT16 test_crc16_reference(const UINT8 *Data, UINT32 DataSize)
+{
+  UINT8 Loop1UInt8;
+
+  UINT16 CrcValue;
+
+
+  CrcValue = 0;
+
+  while (DataSize-- > 0)
+  {
+    CrcValue = CrcValue ^ (UINT8)*Data++ << 8;
+
+    for (Loop1UInt8 = 0; Loop1UInt8 < 8; ++Loop1UInt8)
+    {
+      if (CrcValue & 0x8000)
+        CrcValue = CrcValue << 1 ^ CRC16_POLYNOM;
+      else
+        CrcValue = CrcValue << 1;
+    }
+  }
+
+  return (CrcValue & 0xFFFF);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_crc16_speed() */
+/* ============================================================================================================================================================= *\
+                                               Print the throughput of the CRC16 engine and of the bit-serial reference.
+              NOTE: Not a check: figures depend on the host and on the build type. The ratio shows what the engine gains over the original algorithm.
+\* ============================================================================================================================================================= */
+static void test_crc16_speed(void)
+{
+  UINT8 Data[TEST_CRC_SPEED_SIZE];
+
+  UINT16 Loop1UInt16;
+
+  UINT64 EngineUSec;
+  UINT64 ReferenceUSec;
+  UINT64 TimeStamp;
+
+  volatile UINT16 Sink;  // so that the compiler can't drop the calls being timed.
+
+
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Data); ++Loop1UInt16) Data[Loop1UInt16] = test_random() >> 8;
+  Sink = util_crc16(Data, sizeof(Data));  // tables are generated out of the time measured.
+
+  TimeStamp = time_us_64();
+  for (Loop1UInt16 = 0; Loop1UInt16 < TEST_CRC_SPEED_COUNT; ++Loop1UInt16) Sink = util_crc16(Data, sizeof(Data));
+  EngineUSec = time_us_64() - TimeStamp;
+
+  TimeStamp = time_us_64();
+  for (Loop1UInt16 = 0; Loop1UInt16 < TEST_CRC_SPEED_COUNT; ++Loop1UInt16) Sink = test_crc16_reference(Data, sizeof(Data));
+  ReferenceUSec = time_us_64() - TimeStamp;
+  (void)Sink;
+
+  if (EngineUSec == 0)    EngineUSec    = 1;
+  if (ReferenceUSec == 0) ReferenceUSec = 1;
+
+  printf("info  crc16: engine %u, polynom 0x%4.4X: %.1f MB/s, bit-serial reference: %.1f MB/s (x%.1f)\n", CRC16_ENGINE, CRC16_POLYNOM,
+         (double)(TEST_CRC_SPEED_SIZE * TEST_CRC_SPEED_COUNT) / EngineUSec, (double)(TEST_CRC_SPEED_SIZE * TEST_CRC_SPEED_COUNT) / ReferenceUSec,
+         (double)ReferenceUSec / EngineUSec);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_kv() */
+/* ============================================================================================================================================================= *\
+                                                     Key-value store, string keys hashed to the same record ID.
+\* ============================================================================================================================================================= */
+static void test_kv(void)
+{
+  CHAR Name[2][16];
+
+  UINT8 Value[8];
+
+  UINT16 Hash[TEST_KV_NAMES];
+  UINT16 Loop1UInt16;
+  UINT16 Loop2UInt16;
+  UINT16 ValueSize;
+
+
+  /* Find two names hashed to the same record ID. */
+  Name[0][0] = '\0';
+  for (Loop1UInt16 = 0; (Loop1UInt16 < TEST_KV_NAMES) && (Name[0][0] == '\0'); ++Loop1UInt16)
+  {
+    sprintf(Name[1], "key%u", Loop1UInt16);
+    Hash[Loop1UInt16] = test_kv_hash(Name[1]);
+    for (Loop2UInt16 = 0; Loop2UInt16 < Loop1UInt16; ++Loop2UInt16)
+    {
+      if (Hash[Loop2UInt16] == Hash[Loop1UInt16])
+      {
+        sprintf(Name[0], "key%u", Loop2UInt16);
+        break;
+      }
+    }
+  }
+  test_check(Name[0][0] != '\0', "kv: two string keys hashed to the same record ID");
+  if (Name[0][0] == '\0') return;
+  printf("info  kv: <%s> and <%s> are both hashed to record ID 0x%4.4X\n", Name[0], Name[1], test_kv_hash(Name[0]));
+
+  test_check((flash_kv_set_str((UCHAR *)Name[0], (UINT8 *)"first", 6) == 0) && (flash_kv_set_str((UCHAR *)Name[1], (UINT8 *)"second", 7) == 0), "kv: both keys written");
+  ValueSize = sizeof(Value);
+  test_check((flash_kv_get_str((UCHAR *)Name[0], Value, &ValueSize) == 0) && (ValueSize == 6) && (strcmp((CHAR *)Value, "first") == 0), "kv: first key read back");
+  ValueSize = sizeof(Value);
+  test_check((flash_kv_get_str((UCHAR *)Name[1], Value, &ValueSize) == 0) && (ValueSize == 7) && (strcmp((CHAR *)Value, "second") == 0), "kv: second key read back");
+
+  /* Deleting the key at the hashed ID must not hide the other one, which must still be updated in place. */
+  test_check(flash_kv_delete_str((UCHAR *)Name[0]) == 0, "kv: first key deleted");
+  ValueSize = sizeof(Value);
+  test_check(flash_kv_get_str((UCHAR *)Name[0], Value, &ValueSize) != 0, "kv: first key not found after deletion");
+  test_check(flash_kv_set_str((UCHAR *)Name[1], (UINT8 *)"third", 6) == 0, "kv: second key updated after deletion of the first one");
+  ValueSize = sizeof(Value);
+  test_check((flash_kv_get_str((UCHAR *)Name[1], Value, &ValueSize) == 0) && (strcmp((CHAR *)Value, "third") == 0), "kv: second key read back after deletion of the first one");
+
+  /* Same results after a remount. */
+  test_check(flash_log_mount() == 0, "kv: remount");
+  ValueSize = sizeof(Value);
+  test_check((flash_kv_get_str((UCHAR *)Name[0], Value, &ValueSize) != 0) && (flash_kv_get_str((UCHAR *)Name[1], Value, &ValueSize) == 0) &&
+             (strcmp((CHAR *)Value, "third") == 0), "kv: keys found as before after a remount");
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_kv_hash() */
+/* ============================================================================================================================================================= *\
+                     Record ID given by the hash of a string key of the key-value store (same as flash_kv_key(), before probing the next IDs).
+\* ============================================================================================================================================================= */
+static UINT16 test_kv_hash(const CHAR *Name)
+{
+  UINT32 Hash;
+
+
+  Hash = 2166136261u;
+  while (*Name) Hash = (Hash ^ (UINT8)*Name++) * 16777619u;
+  Hash = (Hash >> 16) ^ Hash;
+
+  return (FLASH_KV_MAX_KEY + 1) + (Hash % (FLASH_LOG_CHECKPOINT_ID - (FLASH_KV_MAX_KEY + 1)));
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_log() */
+/* ============================================================================================================================================================= *\
+                                                                    Log-structured record store.
+        NOTE: flash_log_mount() rebuilds the RAM index from flash only, so calling it again is what happens after a reset.
+\* ============================================================================================================================================================= */
+static void test_log(void)
+{
+  struct flash_stats Stats;
+
+  UINT8 Big[TEST_LOG_BIG_SIZE];
+  UINT8 Data[16];
+  UINT8 FlagPassed;
+
+  UINT16 DataSize;
+  UINT16 Loop1UInt16;
+  UINT16 Version;
+
+
+  /* Blank ring. */
+  test_check(flash_log_mount() == 0, "log: mount of a blank ring");
+  test_check(flash_log_read(1, Data, sizeof(Data)) != 0, "log: record never written is not found");
+
+  /* Append and read back. */
+  FlagPassed = FLAG_ON;
+  for (Loop1UInt16 = 1; Loop1UInt16 <= TEST_LOG_RECORDS; ++Loop1UInt16)
+  {
+    memset(Data, Loop1UInt16, sizeof(Data));
+    if (flash_log_write(Loop1UInt16, Data, sizeof(Data))) FlagPassed = FLAG_OFF;
+  }
+  test_check(FlagPassed, "log: append of new records");
+  test_check(test_log_verify(0), "log: records read back");
+  test_check((flash_log_locate(2, &DataSize) != NULL) && (DataSize == sizeof(Data)), "log: locate returns the size of a record");
+
+  /* Remount (no checkpoint yet, every record is replayed). */
+  test_check((flash_log_mount() == 0) && test_log_verify(0), "log: records found again after a remount");
+
+  /* Tombstone. */
+  test_check(flash_log_delete(TEST_LOG_DELETED) == 0, "log: delete a record");
+  test_check(flash_log_read(TEST_LOG_DELETED, Data, sizeof(Data)) != 0, "log: deleted record is not found");
+  test_check(flash_log_delete(TEST_LOG_DELETED) == 0, "log: delete a record already deleted");
+  test_check((flash_log_mount() == 0) && (flash_log_read(TEST_LOG_DELETED, Data, sizeof(Data)) != 0), "log: deleted record is not found after a remount");
+
+  /* Rewrite a big record and the small ones until every sector of the ring has been reclaimed several times. */
+  memset(Big, 0xA5, sizeof(Big));
+  FlagPassed = FLAG_ON;
+  for (Version = 1; Version <= 100; ++Version)
+  {
+    Big[0] = Version;
+    if (flash_log_write(TEST_LOG_RECORDS + 1, Big, sizeof(Big))) FlagPassed = FLAG_OFF;
+    for (Loop1UInt16 = 1; Loop1UInt16 <= TEST_LOG_RECORDS; ++Loop1UInt16)
+    {
+      if ((Loop1UInt16 == TEST_LOG_DELETED) || (Version % Loop1UInt16)) continue;
+      memset(Data, Loop1UInt16, sizeof(Data));
+      Data[0] = Version / Loop1UInt16;
+      if (flash_log_write(Loop1UInt16, Data, sizeof(Data))) FlagPassed = FLAG_OFF;
+    }
+  }
+  test_check(FlagPassed, "log: append while the ring wraps around");
+  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_LOG_SECTORS; ++Loop1UInt16)
+    if (flash_log_erase_count(Loop1UInt16) < 2) FlagPassed = FLAG_OFF;
+  test_check(FlagPassed, "log: every sector of the ring has been reclaimed");
+  test_check(test_log_verify(Version - 1), "log: live records kept through reclaims");
+  test_check(flash_log_read(TEST_LOG_DELETED, Data, sizeof(Data)) != 0, "log: deleted record is not found after reclaims");
+
+  /* Remount from the latest checkpoint. */
+  test_check(flash_log_mount() == 0, "log: remount after reclaims");
+  flash_get_stats(&Stats);
+  test_check(Stats.LogReplayed < Stats.LogRecords + FLASH_LOG_CHECKPOINT_INTERVAL, "log: remount replays only records more recent than the checkpoint");
+  test_check(test_log_verify(Version - 1), "log: live records found again after a remount");
+  test_check(flash_log_read(TEST_LOG_DELETED, Data, sizeof(Data)) != 0, "log: deleted record is not found after reclaims and a remount");
+
+  /* A deleted record may be written again. */
+  memset(Data, TEST_LOG_DELETED, sizeof(Data));
+  test_check((flash_log_write(TEST_LOG_DELETED, Data, sizeof(Data)) == 0) && (flash_log_mount() == 0) && (flash_log_read(TEST_LOG_DELETED, Data, sizeof(Data)) == 0) &&
+             (Data[0] == TEST_LOG_DELETED), "log: deleted record written again");
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_log_verify() */
+/* ============================================================================================================================================================= *\
+                                      Check that the live records of the log-structured record store hold their expected version.
+          NOTE: Version 0 is the first version of the small records. After the fill loop of test_log(), Version is the last version of the big record.
+\* ============================================================================================================================================================= */
+static UINT8 test_log_verify(UINT16 Version)
+{
+  UINT8 Big[TEST_LOG_BIG_SIZE];
+  UINT8 Data[16];
+  UINT8 Expected[16];
+
+  UINT16 Loop1UInt16;
+
+
+  for (Loop1UInt16 = 1; Loop1UInt16 <= TEST_LOG_RECORDS; ++Loop1UInt16)
+  {
+    if ((Loop1UInt16 == TEST_LOG_DELETED) && Version) continue;
+
+    memset(Expected, Loop1UInt16, sizeof(Expected));
+    if (Version) Expected[0] = Version / Loop1UInt16;
+    if (flash_log_read(Loop1UInt16, Data, sizeof(Data)) || memcmp(Data, Expected, sizeof(Data))) return FALSE;
+  }
+
+  if (Version)
+  {
+    if (flash_log_read(TEST_LOG_RECORDS + 1, Big, sizeof(Big)) || (Big[0] != (Version & 0xFF)) || (Big[sizeof(Big) - 1] != 0xA5)) return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_random() */
+/* ============================================================================================================================================================= *\
+                                             Return the next value of the pseudo-random sequence (same sequence on every run).
+\* ============================================================================================================================================================= */
+static UINT32 test_random(void)
+{
+  TestRandom = (TestRandom * 1103515245) + 12345;
+
+  return (TestRandom >> 8);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_read() */
+/* ============================================================================================================================================================= *\
+                                                                             Read path.
+\* ============================================================================================================================================================= */
+static void test_read(void)
+{
+  struct flash_stats Stats;
+
+  UINT8 Data[TEST_READ_SIZE];
+  UINT8 Expected[TEST_READ_SIZE];
+  UINT8 FlagPassed;
+  UINT8 Range[300];
+
+  UINT16 Loop1UInt16;
+
+  UINT32 Offset;
+
+
+  test_check(flash_read_data(TEST_READ_OFFSET, Data, sizeof(Data)) != 0, "read: blank sector is rejected");
+
+  for (Loop1UInt16 = 0; Loop1UInt16 < sizeof(Expected); ++Loop1UInt16) Expected[Loop1UInt16] = test_random() >> 8;
+  memcpy(Data, Expected, sizeof(Data));
+  test_check(flash_save_data(TEST_READ_OFFSET, Data, sizeof(Data)) == FLASH_SAVE_WRITTEN, "read: save data");
+  test_check(flash_save_data(TEST_READ_OFFSET, Data, sizeof(Data)) == FLASH_SAVE_SKIPPED, "read: saving the same data again writes nothing");
+  memcpy(Expected, Data, sizeof(Expected));  // CRC16 inserted by flash_save_data().
+
+  memset(Data, 0, sizeof(Data));
+  test_check((flash_read_data(TEST_READ_OFFSET, Data, sizeof(Data)) == 0) && (memcmp(Data, Expected, sizeof(Data)) == 0), "read: data read back as saved");
+  test_check(flash_verify_crc(TEST_READ_OFFSET + FLASH_PAYLOAD_OFFSET, sizeof(Data)) == 0, "read: flash_verify_crc() accepts data saved by flash_save_data()");
+  test_check(flash_extract_crc(Data, sizeof(Data)) == util_crc16(Data, sizeof(Data) - 2), "read: flash_extract_crc() returns the CRC16 saved");
+
+  /* Byte-addressable reads, at any offset and size (including across the end of data). */
+  FlagPassed = FLAG_ON;
+  for (Offset = 0; Offset < (sizeof(Data) + 50); Offset += 37)
+  {
+    if (flash_read_range(TEST_READ_OFFSET + Offset, Range, sizeof(Range))) FlagPassed = FLAG_OFF;
+    if (memcmp(Range, (UINT8 *)(XIP_BASE + TEST_READ_OFFSET + Offset), sizeof(Range))) FlagPassed = FLAG_OFF;
+  }
+  test_check(FlagPassed, "read: flash_read_range() at any offset");
+
+  /* Flip one bit of data in flash. */
+  Data[100] ^= 0x10;
+  flash_write_range(TEST_READ_OFFSET + FLASH_PAYLOAD_OFFSET + 100, &Data[100], 1);
+  test_check(flash_read_data(TEST_READ_OFFSET, Data, sizeof(Data)) != 0, "read: corrupted data is rejected");
+  flash_get_stats(&Stats);
+  test_check((Stats.ScratchHighWater == FLASH_SECTOR_SIZE) && (Stats.ScratchBusy == 0), "read: scratch buffer high-water is one sector (no nested request)");
+
+  /* Ranges outside of the area that may be written. */
+  test_check(flash_write_range(FLASH_WRITE_RANGE_MIN - FLASH_SECTOR_SIZE, Data, 1) != 0, "read: flash_write_range() below FLASH_WRITE_RANGE_MIN is rejected");
+  test_check(flash_write_range(PICO_FLASH_SIZE_BYTES, Data, 0) != 0, "read: flash_write_range() at the end of flash is rejected");
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_wear() */
+/* ============================================================================================================================================================= *\
+                                                   Wear leveling of the log-structured record store over many saves.
+        NOTES: The ring is used in order, so that every sector is erased in turn whatever records are written: erase counts may differ by one at most.
+               Erases are counted both by the record store and by the emulated flash, which must agree (no erase is done outside of the ring).
+\* ============================================================================================================================================================= */
+static void test_wear(UINT32 Saves)
+{
+  CHAR Description[80];
+
+  UINT8 Data[TEST_WEAR_COLD_SIZE];
+  UINT8 FlagPassed;
+
+  UINT16 Loop1UInt16;
+
+  UINT32 EraseCount;
+  UINT32 Loop1UInt32;
+  UINT32 MaxErase;
+  UINT32 MinErase;
+  UINT32 TotalErase;
+
+
+  printf("Wear leveling over %lu saves\n", (unsigned long)Saves);
+  test_check(flash_log_mount() == 0, "wear: mount of a blank ring");
+
+  /* Cold records are written once, then moved each time their sector is reclaimed. */
+  FlagPassed = FLAG_ON;
+  for (Loop1UInt16 = 0; Loop1UInt16 < TEST_WEAR_COLD; ++Loop1UInt16)
+  {
+    memset(Data, 100 + Loop1UInt16, sizeof(Data));
+    if (flash_log_write(100 + Loop1UInt16, Data, TEST_WEAR_COLD_SIZE)) FlagPassed = FLAG_OFF;
+  }
+
+  /* Hot records are rewritten in turn, each one holds the number of the save that wrote it. */
+  for (Loop1UInt32 = 0; Loop1UInt32 < Saves; ++Loop1UInt32)
+  {
+    memset(Data, 0, TEST_WEAR_HOT_SIZE);
+    memcpy(Data, &Loop1UInt32, sizeof(Loop1UInt32));
+    if (flash_log_write(1 + (Loop1UInt32 % TEST_WEAR_HOT), Data, TEST_WEAR_HOT_SIZE)) FlagPassed = FLAG_OFF;
+  }
+  test_check(FlagPassed, "wear: every save succeeded");
+
+  /* Erase count of each ring sector. */
+  printf("sector,offset,log_erases,flash_erases\n");
+  MaxErase   = 0;
+  MinErase   = 0xFFFFFFFF;
+  TotalErase = 0;
+  FlagPassed = FLAG_ON;
+  for (Loop1UInt16 = 0; Loop1UInt16 < FLASH_LOG_SECTORS; ++Loop1UInt16)
+  {
+    EraseCount = flash_log_erase_count(Loop1UInt16);
+    printf("%u,0x%6.6X,%lu,%lu\n", Loop1UInt16, FLASH_DATA_OFFSET1 - (Loop1UInt16 * FLASH_SECTOR_SIZE), (unsigned long)EraseCount,
+           (unsigned long)host_flash_erase_count((FLASH_DATA_OFFSET1 / FLASH_SECTOR_SIZE) - Loop1UInt16));
+
+    if (EraseCount != host_flash_erase_count((FLASH_DATA_OFFSET1 / FLASH_SECTOR_SIZE) - Loop1UInt16)) FlagPassed = FLAG_OFF;
+    if (EraseCount > MaxErase) MaxErase = EraseCount;
+    if (EraseCount < MinErase) MinErase = EraseCount;
+    TotalErase += EraseCount;
+  }
+  printf("info  wear: %lu erases, %.1f saves per erase, highest erase count %lu (%.2f%% of %u cycles)\n", (unsigned long)TotalErase,
+         TotalErase ? ((double)Saves / TotalErase) : 0.0, (unsigned long)MaxErase, (100.0 * MaxErase) / FLASH_WEAR_ENDURANCE, FLASH_WEAR_ENDURANCE);
+  test_check(FlagPassed, "wear: erases counted by the record store are the physical erases");
+  snprintf(Description, sizeof(Description), "wear: erase counts of ring sectors are within one erase (%lu to %lu)", (unsigned long)MinErase, (unsigned long)MaxErase);
+  test_check((MaxErase - MinErase) <= 1, Description);
+
+  /* Nothing lost, after a remount. */
+  FlagPassed = (flash_log_mount() == 0);
+  for (Loop1UInt16 = 0; Loop1UInt16 < TEST_WEAR_COLD; ++Loop1UInt16)
+  {
+    if (flash_log_read(100 + Loop1UInt16, Data, TEST_WEAR_COLD_SIZE) || (Data[0] != (UINT8)(100 + Loop1UInt16)) || (Data[TEST_WEAR_COLD_SIZE - 1] != Data[0]))
+      FlagPassed = FLAG_OFF;
+  }
+  for (Loop1UInt32 = ((Saves > TEST_WEAR_HOT) ? (Saves - TEST_WEAR_HOT) : 0); Loop1UInt32 < Saves; ++Loop1UInt32)
+  {
+    if (flash_log_read(1 + (Loop1UInt32 % TEST_WEAR_HOT), Data, TEST_WEAR_HOT_SIZE) || memcmp(Data, &Loop1UInt32, sizeof(Loop1UInt32))) FlagPassed = FLAG_OFF;
+  }
+  test_check(FlagPassed, "wear: latest version of every record found after a remount");
+
+  return;
+}
@@ -0,0 +1,541 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Tool.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Host companion of flash_xfer_serve() in Pico-Flash-Module. Exports a flash range of the Pico to a binary file, or imports a binary file to a flash range,
+            using the framed binary transfer (chunked, CRC16-checked, with windowed acknowledges) described with FLASH_XFER_xxx in Pico-Flash-Xfer.h.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host (this file is not part of the Pico firmware):   gcc -O2 -I. -o pico-flash-tool Pico-Flash-Tool.c
+
+      Select "Binary transfer with host tool" in the menu of Pico-Flash-Example (or call flash_xfer_serve() from your own firmware), close the terminal
+      emulator, then within the time-out:
+            pico-flash-tool /dev/ttyACM0 export 0x1F6000 0xA000 sectors.bin
+            pico-flash-tool /dev/ttyACM0 import 0x1FF000 sector.bin
+
+      Device may be a serial port (set to raw mode), a pseudo-terminal, or "-" to use stdin / stdout (for example with a pipe-based stand-in of the Pico).
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "baseline.h"
+#include "Pico-Flash-Xfer.h"  // binary transfer protocol, shared with Pico-Flash-Module.
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+/* Maximum size of an image (whole flash of the Pico). */
+#define IMAGE_MAX_SIZE          0x200000
+
+static INT    DeviceIn;                                   // file descriptor to read from the device.
+static INT    DeviceOut;                                  // file descriptor to write to the device.
+static UINT16 Crc16Table[256];
+static UINT8  Payload[FLASH_XFER_CHUNK_SIZE];             // payload of the frame being received.
+static UINT8  Image[IMAGE_MAX_SIZE];
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Update a CRC16 with a chunk of data (same CRC16 as util_crc16() on the Pico). */
+static UINT16 crc16_update(UINT16 CrcValue, const UINT8 *Data, UINT32 DataSize);
+
+/* Receive a flash range from the Pico. */
+static INT do_export(UINT32 DataOffset, UINT32 DataSize, const CHAR *FileName);
+
+/* Send an image to a flash range of the Pico. */
+static INT do_import(UINT32 DataOffset, const CHAR *FileName);
+
+/* Receive a frame from the Pico. */
+static INT frame_receive(UINT8 *Type, UINT8 *Sequence, UINT16 *Length, INT TimeoutMSec);
+
+/* Send a frame to the Pico. */
+static void frame_send(UINT8 Type, UINT8 Sequence, const UINT8 *Data, UINT16 Length);
+
+/* Send the transfer request and wait until it is accepted by the Pico. */
+static INT request_send(UINT8 Type, UINT32 DataOffset, UINT32 DataSize);
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(INT argc, CHAR *argv[])
+{
+  struct termios Termios;
+
+  UINT16 Loop1UInt16;
+  UINT16 Crc16;
+
+  UINT8 Loop1UInt8;
+
+
+  if ((argc < 5) || ((strcmp(argv[2], "export") == 0) && (argc < 6)))
+  {
+    fprintf(stderr, "Usage: %s <device> export <offset> <length> <file>\n", argv[0]);
+    fprintf(stderr, "       %s <device> import <offset> <file>\n", argv[0]);
+    fprintf(stderr, "       <device> may be \"-\" to use stdin / stdout.\n");
+    return 2;
+  }
+
+  /* Generate CRC16 lookup table. */
+  for (Loop1UInt16 = 0; Loop1UInt16 < 256; ++Loop1UInt16)
+  {
+    Crc16 = Loop1UInt16 << 8;
+    for (Loop1UInt8 = 0; Loop1UInt8 < 8; ++Loop1UInt8)
+      Crc16 = (Crc16 & 0x8000) ? ((Crc16 << 1) ^ CRC16_POLYNOM) : (Crc16 << 1);
+    Crc16Table[Loop1UInt16] = Crc16;
+  }
+
+  if (strcmp(argv[1], "-") == 0)
+  {
+    DeviceIn  = STDIN_FILENO;
+    DeviceOut = STDOUT_FILENO;
+  }
+  else
+  {
+    DeviceIn = DeviceOut = open(argv[1], O_RDWR | O_NOCTTY);
+    if (DeviceIn < 0)
+    {
+      fprintf(stderr, "Can't open %s: %s\n", argv[1], strerror(errno));
+      return 1;
+    }
+
+    /* Serial port or pseudo-terminal: raw mode, no echo nor character translation. */
+    if (isatty(DeviceIn) && (tcgetattr(DeviceIn, &Termios) == 0))
+    {
+      cfmakeraw(&Termios);
+      tcsetattr(DeviceIn, TCSANOW, &Termios);
+      tcflush(DeviceIn, TCIOFLUSH);
+    }
+  }
+
+  if (strcmp(argv[2], "export") == 0) return do_export(strtoul(argv[3], NULL, 0), strtoul(argv[4], NULL, 0), argv[5]);
+  if (strcmp(argv[2], "import") == 0) return do_import(strtoul(argv[3], NULL, 0), argv[4]);
+
+  fprintf(stderr, "Unknown command: %s\n", argv[2]);
+
+  return 2;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=crc16_update() */
+/* ============================================================================================================================================================= *\
+                                                   Update a CRC16 with a chunk of data (same CRC16 as util_crc16() on the Pico).
+\* ============================================================================================================================================================= */
+static UINT16 crc16_update(UINT16 CrcValue, const UINT8 *Data, UINT32 DataSize)
+{
+  while (DataSize-- > 0)
+    CrcValue = (CrcValue << 8) ^ Crc16Table[((CrcValue >> 8) ^ *Data++) & 0xFF];
+
+  return CrcValue;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=do_export() */
+/* ============================================================================================================================================================= *\
+                                                                 Receive a flash range from the Pico.
+\* ============================================================================================================================================================= */
+static INT do_export(UINT32 DataOffset, UINT32 DataSize, const CHAR *FileName)
+{
+  FILE *File;
+
+  UINT8 FlagNak;
+  UINT8 Retry;
+  UINT8 Sequence;
+  UINT8 Status[3];
+  UINT8 Type;
+
+  UINT16 Crc16;
+  UINT16 Length;
+
+  UINT32 Expected;
+  UINT32 Received;
+
+
+  if ((DataSize == 0) || (DataSize > IMAGE_MAX_SIZE)) return 2;
+  if (request_send(FLASH_XFER_READ, DataOffset, DataSize)) return 1;
+
+  Expected = 1;
+  Received = 0;
+  FlagNak  = FALSE;
+  Retry    = 0;
+
+  while (1)
+  {
+    switch (frame_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 2))
+    {
+      case (0):
+        Retry = 0;
+
+        if (Sequence != (UINT8)Expected)
+        {
+          /* Frame already received (acknowledge lost), or frames missing. */
+          if ((UINT8)(Expected - Sequence) <= FLASH_XFER_WINDOW)
+            frame_send(FLASH_XFER_ACK, Expected - 1, NULL, 0);
+          else if (!FlagNak)
+          {
+            frame_send(FLASH_XFER_NAK, Expected, NULL, 0);
+            FlagNak = TRUE;
+          }
+          break;
+        }
+
+        if ((Type == FLASH_XFER_DATA) && (Length <= (DataSize - Received)))
+        {
+          memcpy(&Image[Received], Payload, Length);
+          Received += Length;
+          frame_send(FLASH_XFER_ACK, Sequence, NULL, 0);
+          ++Expected;
+          FlagNak = FALSE;
+          break;
+        }
+
+        if (Type == FLASH_XFER_END)
+        {
+          Crc16     = crc16_update(0, Image, Received);
+          Status[0] = Crc16 & 0xFF;
+          Status[1] = Crc16 >> 8;
+          Status[2] = ((Received != DataSize) || (Length < 3) || (Payload[0] != Status[0]) || (Payload[1] != Status[1]) || Payload[2]);
+
+          /* Answer the END frame until the Pico stops sending it. */
+          do
+          {
+            frame_send(FLASH_XFER_END, Sequence, Status, sizeof(Status));
+          } while (frame_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 2) != 1);
+
+          if (Status[2])
+          {
+            fprintf(stderr, "Export failed (%u of %u bytes received, CRC16 0x%4.4X).\n", Received, DataSize, Crc16);
+            return 1;
+          }
+
+          File = fopen(FileName, "wb");
+          if ((File == NULL) || (fwrite(Image, 1, DataSize, File) != DataSize))
+          {
+            fprintf(stderr, "Can't write %s: %s\n", FileName, strerror(errno));
+            return 1;
+          }
+          fclose(File);
+          fprintf(stderr, "Exported %u bytes from offset 0x%6.6X to %s (CRC16 0x%4.4X).\n", DataSize, DataOffset, FileName, Crc16);
+
+          return 0;
+        }
+      break;
+
+      case (1):
+        if (++Retry > FLASH_XFER_RETRY_MAX)
+        {
+          fprintf(stderr, "No answer from the Pico.\n");
+          return 1;
+        }
+      break;
+    }
+  }
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=do_import() */
+/* ============================================================================================================================================================= *\
+                                                                Send an image to a flash range of the Pico.
+\* ============================================================================================================================================================= */
+static INT do_import(UINT32 DataOffset, const CHAR *FileName)
+{
+  FILE *File;
+
+  UINT8 Retry;
+  UINT8 Sequence;
+  UINT8 Status[3];
+  UINT8 Type;
+
+  UINT16 Crc16;
+  UINT16 Length;
+
+  UINT32 Base;
+  UINT32 DataSize;
+  UINT32 Frame;
+  UINT32 FrameCount;
+  UINT32 Next;
+
+
+  File = fopen(FileName, "rb");
+  if (File == NULL)
+  {
+    fprintf(stderr, "Can't open %s: %s\n", FileName, strerror(errno));
+    return 1;
+  }
+  DataSize = fread(Image, 1, IMAGE_MAX_SIZE, File);
+  fclose(File);
+  if (DataSize == 0) return 2;
+
+  if (request_send(FLASH_XFER_WRITE, DataOffset, DataSize)) return 1;
+
+  Crc16      = crc16_update(0, Image, DataSize);
+  Status[0]  = Crc16 & 0xFF;
+  Status[1]  = Crc16 >> 8;
+  Status[2]  = 0;
+  FrameCount = (DataSize + FLASH_XFER_CHUNK_SIZE - 1) / FLASH_XFER_CHUNK_SIZE;
+  Base       = 1;
+  Next       = 1;
+  Retry      = 0;
+
+  /* Same sliding window as flash_xfer_export() on the Pico. Last frame (FrameCount + 1) is the END frame. */
+  while (Base <= (FrameCount + 1))
+  {
+    for (; (Next <= (FrameCount + 1)) && (Next < (Base + FLASH_XFER_WINDOW)); ++Next)
+    {
+      if (Next <= FrameCount)
+      {
+        Length = ((DataSize - ((Next - 1) * FLASH_XFER_CHUNK_SIZE)) < FLASH_XFER_CHUNK_SIZE) ? (DataSize - ((Next - 1) * FLASH_XFER_CHUNK_SIZE)) : FLASH_XFER_CHUNK_SIZE;
+        frame_send(FLASH_XFER_DATA, Next, &Image[(Next - 1) * FLASH_XFER_CHUNK_SIZE], Length);
+      }
+      else
+        frame_send(FLASH_XFER_END, Next, Status, sizeof(Status));
+    }
+
+    switch (frame_receive(&Type, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC * 2))
+    {
+      case (0):
+        Frame = Base + (UINT8)(Sequence - (UINT8)Base);
+        if (Frame >= Next) break;
+        Retry = 0;
+
+        if ((Type == FLASH_XFER_END) && (Frame == (FrameCount + 1)))
+        {
+          if ((Length < 3) || Payload[2])
+          {
+            fprintf(stderr, "Import failed, flash content doesn't match the image.\n");
+            return 1;
+          }
+          fprintf(stderr, "Imported %u bytes from %s to offset 0x%6.6X (CRC16 0x%4.4X).\n", DataSize, FileName, DataOffset, Crc16);
+
+          return 0;
+        }
+        if (Type == FLASH_XFER_ACK) Base = Frame + 1;
+        if (Type == FLASH_XFER_NAK) Next = Base = Frame;
+      break;
+
+      case (1):
+        /* Erasing a sector may take a while on the Pico, give it more time before giving up. */
+        if (++Retry > FLASH_XFER_RETRY_MAX)
+        {
+          fprintf(stderr, "No answer from the Pico.\n");
+          return 1;
+        }
+        Next = Base;
+      break;
+    }
+  }
+
+  return 1;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=frame_receive() */
+/* ============================================================================================================================================================= *\
+                                                                     Receive a frame from the Pico.
+                  NOTE: Returns 0 if a valid frame has been received, 1 on time-out, 2 if the frame is not valid. Payload is returned in Payload[].
+\* ============================================================================================================================================================= */
+static INT frame_receive(UINT8 *Type, UINT8 *Sequence, UINT16 *Length, INT TimeoutMSec)
+{
+  static UINT8 Buffer[4096];
+  static INT   BufferHead;
+  static INT   BufferSize;
+
+  struct pollfd Poll;
+
+  UINT8 Frame[FLASH_XFER_CHUNK_SIZE + 6];
+
+  INT Count;
+  INT Needed;
+  INT Size;
+
+
+  Size   = 0;
+  Needed = 1;
+
+  while (Size < Needed)
+  {
+    /* Refill input buffer from the device. */
+    if (BufferHead == BufferSize)
+    {
+      Poll.fd     = DeviceIn;
+      Poll.events = POLLIN;
+      if (poll(&Poll, 1, TimeoutMSec) <= 0) return 1;
+
+      Count = read(DeviceIn, Buffer, sizeof(Buffer));
+      if (Count <= 0) return 1;
+      BufferHead = 0;
+      BufferSize = Count;
+    }
+
+    Frame[Size] = Buffer[BufferHead++];
+
+    /* Wait for start of frame, then header, then payload and CRC16. */
+    if ((Size == 0) && (Frame[0] != FLASH_XFER_SOF)) continue;
+    ++Size;
+    if (Size == 5)
+    {
+      *Length = Frame[3] | (Frame[4] << 8);
+      if (*Length > FLASH_XFER_CHUNK_SIZE) return 2;
+      Needed = 5 + *Length + 2;
+    }
+    else if (Size == 1)
+      Needed = 5;
+  }
+
+  *Type     = Frame[1];
+  *Sequence = Frame[2];
+  memcpy(Payload, &Frame[5], *Length);
+
+  return ((crc16_update(0, &Frame[1], 4 + *Length) == (Frame[5 + *Length] | (Frame[6 + *Length] << 8))) ? 0 : 2);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=frame_send() */
+/* ============================================================================================================================================================= *\
+                                                                       Send a frame to the Pico.
+\* ============================================================================================================================================================= */
+static void frame_send(UINT8 Type, UINT8 Sequence, const UINT8 *Data, UINT16 Length)
+{
+  UINT8 Frame[FLASH_XFER_CHUNK_SIZE + 7];
+
+  UINT16 Crc16;
+
+  INT Count;
+  INT Sent;
+
+
+  Frame[0] = FLASH_XFER_SOF;
+  Frame[1] = Type;
+  Frame[2] = Sequence;
+  Frame[3] = Length & 0xFF;
+  Frame[4] = Length >> 8;
+  if (Length) memcpy(&Frame[5], Data, Length);
+  Crc16 = crc16_update(0, &Frame[1], 4 + Length);
+  Frame[5 + Length] = Crc16 & 0xFF;
+  Frame[6 + Length] = Crc16 >> 8;
+
+  /* The whole frame is written at once, so that it is sent in as few USB packets as possible. */
+  for (Sent = 0; Sent < (7 + Length); Sent += Count)
+  {
+    Count = write(DeviceOut, &Frame[Sent], 7 + Length - Sent);
+    if (Count < 0)
+    {
+      if (errno == EINTR) Count = 0;
+      else return;
+    }
+  }
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=request_send() */
+/* ============================================================================================================================================================= *\
+                                                     Send the transfer request and wait until it is accepted by the Pico.
+                  NOTE: The Pico may begin sending data frames right away if its acknowledge has been lost; this also means the request has been accepted.
+\* ============================================================================================================================================================= */
+static INT request_send(UINT8 Type, UINT32 DataOffset, UINT32 DataSize)
+{
+  UINT8 Request[8];
+  UINT8 Retry;
+  UINT8 Sequence;
+  UINT8 Answer;
+
+  UINT16 Length;
+
+
+  Request[0] = DataOffset & 0xFF;
+  Request[1] = (DataOffset >> 8) & 0xFF;
+  Request[2] = (DataOffset >> 16) & 0xFF;
+  Request[3] = DataOffset >> 24;
+  Request[4] = DataSize & 0xFF;
+  Request[5] = (DataSize >> 8) & 0xFF;
+  Request[6] = (DataSize >> 16) & 0xFF;
+  Request[7] = DataSize >> 24;
+
+  for (Retry = 0; Retry < FLASH_XFER_RETRY_MAX; ++Retry)
+  {
+    frame_send(Type, 0, Request, sizeof(Request));
+
+    while (frame_receive(&Answer, &Sequence, &Length, FLASH_XFER_TIMEOUT_MSEC) != 1)
+    {
+      if ((Answer == FLASH_XFER_ACK) && (Sequence == 0)) return 0;
+
+      if ((Answer == FLASH_XFER_END) && (Sequence == 0))
+      {
+        fprintf(stderr, "Request refused by the Pico (range 0x%6.6X + 0x%X is outside of flash).\n", DataOffset, DataSize);
+        return 1;
+      }
+
+      /* First data frame of an export: the acknowledge has been lost. Ask for it again with a NAK. */
+      if ((Answer == FLASH_XFER_DATA) && (Type == FLASH_XFER_READ))
+      {
+        frame_send(FLASH_XFER_NAK, 1, NULL, 0);
+        return 0;
+      }
+    }
+  }
+
+  fprintf(stderr, "No answer from the Pico.\n");
+
+  return 1;
+}
@@ -0,0 +1,267 @@
+/* ================================================================================================================================================================= *\
+   Pico-Flash-Xfer-Test.c
+   Langage: Linux gcc
+   Version 1.00
+
+   REVISION HISTORY:
+   =================
+   1.00 - Initial release.
+\* ================================================================================================================================================================= */
+
+
+/* ================================================================================================================================================================= *\
+        Host test of the binary transfer: flash_xfer_serve() of Pico-Flash-Module, over the emulated flash of Pico-Flash-Host.c, against the real host tool
+        (Pico-Flash-Tool.c). The tool is started with device "-" on one end of a socket pair, while stdin / stdout of flash_xfer_serve() are redirected to
+        the other end. Each check prints one line, and the exit status is 1 if any check failed.
+            export - a pattern written to flash (XFER_TEST_SIZE bytes, not a multiple of the chunk size) is exported to a file, which must match flash.
+            import - the file is modified and imported back to the same range, flash must then match the file.
+
+                                                                            HOW TO USE
+                                                                         ================
+      Build on the host:   cmake -S . -B build-host -DPICO_FLASH_HOST=ON && cmake --build build-host
+
+            ctest --test-dir build-host -R xfer -V
+            build-host/pico-flash-xfer-test build-host/pico-flash-tool
+\* ================================================================================================================================================================= */
+
+
+
+/* $TITLE=Included files. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                           Include files.
+\* ================================================================================================================================================================= */
+#include "Pico-Flash-Module.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+
+/* $TITLE=Global variables and definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                     Global variables and defines.
+\* ================================================================================================================================================================= */
+#define XFER_TEST_OFFSET        FLASH_BENCH_OFFSET  // flash range exported and imported (above FLASH_WRITE_RANGE_MIN).
+#define XFER_TEST_SIZE          ((3 * FLASH_SECTOR_SIZE) + 100)  // size of the range (ends in the middle of a chunk and of a sector).
+#define XFER_TEST_TIMEOUT_MSEC  10000  // time given to the host tool to send its request.
+
+static UINT16 TestChecks;
+static UINT16 TestFailures;
+
+
+
+/* $TITLE=Function definitions. */
+/* $PAGE */
+/* ================================================================================================================================================================= *\
+                                                                       Function definitions.
+\* ================================================================================================================================================================= */
+/* Count a check and print its result. */
+static void test_check(UINT8 FlagPassed, const CHAR *Description);
+
+/* Read a file, return the number of bytes read. */
+static UINT32 test_file_read(const CHAR *FileName, UINT8 *Data, UINT32 DataSize);
+
+/* Run the host tool against flash_xfer_serve(), return TRUE if both sides report success. */
+static UINT8 test_xfer(CHAR *ToolArgv[]);
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=Main program entry point. */
+/* ============================================================================================================================================================= *\
+                                                                          Main program entry point.
+\* ============================================================================================================================================================= */
+INT main(INT argc, CHAR *argv[])
+{
+  struct host_flash_config Config;
+
+  CHAR  FileName[] = "/tmp/pico-flash-xfer-XXXXXX";
+  CHAR  Offset[16];
+  CHAR  Size[16];
+  CHAR *ToolArgv[7];
+
+  UINT8  Data[XFER_TEST_SIZE];
+  UINT8  FlagDone;
+  UINT8  Image[XFER_TEST_SIZE + 1];
+
+  INT    File;
+
+  UINT32 Loop1UInt32;
+
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <path of pico-flash-tool>\n", argv[0]);
+    return 2;
+  }
+
+  /* Emulated flash without time model: time-outs of the transfer are in real time, on both sides. */
+  memset(&Config, 0, sizeof(Config));
+  File = mkstemp(FileName);
+  if ((File < 0) || host_flash_init(&Config))
+  {
+    fprintf(stderr, "Can't initialize emulated flash.\n");
+    return 1;
+  }
+  close(File);
+
+  for (Loop1UInt32 = 0; Loop1UInt32 < XFER_TEST_SIZE; ++Loop1UInt32)
+    Data[Loop1UInt32] = (UINT8)((Loop1UInt32 * 7) + (Loop1UInt32 >> 8));
+  if (flash_write_range(XFER_TEST_OFFSET, Data, XFER_TEST_SIZE))
+  {
+    fprintf(stderr, "Can't write test pattern to flash.\n");
+    return 1;
+  }
+
+  snprintf(Offset, sizeof(Offset), "0x%X", XFER_TEST_OFFSET);
+  snprintf(Size,   sizeof(Size),   "0x%X", XFER_TEST_SIZE);
+
+  /* Export of the pattern to a file. */
+  ToolArgv[0] = argv[1];
+  ToolArgv[1] = "-";
+  ToolArgv[2] = "export";
+  ToolArgv[3] = Offset;
+  ToolArgv[4] = Size;
+  ToolArgv[5] = FileName;
+  ToolArgv[6] = NULL;
+  FlagDone = test_xfer(ToolArgv);
+  test_check(FlagDone, "export: flash_xfer_serve() and pico-flash-tool both report success");
+  test_check(FlagDone && (test_file_read(FileName, Image, sizeof(Image)) == XFER_TEST_SIZE) && (memcmp(Image, (UINT8 *)(XIP_BASE + XFER_TEST_OFFSET), XFER_TEST_SIZE) == 0),
+             "export: exported file matches flash content");
+
+  /* Import of the modified file to the same range. */
+  for (Loop1UInt32 = 0; Loop1UInt32 < XFER_TEST_SIZE; ++Loop1UInt32)
+    Data[Loop1UInt32] ^= 0x5A;
+  File = open(FileName, O_WRONLY | O_TRUNC);
+  if ((File < 0) || (write(File, Data, XFER_TEST_SIZE) != XFER_TEST_SIZE))
+  {
+    fprintf(stderr, "Can't write %s.\n", FileName);
+    return 1;
+  }
+  close(File);
+
+  ToolArgv[2] = "import";
+  ToolArgv[4] = FileName;
+  ToolArgv[5] = NULL;
+  FlagDone = test_xfer(ToolArgv);
+  test_check(FlagDone, "import: flash_xfer_serve() and pico-flash-tool both report success");
+  test_check(FlagDone && (memcmp(Data, (UINT8 *)(XIP_BASE + XFER_TEST_OFFSET), XFER_TEST_SIZE) == 0), "import: flash content matches imported file");
+
+  unlink(FileName);
+  host_flash_close();
+
+  printf("%u checks, %u failed\n", TestChecks, TestFailures);
+
+  return (TestFailures != 0);
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_check() */
+/* ============================================================================================================================================================= *\
+                                                                Count a check and print its result.
+\* ============================================================================================================================================================= */
+static void test_check(UINT8 FlagPassed, const CHAR *Description)
+{
+  ++TestChecks;
+  if (!FlagPassed) ++TestFailures;
+
+  printf("%s  %s\n", FlagPassed ? "ok  " : "FAIL", Description);
+
+  return;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_file_read() */
+/* ============================================================================================================================================================= *\
+                                                             Read a file, return the number of bytes read.
+\* ============================================================================================================================================================= */
+static UINT32 test_file_read(const CHAR *FileName, UINT8 *Data, UINT32 DataSize)
+{
+  FILE *File;
+
+  UINT32 ReadSize;
+
+
+  File = fopen(FileName, "rb");
+  if (File == NULL) return 0;
+  ReadSize = fread(Data, 1, DataSize, File);
+  fclose(File);
+
+  return ReadSize;
+}
+
+
+
+
+
+/* $PAGE */
+/* $TITLE=test_xfer() */
+/* ============================================================================================================================================================= *\
+                                          Run the host tool against flash_xfer_serve(), return TRUE if both sides report success.
+             NOTE: The tool runs in a child process, with stdin / stdout on one end of a socket pair. Stdin / stdout of this process are redirected
+                   to the other end while flash_xfer_serve() is running, then restored.
+\* ============================================================================================================================================================= */
+static UINT8 test_xfer(CHAR *ToolArgv[])
+{
+  INT SavedIn;
+  INT SavedOut;
+  INT Socket[2];
+  INT WaitStatus;
+
+  UINT8 ReturnCode;
+
+  pid_t Pid;
+
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, Socket) != 0) return FALSE;
+
+  fflush(stdout);
+  Pid = fork();
+  if (Pid < 0) return FALSE;
+  if (Pid == 0)
+  {
+    /* Host tool, with device "-" on its end of the socket pair. */
+    dup2(Socket[1], STDIN_FILENO);
+    dup2(Socket[1], STDOUT_FILENO);
+    close(Socket[0]);
+    close(Socket[1]);
+    execv(ToolArgv[0], ToolArgv);
+    fprintf(stderr, "Can't run %s.\n", ToolArgv[0]);
+    _exit(127);
+  }
+  close(Socket[1]);
+
+  SavedIn  = dup(STDIN_FILENO);
+  SavedOut = dup(STDOUT_FILENO);
+  dup2(Socket[0], STDIN_FILENO);
+  dup2(Socket[0], STDOUT_FILENO);
+
+  ReturnCode = flash_xfer_serve(XFER_TEST_TIMEOUT_MSEC);
+
+  fflush(stdout);
+  dup2(SavedIn,  STDIN_FILENO);
+  dup2(SavedOut, STDOUT_FILENO);
+  close(SavedIn);
+  close(SavedOut);
+  close(Socket[0]);
+
+  if (waitpid(Pid, &WaitStatus, 0) != Pid) return FALSE;
+
+  return ((ReturnCode == 0) && WIFEXITED(WaitStatus) && (WEXITSTATUS(WaitStatus) == 0)) ? TRUE : FALSE;
+}
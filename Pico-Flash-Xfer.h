@@ -0,0 +1,49 @@
+/* ============================================================================================================================================================= *\
+   Pico-Flash-Xfer.h
+   Langage: C (Pico SDK and Linux gcc)
+
+   Definitions of the binary transfer of flash ranges shared by both sides: flash_xfer_serve() in Pico-Flash-Module (on the Pico) and Pico-Flash-Tool.c
+   (on the host). Included by Pico-Flash-Module.h and by Pico-Flash-Tool.c, so that both sides always use the same protocol values.
+
+   NOTE:
+   THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+   WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+   TIME. AS A RESULT, THE AUTHOR SHALL NOT BE HELD LIABLE FOR ANY DIRECT,
+   INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING FROM
+   THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE CODING
+   INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCT.
+\* ============================================================================================================================================================= */
+
+#ifndef __PICO_FLASH_XFER_H
+#define __PICO_FLASH_XFER_H
+
+/* $PAGE */
+/* $TITLE=Definitions */
+/* ============================================================================================================================================================= *\
+                                                                        Definitions.
+\* ============================================================================================================================================================= */
+/* Polynom used for CRC16 calculation (also used for the CRC16 of transfer frames). Different authorities use different polynoms:
+   0x8005, 0x1021, 0x1DCF, 0x755B, 0x5935, 0x3D65, 0x8BB7, 0x0589, 0xC867, 0xA02B, 0x2F15, 0x6815, 0xC599, 0x202D, 0x0805, 0x1CF5 */
+#ifndef CRC16_POLYNOM
+#define CRC16_POLYNOM           0x1021
+#endif  // CRC16_POLYNOM
+
+/* Each frame is made of: FLASH_XFER_SOF, type, sequence number, payload length (16 bits), payload, CRC16 of type up to the end of payload (16 bits).
+   16-bit values are little-endian. The receiver acknowledges data frames in order. The sender may send up to FLASH_XFER_WINDOW frames before waiting for
+   an acknowledge, and sends again all frames from the first one not acknowledged after a NAK or a time-out. The END frame closes the transfer and is
+   answered by an END frame giving the status. */
+#define FLASH_XFER_SOF          0xA5  // start of frame.
+#define FLASH_XFER_CHUNK_SIZE   1024  // maximum payload of a frame.
+#define FLASH_XFER_WINDOW       8     // frames sent before waiting for an acknowledge.
+#define FLASH_XFER_TIMEOUT_MSEC 500   // time-out before frames not acknowledged are sent again.
+#define FLASH_XFER_RETRY_MAX    10    // time-outs in a row before the transfer is aborted.
+
+/* Types of frames used for binary transfer. */
+#define FLASH_XFER_READ         0x01  // host to Pico: export a flash range (payload: offset and length, 32 bits each).
+#define FLASH_XFER_WRITE        0x02  // host to Pico: import an image to a flash range (payload: offset and length, 32 bits each).
+#define FLASH_XFER_DATA         0x03  // chunk of data.
+#define FLASH_XFER_ACK          0x04  // frames received in order up to this sequence number.
+#define FLASH_XFER_NAK          0x05  // frame with this sequence number was expected, send again from there.
+#define FLASH_XFER_END          0x06  // end of transfer (payload: CRC16 of the whole range (16 bits), then status: 0 = success).
+
+#endif  // __PICO_FLASH_XFER_H